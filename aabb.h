@@ -0,0 +1,82 @@
+#ifndef AABB_H
+#define AABB_H
+
+#include <algorithm>
+#include <limits>
+
+#include <QVector3D>
+
+inline QVector3D minComponents(const QVector3D &a, const QVector3D &b)
+{
+    return QVector3D(std::min(a.x(), b.x()), std::min(a.y(), b.y()), std::min(a.z(), b.z()));
+}
+
+inline QVector3D maxComponents(const QVector3D &a, const QVector3D &b)
+{
+    return QVector3D(std::max(a.x(), b.x()), std::max(a.y(), b.y()), std::max(a.z(), b.z()));
+}
+
+struct Aabb
+{
+    Aabb() = default;
+    Aabb(const QVector3D &min, const QVector3D &max) : min(min), max(max) {}
+
+    QVector3D min = QVector3D(1, 1, 1) * std::numeric_limits<float>::max();
+    QVector3D max = QVector3D(1, 1, 1) * -std::numeric_limits<float>::max();
+
+    bool isEmpty() const
+    {
+        return min.x() > max.x() || min.y() > max.y() || min.z() > max.z();
+    }
+    void extend(const QVector3D &point)
+    {
+        min = minComponents(min, point);
+        max = maxComponents(max, point);
+    }
+    void extend(const Aabb &other)
+    {
+        min = minComponents(min, other.min);
+        max = maxComponents(max, other.max);
+    }
+    bool contains(const QVector3D &point) const
+    {
+        return point.x() >= min.x() && point.y() >= min.y() && point.z() >= min.z()
+                && point.x() <= max.x() && point.y() <= max.y() && point.z() <= max.z();
+    }
+    bool intersects(const Aabb &other) const
+    {
+        return min.x() <= other.max.x() && min.y() <= other.max.y() && min.z() <= other.max.z()
+                && other.min.x() <= max.x() && other.min.y() <= max.y() && other.min.z() <= max.z();
+    }
+    QVector3D center() const
+    {
+        return (min + max) * 0.5f;
+    }
+    float surfaceArea() const
+    {
+        if (isEmpty())
+            return 0.0f;
+        const QVector3D size = max - min;
+        return 2.0f * (size.x() * size.y() + size.y() * size.z() + size.z() * size.x());
+    }
+
+    // slab test, returns distance along the ray where it enters the box
+    // (zero when starting inside) or infinity on miss or if it's farther than maxDistance
+    float entryDistance(
+            const QVector3D &origin,
+            const QVector3D &inverseDirection,
+            const float maxDistance) const
+    {
+        float entry = 0.0f;
+        float exit = maxDistance;
+        for (int axis = 0; axis < 3; ++axis) {
+            const float t0 = (min[axis] - origin[axis]) * inverseDirection[axis];
+            const float t1 = (max[axis] - origin[axis]) * inverseDirection[axis];
+            entry = std::max(entry, std::min(t0, t1));
+            exit = std::min(exit, std::max(t0, t1));
+        }
+        return entry <= exit ? entry : std::numeric_limits<float>::infinity();
+    }
+};
+
+#endif // AABB_H
@@ -0,0 +1,39 @@
+#include "allocations.h"
+
+#ifdef YART_COUNT_ALLOCATIONS
+#include <cstdlib>
+#include <new>
+
+namespace {
+
+thread_local qint64 threadAllocationCount = 0;
+
+}
+
+void *operator new(std::size_t size)
+{
+    ++threadAllocationCount;
+    if (void *pointer = std::malloc(size ? size : 1))
+        return pointer;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *pointer) noexcept
+{
+    std::free(pointer);
+}
+
+void operator delete(void *pointer, std::size_t) noexcept
+{
+    std::free(pointer);
+}
+#endif
+
+qint64 allocationCount()
+{
+#ifdef YART_COUNT_ALLOCATIONS
+    return threadAllocationCount;
+#else
+    return 0;
+#endif
+}
@@ -0,0 +1,10 @@
+#ifndef ALLOCATIONS_H
+#define ALLOCATIONS_H
+
+#include <QtGlobal>
+
+// global operator new calls made by the calling thread so far; they are counted
+// only in builds with CONFIG += count_allocations, otherwise it's always zero
+qint64 allocationCount();
+
+#endif // ALLOCATIONS_H
@@ -0,0 +1,220 @@
+#include "animation.h"
+
+#include <algorithm>
+
+#include <QFile>
+#include <QStringList>
+
+#include "profiler.h"
+
+bool Animation::load(const QString &fileName, Animation &animation, QString *error)
+{
+    const auto fail = [&](const QString &message) {
+        if (error)
+            *error = message;
+        return false;
+    };
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text))
+        return fail("can't open " + fileName);
+
+    Animation res;
+    int frameCount = -1;
+    int lastFrame = -1;
+    for (int lineNumber = 1; !file.atEnd(); ++lineNumber) {
+        QString line = QString::fromUtf8(file.readLine());
+        const int commentStart = line.indexOf('#');
+        if (commentStart >= 0)
+            line.truncate(commentStart);
+        const QStringList words = line.simplified().split(' ', Qt::SkipEmptyParts);
+        if (words.isEmpty())
+            continue;
+
+        const QString where = fileName + ":" + QString::number(lineNumber) + ": ";
+        // frames and indices come first, then coordinates
+        QVector<int> integers;
+        QVector<float> numbers;
+        const QString &type = words.first();
+        const int integerCount = type == "frames" || type == "camera" ? 1 : 2;
+        for (int index = 1; index < words.size(); ++index) {
+            bool isNumber = false;
+            if (index <= integerCount) {
+                integers.append(words.at(index).toInt(&isNumber));
+                if (!isNumber || integers.last() < 0)
+                    return fail(where + "expected a non negative integer instead of " + words.at(index));
+            } else {
+                numbers.append(words.at(index).toFloat(&isNumber));
+                if (!isNumber)
+                    return fail(where + "expected a number instead of " + words.at(index));
+            }
+        }
+        if (type == "frames") {
+            if (integers.size() != 1 || !numbers.isEmpty())
+                return fail(where + "expected frames <count>");
+            frameCount = integers.first();
+            continue;
+        }
+        if (type == "camera") {
+            if (integers.size() != 1 || numbers.size() != 4)
+                return fail(where + "expected camera <frame> <x> <y> <z> <size>");
+            res.addCameraKeyframe(integers.at(0), QVector3D(numbers.at(0), numbers.at(1), numbers.at(2)), numbers.at(3));
+        } else if (type == "sphere" || type == "bulb") {
+            if (integers.size() != 2 || numbers.size() != 3)
+                return fail(where + "expected " + type + " <frame> <index> <x> <y> <z>");
+            const QVector3D center(numbers.at(0), numbers.at(1), numbers.at(2));
+            if (type == "sphere")
+                res.addSphereKeyframe(integers.at(0), integers.at(1), center);
+            else
+                res.addBulbKeyframe(integers.at(0), integers.at(1), center);
+        } else {
+            return fail(where + "unknown keyframe " + type);
+        }
+        lastFrame = std::max(lastFrame, integers.first());
+    }
+    res.setFrameCount(frameCount >= 0 ? frameCount : lastFrame + 1);
+    if (res.frameCount() <= 0)
+        return fail(fileName + " has no frames");
+    animation = res;
+    return true;
+}
+
+void Animation::addCameraKeyframe(const int frame, const QVector3D &origin, const float size)
+{
+    camera_.add({frame, origin, size});
+}
+
+void Animation::addSphereKeyframe(const int frame, const int sphere, const QVector3D &center)
+{
+    track(spheres_, sphere).add({frame, center, 0.0f});
+}
+
+void Animation::addBulbKeyframe(const int frame, const int bulb, const QVector3D &center)
+{
+    track(bulbs_, bulb).add({frame, center, 0.0f});
+}
+
+bool Animation::fits(const FlatScene &scene, QString *error) const
+{
+    const auto fits = [&](const QVector<Track> &tracks, const int count, const char *name) {
+        for (const Track &track : tracks) {
+            if (track.index < count)
+                continue;
+            if (error)
+                *error = QString("keyframes of ") + name + " " + QString::number(track.index)
+                         + " of a scene of " + QString::number(count);
+            return false;
+        }
+        return true;
+    };
+    return fits(spheres_, scene.spheres().size(), "sphere") && fits(bulbs_, scene.bulbs().size(), "bulb");
+}
+
+Camera Animation::camera(const int frame, const Camera &base) const
+{
+    if (camera_.keyframes.isEmpty())
+        return base;
+    const Keyframe keyframe = camera_.at(frame);
+    Camera res = base;
+    res.origin = keyframe.position;
+    res.size = keyframe.size;
+    return res;
+}
+
+void Animation::apply(const int frame, FlatScene &scene, const QVector<int> &flatSpheres) const
+{
+    QVector<FlatScene::SphereEdit> sphereEdits;
+    sphereEdits.reserve(spheres_.size());
+    for (const Track &track : spheres_) {
+        const int index = flatSpheres.at(track.index);
+        sphereEdits.append({index, track.at(frame).position, scene.spheres().radius(index)});
+    }
+    scene.setSpheres(sphereEdits);
+
+    QVector<FlatScene::BulbEdit> bulbEdits;
+    bulbEdits.reserve(bulbs_.size());
+    for (const Track &track : bulbs_) {
+        FlatScene::PointLight bulb = scene.bulbs().at(track.index);
+        bulb.center = track.at(frame).position;
+        bulbEdits.append({track.index, bulb});
+    }
+    scene.setBulbs(bulbEdits);
+}
+
+void Animation::Track::add(const Keyframe &keyframe)
+{
+    const auto next = std::lower_bound(keyframes.begin(), keyframes.end(), keyframe.frame, [](const Keyframe &other, const int frame) {
+        return other.frame < frame;
+    });
+    if (next != keyframes.end() && next->frame == keyframe.frame)
+        *next = keyframe;
+    else
+        keyframes.insert(next, keyframe);
+}
+
+Animation::Keyframe Animation::Track::at(const int frame) const
+{
+    if (frame <= keyframes.first().frame)
+        return keyframes.first();
+    if (frame >= keyframes.last().frame)
+        return keyframes.last();
+    const auto next = std::upper_bound(keyframes.begin(), keyframes.end(), frame, [](const int frame, const Keyframe &other) {
+        return frame < other.frame;
+    });
+    const Keyframe &previous = *(next - 1);
+    const float t = float(frame - previous.frame) / (next->frame - previous.frame);
+    return {frame, previous.position + (next->position - previous.position) * t, previous.size + (next->size - previous.size) * t};
+}
+
+Animation::Track &Animation::track(QVector<Track> &tracks, const int index)
+{
+    const auto track = std::lower_bound(tracks.begin(), tracks.end(), index, [](const Track &other, const int index) {
+        return other.index < index;
+    });
+    if (track != tracks.end() && track->index == index)
+        return *track;
+    return *tracks.insert(track, Track{index, {}});
+}
+
+bool renderAnimation(
+        const Animation &animation,
+        FlatScene &scene,
+        const Camera &camera,
+        const TraceSettings &traceSettings,
+        const Antialiasing &antialiasing,
+        const int resolution,
+        QThreadPool &threadPool,
+        const int tileSize,
+        const std::function<bool(int frame, Framebuffer &framebuffer, const RenderStats &stats)> &frameReady)
+{
+    // spheres are stored in bvh order, its shape indices are the ones of the description
+    const FlatArray<int> &shapeIndices = scene.sphereBvh().shapeIndices();
+    QVector<int> flatSpheres(shapeIndices.size());
+    for (int index = 0; index < shapeIndices.size(); ++index)
+        flatSpheres[shapeIndices.at(index)] = index;
+
+    // moving shapes keeps the materials and bulb radii the kernel is picked for
+    const BatchKernel trace = batchKernel(kernelFeatures(scene, traceSettings));
+    ScratchArenas scratchArenas(threadPool.maxThreadCount());
+    Framebuffer framebuffers[2] = {Framebuffer(resolution, resolution), Framebuffer(resolution, resolution)};
+    Camera frameCamera = camera;
+    const auto shader = [&](const Sample *samples, const int count, Color *colors, Arena &scratch) {
+        const ArenaScope scope(scratch);
+        Ray *rays = scratch.allocateArray<Ray>(count);
+        frameCamera.generateRays(samples, count, resolution, rays);
+        trace(scene, traceSettings, rays, count, colors, scratch, nullptr, nullptr);
+    };
+
+    for (int frame = 0; frame < animation.frameCount(); ++frame) {
+        const ProfileEvent event("frame", {{"frame", frame}});
+        animation.apply(frame, scene, flatSpheres);
+        frameCamera = animation.camera(frame, camera);
+        Framebuffer &framebuffer = framebuffers[frame % 2];
+        RenderStats stats = render(framebuffer, threadPool, tileSize, scratchArenas, shader);
+        scratchArenas.reset();
+        stats += antialias(framebuffer, threadPool, tileSize, scratchArenas, shader, antialiasing);
+        scratchArenas.reset();
+        if (!frameReady(frame, framebuffer, stats))
+            return false;
+    }
+    return true;
+}
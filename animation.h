@@ -0,0 +1,90 @@
+#ifndef ANIMATION_H
+#define ANIMATION_H
+
+#include <functional>
+
+#include <QString>
+#include <QThreadPool>
+#include <QVector>
+#include <QVector3D>
+
+#include "camera.h"
+#include "flatscene.h"
+#include "framebuffer.h"
+#include "tilerenderer.h"
+#include "tracer.h"
+
+// keyframes of the camera and of spheres and bulbs moving through a scene; positions between
+// keyframes of an element are interpolated linearly, before its first and after its last one they are held
+class Animation
+{
+public:
+    // reads keyframes from a text file, one per line, '#' starts a comment; frames start at 0,
+    // spheres and bulbs are indexed in the order of the scene description:
+    //   frames <count>
+    //   camera <frame> <x> <y> <z> <size>, the origin and size of Camera
+    //   sphere <frame> <index> <x> <y> <z>
+    //   bulb <frame> <index> <x> <y> <z>
+    // frames defaults to one after the last keyframe; returns false and sets error, naming the line,
+    // if the file can't be read
+    static bool load(const QString &fileName, Animation &animation, QString *error = nullptr);
+
+    int frameCount() const { return frameCount_; }
+    void setFrameCount(int frameCount) { frameCount_ = frameCount; }
+    void addCameraKeyframe(int frame, const QVector3D &origin, float size);
+    void addSphereKeyframe(int frame, int sphere, const QVector3D &center);
+    void addBulbKeyframe(int frame, int bulb, const QVector3D &center);
+
+    // returns false and sets error if keyframes refer to spheres or bulbs scene doesn't have
+    bool fits(const FlatScene &scene, QString *error = nullptr) const;
+    // base moved to where the camera is at frame
+    Camera camera(int frame, const Camera &base) const;
+    // moves spheres and bulbs of the scene to where they are at frame, refitting its bvh instead of
+    // rebuilding it; flatSpheres gives scene indices of the spheres of the description
+    void apply(int frame, FlatScene &scene, const QVector<int> &flatSpheres) const;
+
+private:
+    struct Keyframe
+    {
+        int frame = 0;
+        QVector3D position;
+        // of the camera
+        float size = 0.0f;
+    };
+    // keyframes of an element by frame
+    struct Track
+    {
+        int index = 0;
+        QVector<Keyframe> keyframes;
+
+        // replaces the one of the same frame
+        void add(const Keyframe &keyframe);
+        Keyframe at(int frame) const;
+    };
+
+    static Track &track(QVector<Track> &tracks, int index);
+
+    int frameCount_ = 0;
+    Track camera_;
+    QVector<Track> spheres_;
+    QVector<Track> bulbs_;
+};
+
+// renders all frames of animation, moving spheres and bulbs of scene in place; the thread pool,
+// scratch arenas, kernel and two framebuffers are shared by all frames, a frame is traced and
+// antialiased as the last level of renderProgressive(); frameReady(frame, framebuffer, stats)
+// is called per frame and returns false to stop; the framebuffer it gets is rendered into again
+// two frames later, so saving it in the background overlaps with rendering the next frame
+// as long as the save is done by the next frameReady() call
+bool renderAnimation(
+        const Animation &animation,
+        FlatScene &scene,
+        const Camera &camera,
+        const TraceSettings &traceSettings,
+        const Antialiasing &antialiasing,
+        int resolution,
+        QThreadPool &threadPool,
+        int tileSize,
+        const std::function<bool(int frame, Framebuffer &framebuffer, const RenderStats &stats)> &frameReady);
+
+#endif // ANIMATION_H
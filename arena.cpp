@@ -0,0 +1,131 @@
+#include "arena.h"
+
+#include <algorithm>
+
+#include <QMutexLocker>
+
+namespace {
+
+// blocks are aligned for the widest simd loads and cache lines
+constexpr qsizetype blockAlignment = 64;
+
+}
+
+Arena::Arena(const qsizetype blockSize)
+    : blockSize_(std::max<qsizetype>(blockSize, blockAlignment))
+{
+}
+
+Arena::~Arena()
+{
+    reset();
+    for (const Block &block : blocks_)
+        ::operator delete[](block.data, std::align_val_t(blockAlignment));
+}
+
+void *Arena::allocate(const qsizetype size, const qsizetype alignment)
+{
+    for (;; ++block_, offset_ = 0) {
+        if (block_ == blocks_.size()) {
+            const qsizetype blockSize = std::max(blockSize_, size + alignment);
+            char *data = static_cast<char *>(::operator new[](blockSize, std::align_val_t(blockAlignment)));
+            blocks_.append({data, blockSize});
+        }
+        const Block &block = blocks_.at(block_);
+        const qsizetype start = (offset_ + alignment - 1) / alignment * alignment;
+        if (start + size <= block.size) {
+            offset_ = start + size;
+            return block.data + start;
+        }
+    }
+}
+
+void Arena::reserve(const qsizetype size)
+{
+    qsizetype available = 0;
+    for (int index = block_; index < blocks_.size(); ++index)
+        available += blocks_.at(index).size - (index == block_ ? offset_ : 0);
+    if (available >= size)
+        return;
+    const qsizetype blockSize = std::max(blockSize_, size - available);
+    char *data = static_cast<char *>(::operator new[](blockSize, std::align_val_t(blockAlignment)));
+    blocks_.append({data, blockSize});
+}
+
+void Arena::reset()
+{
+    destroyUntil(nullptr);
+    block_ = 0;
+    offset_ = 0;
+}
+
+Arena::Marker Arena::mark() const
+{
+    return {block_, offset_, destructors_};
+}
+
+void Arena::rewind(const Marker &marker)
+{
+    destroyUntil(static_cast<Destructor *>(marker.destructors));
+    block_ = marker.block;
+    offset_ = marker.offset;
+}
+
+qsizetype Arena::used() const
+{
+    qsizetype res = offset_;
+    for (int index = 0; index < block_ && index < blocks_.size(); ++index)
+        res += blocks_.at(index).size;
+    return res;
+}
+
+qsizetype Arena::capacity() const
+{
+    qsizetype res = 0;
+    for (const Block &block : blocks_)
+        res += block.size;
+    return res;
+}
+
+void Arena::destroyUntil(Destructor *last)
+{
+    for (; destructors_ != last; destructors_ = destructors_->previous)
+        destructors_->destroy(destructors_->object);
+}
+
+ScratchArenas::ScratchArenas(const int count, const qsizetype arenaSize)
+    : arenaSize_(arenaSize)
+{
+    for (int index = 0; index < count; ++index) {
+        arenas_.append(std::make_shared<Arena>());
+        arenas_.last()->reserve(arenaSize_);
+        free_.append(arenas_.last().get());
+    }
+}
+
+Arena &ScratchArenas::acquire()
+{
+    QMutexLocker locker(&mutex_);
+    if (free_.isEmpty()) {
+        // more workers than expected, the only case a frame allocates
+        arenas_.append(std::make_shared<Arena>());
+        arenas_.last()->reserve(arenaSize_);
+        return *arenas_.last();
+    }
+    Arena *arena = free_.last();
+    free_.removeLast();
+    return *arena;
+}
+
+void ScratchArenas::release(Arena &arena)
+{
+    QMutexLocker locker(&mutex_);
+    free_.append(&arena);
+}
+
+void ScratchArenas::reset()
+{
+    QMutexLocker locker(&mutex_);
+    for (const auto &arena : arenas_)
+        arena->reset();
+}
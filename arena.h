@@ -0,0 +1,130 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include <QMutex>
+#include <QVector>
+
+// bump allocator over large blocks: allocations are freed all together by reset() or rewind(),
+// which keep the blocks for what is allocated next, so a warmed up arena doesn't allocate;
+// objects made by create() are destroyed then too, in reverse order
+class Arena
+{
+public:
+    static constexpr qsizetype defaultBlockSize = 64 * 1024;
+
+    explicit Arena(qsizetype blockSize = defaultBlockSize);
+    ~Arena();
+    Arena(const Arena &) = delete;
+    Arena &operator=(const Arena &) = delete;
+
+    void *allocate(qsizetype size, qsizetype alignment = alignof(std::max_align_t));
+    // default constructed values, that must not need destruction
+    template <typename T>
+    T *allocateArray(qsizetype count);
+    template <typename T, typename... Args>
+    T *create(Args &&...args);
+
+    // makes sure that much can be allocated without another block
+    void reserve(qsizetype size);
+    void reset();
+
+    struct Marker
+    {
+        int block = 0;
+        qsizetype offset = 0;
+        void *destructors = nullptr;
+    };
+    // rewind(mark()) frees everything allocated after mark() was called
+    Marker mark() const;
+    void rewind(const Marker &marker);
+
+    // bytes allocated since the last reset, including alignment padding
+    qsizetype used() const;
+    qsizetype capacity() const;
+
+private:
+    struct Block
+    {
+        char *data = nullptr;
+        qsizetype size = 0;
+    };
+    struct Destructor
+    {
+        void (*destroy)(void *object);
+        void *object;
+        Destructor *previous;
+    };
+
+    void destroyUntil(Destructor *last);
+
+    qsizetype blockSize_ = defaultBlockSize;
+    QVector<Block> blocks_;
+    int block_ = 0;
+    qsizetype offset_ = 0;
+    Destructor *destructors_ = nullptr;
+};
+
+// frees what is allocated in the arena during the scope when it ends
+class ArenaScope
+{
+public:
+    explicit ArenaScope(Arena &arena) : arena_(arena), marker_(arena.mark()) {}
+    ~ArenaScope() { arena_.rewind(marker_); }
+    ArenaScope(const ArenaScope &) = delete;
+    ArenaScope &operator=(const ArenaScope &) = delete;
+
+private:
+    Arena &arena_;
+    Arena::Marker marker_;
+};
+
+// an arena per worker for scratch memory of frame lifetime, reserved up front;
+// workers acquire() one while rendering a tile, so they never share one
+class ScratchArenas
+{
+public:
+    static constexpr qsizetype defaultArenaSize = 256 * 1024;
+
+    ScratchArenas(int count, qsizetype arenaSize = defaultArenaSize);
+
+    Arena &acquire();
+    void release(Arena &arena);
+    // frees everything allocated in the arenas, none of them may be acquired
+    void reset();
+
+private:
+    QMutex mutex_;
+    qsizetype arenaSize_ = defaultArenaSize;
+    QVector<std::shared_ptr<Arena>> arenas_;
+    QVector<Arena *> free_;
+};
+
+template <typename T>
+T *Arena::allocateArray(const qsizetype count)
+{
+    static_assert(std::is_trivially_destructible<T>::value, "array elements aren't destroyed");
+    T *values = static_cast<T *>(allocate(count * qsizetype(sizeof(T)), alignof(T)));
+    for (qsizetype index = 0; index < count; ++index)
+        new (values + index) T();
+    return values;
+}
+
+template <typename T, typename... Args>
+T *Arena::create(Args &&...args)
+{
+    T *object = new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    if (!std::is_trivially_destructible<T>::value) {
+        Destructor *destructor = static_cast<Destructor *>(allocate(sizeof(Destructor), alignof(Destructor)));
+        *destructor = {[](void *object) { static_cast<T *>(object)->~T(); }, object, destructors_};
+        destructors_ = destructor;
+    }
+    return object;
+}
+
+#endif // ARENA_H
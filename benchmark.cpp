@@ -0,0 +1,886 @@
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <random>
+
+#include <QBuffer>
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFile>
+#ifdef YART_GPU
+#include <QGuiApplication>
+#endif
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QThread>
+#include <QThreadPool>
+#include <QVector>
+
+#ifdef Q_OS_WIN
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#include "animation.h"
+#include "denoiser.h"
+#include "distributed.h"
+#include "flatscene.h"
+#include "framebuffer.h"
+#include "gpurenderer.h"
+#include "preview.h"
+#include "profiler.h"
+#include "renderer.h"
+#include "scenes.h"
+#include "spheres.h"
+#include "tilerenderer.h"
+#include "tracer.h"
+
+namespace {
+
+struct BenchmarkScene
+{
+    QString name;
+    std::function<SceneDescription(quint32 seed)> generate;
+};
+
+const QVector<BenchmarkScene> &benchmarkScenes()
+{
+    static const QVector<BenchmarkScene> scenes = {
+        {"default", [](quint32) { return defaultScene(); }},
+        {"spheres-1k", [](const quint32 seed) { return randomScene(1000, 2, seed); }},
+        {"matte-1k", [](const quint32 seed) {
+             SceneDescription res = randomScene(1000, 2, seed);
+             for (const auto &shape : res.shapes)
+                 shape->mirror = 0.0f;
+             return res;
+         }},
+        {"spheres-100k", [](const quint32 seed) { return randomScene(100000, 2, seed); }},
+        {"spheres-1m", [](const quint32 seed) { return randomScene(1000000, 2, seed); }},
+        {"many-lights", [](const quint32 seed) { return randomScene(1000, 64, seed); }},
+        {"local-lights", [](const quint32 seed) { return randomScene(1000, 256, seed, defaultCamera().size * 0.5f); }},
+        {"planes", [](quint32) { return planesScene(); }},
+        {"instances-1k", [](const quint32 seed) { return instancedScene(1000, seed); }},
+        {"instances-10k", [](const quint32 seed) { return instancedScene(10000, seed); }},
+    };
+    return scenes;
+}
+
+double elapsedMs(const QElapsedTimer &timer)
+{
+    return timer.nsecsElapsed() / 1e6;
+}
+
+// peak resident set size of the process so far
+qint64 peakMemoryBytes()
+{
+#ifdef Q_OS_WIN
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return 0;
+    return static_cast<qint64>(counters.PeakWorkingSetSize);
+#else
+    rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+#ifdef Q_OS_MACOS
+    return usage.ru_maxrss;
+#else
+    return static_cast<qint64>(usage.ru_maxrss) * 1024;
+#endif
+#endif
+}
+
+double median(QVector<double> values)
+{
+    if (values.isEmpty())
+        return 0.0;
+    std::sort(values.begin(), values.end());
+    const int middle = values.size() / 2;
+    return values.size() % 2 ? values.at(middle) : (values.at(middle - 1) + values.at(middle)) * 0.5;
+}
+
+double perSecond(const qint64 count, const double ms)
+{
+    return ms > 0.0 ? count / (ms / 1000.0) : 0.0;
+}
+
+// tests random rays against random runs of spheres with both the packet kernels and the scalar ones,
+// skipping a random few of them, and counts the rays they give another sphere or distance for;
+// rays start inside spheres too, half of them are aimed at one, and runs start at any sphere as the
+// ones of bvh leaves do; where rounding may differ, e.g. once the compiler fuses the scalar multiplies
+// and adds, rays grazing a sphere or hitting it about as far as their limit may go either way
+QJsonObject verifyKernels(const int rayCount, const quint32 seed, qint64 &mismatches)
+{
+    std::mt19937 engine(seed);
+    // one coordinate after the other, arguments of a call are evaluated in any order
+    const auto point = [&] {
+        const float x = uniform(engine, -4.0f, 4.0f);
+        const float y = uniform(engine, -4.0f, 4.0f);
+        return QVector3D(x, y, uniform(engine, -4.0f, 4.0f));
+    };
+    const double tolerance = 1e-4;
+
+    SphereArray spheres;
+    QVector<bool> skipped;
+    qint64 closestHitMismatches = 0;
+    qint64 anyHitMismatches = 0;
+    qint64 closestHits = 0;
+    qint64 anyHits = 0;
+    for (int ray = 0; ray < rayCount; ++ray) {
+        if (ray % 64 == 0) {
+            spheres = SphereArray();
+            skipped.clear();
+            for (int index = uniformInt(engine, 1, 4 * simd::width + 1); index > 0; --index) {
+                const QVector3D center = point();
+                spheres.append(center, uniform(engine, 0.1f, 2.0f));
+                skipped.append(uniform(engine, 0.0f, 1.0f) < 0.2f);
+            }
+        }
+        const int first = uniformInt(engine, 0, spheres.size() - 1);
+        const int count = uniformInt(engine, 1, spheres.size() - first);
+        const QVector3D origin = point();
+        QVector3D direction = point();
+        if (uniform(engine, 0.0f, 1.0f) < 0.5f)
+            direction = spheres.center(uniformInt(engine, first, first + count - 1)) - origin + direction * 0.25f;
+        if (direction.isNull())
+            direction = QVector3D(0, 0, 1);
+        direction.normalize();
+        const auto isSkippedIndex = [&](const int index) { return skipped.at(index); };
+        // in double, whether the ray grazes the sphere or hits it within tolerance of limit
+        const auto isBorderline = [&](const int index, const float limit) {
+            const double mX = double(origin.x()) - spheres.center(index).x();
+            const double mY = double(origin.y()) - spheres.center(index).y();
+            const double mZ = double(origin.z()) - spheres.center(index).z();
+            const double b = direction.x() * mX + direction.y() * mY + direction.z() * mZ;
+            const double c = mX * mX + mY * mY + mZ * mZ - spheres.radiusSquared().at(index);
+            const double discr = b * b - c;
+            if (std::abs(discr) <= tolerance * std::max(b * b, std::abs(c)) || std::abs(c) <= tolerance)
+                return true;
+            const double t = std::max(0.0, -b - std::sqrt(std::max(0.0, discr)));
+            return std::abs(t - limit) <= tolerance * std::max(1.0, t);
+        };
+
+        const float maxDistance = uniform(engine, 0.0f, 1.0f) < 0.5f ? std::numeric_limits<float>::max() : uniform(engine, 0.5f, 16.0f);
+        float packetDistance = maxDistance;
+        float scalarDistance = maxDistance;
+        const int packetHit = spheres.closestHit(first, count, origin, direction, packetDistance, isSkippedIndex);
+        const int scalarHit = spheres.closestHitScalar(first, count, origin, direction, scalarDistance, isSkippedIndex);
+        closestHits += scalarHit >= 0;
+        if (packetHit == scalarHit) {
+            if (std::abs(packetDistance - scalarDistance) > tolerance * std::max(1.0f, scalarDistance)
+                    && !isBorderline(scalarHit, scalarDistance))
+                ++closestHitMismatches;
+        } else if ((packetHit >= 0 && !isBorderline(packetHit, scalarDistance))
+                   || (scalarHit >= 0 && !isBorderline(scalarHit, packetDistance))) {
+            ++closestHitMismatches;
+        }
+        const int packetAnyHit = spheres.anyHit(first, count, origin, direction, maxDistance, isSkippedIndex);
+        const int scalarAnyHit = spheres.anyHitScalar(first, count, origin, direction, maxDistance, isSkippedIndex);
+        anyHits += scalarAnyHit >= 0;
+        if (packetAnyHit != scalarAnyHit
+                && ((packetAnyHit >= 0 && !isBorderline(packetAnyHit, maxDistance))
+                    || (scalarAnyHit >= 0 && !isBorderline(scalarAnyHit, maxDistance))))
+            ++anyHitMismatches;
+    }
+    mismatches += closestHitMismatches + anyHitMismatches;
+    return {
+        {"simd", simd::name},
+        {"rays", rayCount},
+        {"closestHits", closestHits},
+        {"closestHitMismatches", closestHitMismatches},
+        {"anyHits", anyHits},
+        {"anyHitMismatches", anyHitMismatches},
+    };
+}
+
+// renders the scene in a preview, then applies edits one at a time, updating it after each:
+// a sphere moved a little, a light color changed, a material changed; cachesPrimaryHits
+// keeps the primary hits of tiles only shaded again
+QJsonObject benchmarkEdits(
+        const FlatScene &scene,
+        const Camera &camera,
+        const TraceSettings &traceSettings,
+        const Antialiasing &antialiasing,
+        const int resolution,
+        const int tileSize,
+        const int threadCount,
+        const int editCount,
+        const bool cachesPrimaryHits,
+        const quint32 seed)
+{
+    PreviewRenderer preview(scene, camera, traceSettings, antialiasing, resolution, tileSize, threadCount);
+    preview.setCachesPrimaryHits(cachesPrimaryHits);
+    QElapsedTimer timer;
+    timer.start();
+    preview.update();
+    const double fullUpdateMs = elapsedMs(timer);
+
+    std::mt19937 engine(seed);
+    const QVector3D maxOffset(0.5f, 0.5f, 0.5f);
+    QVector<double> updateTimes;
+    qint64 dirtyTiles = 0;
+    RayStats rays;
+    for (int edit = 0; edit < editCount; ++edit) {
+        switch (edit % 3) {
+        case 0: {
+            const int sphere = uniformInt(engine, 0, preview.sphereCount() - 1);
+            preview.moveSphere(sphere, preview.sphereCenter(sphere) + uniform(engine, -maxOffset, maxOffset));
+            break;
+        }
+        case 1: {
+            const int light = uniformInt(engine, 0, preview.lightCount() - 1);
+            preview.setLightColor(light, uniform(engine, Color(), Color(1, 1, 1)));
+            break;
+        }
+        default: {
+            const int sphere = uniformInt(engine, 0, preview.sphereCount() - 1);
+            const Color color = uniform(engine, Color(), Color(1, 1, 1));
+            preview.setSphereMaterial(sphere, color, uniform(engine, 0.0f, 1.0f) < 0.25f ? 0.5f : 0.0f);
+            break;
+        }
+        }
+        dirtyTiles += preview.dirtyTileCount();
+        timer.restart();
+        rays += preview.update().rays;
+        updateTimes.append(elapsedMs(timer));
+    }
+    const int tilesPerRow = (resolution + tileSize - 1) / tileSize;
+    return QJsonObject{
+        {"edits", editCount},
+        {"tiles", tilesPerRow * tilesPerRow},
+        {"fullUpdateMs", fullUpdateMs},
+        {"msPerEdit", median(updateTimes)},
+        {"dirtyTilesPerEdit", editCount ? double(dirtyTiles) / editCount : 0.0},
+        {"primaryRaysPerEdit", editCount ? double(rays.primary) / editCount : 0.0},
+        {"cachedPrimaryRaysPerEdit", editCount ? double(rays.cachedPrimary) / editCount : 0.0},
+        {"primaryHitCacheBytes", preview.primaryHitCacheBytes()},
+    };
+}
+
+// renders the scene's final frame with its tiles leased to nodes of a thread each, connected
+// over local tcp, for every count of nodes; speedups are against the first count
+QJsonArray benchmarkNodes(
+        const FlatScene &scene,
+        const Camera &camera,
+        const TraceSettings &traceSettings,
+        const Antialiasing &antialiasing,
+        const int resolution,
+        const int tileSize,
+        const QVector<int> &nodeCounts)
+{
+    RenderJob job;
+    job.resolution = resolution;
+    job.tileSize = tileSize;
+    job.camera = camera;
+    job.antialiasing = antialiasing;
+    job.traceSettings = traceSettings;
+    job.sphereCount = scene.spheres().size();
+    job.bulbCount = scene.bulbs().size();
+    QJsonArray res;
+    double firstMs = 0.0;
+    for (const int nodeCount : nodeCounts) {
+        RenderCoordinator coordinator(job, 60000);
+        QString error;
+        if (!coordinator.listen(0, &error)) {
+            std::cerr << error.toStdString() << "\n";
+            break;
+        }
+        QElapsedTimer timer;
+        timer.start();
+        QVector<std::shared_ptr<QThread>> nodes;
+        for (int node = 0; node < nodeCount; ++node) {
+            nodes.append(std::shared_ptr<QThread>(QThread::create([&, port = coordinator.port()] {
+                QThreadPool threadPool;
+                threadPool.setMaxThreadCount(1);
+                QString nodeError;
+                if (!renderForCoordinator("127.0.0.1", port, scene, threadPool, &nodeError))
+                    std::cerr << nodeError.toStdString() << "\n";
+            })));
+            nodes.last()->start();
+        }
+        coordinator.run();
+        const double ms = elapsedMs(timer);
+        for (const auto &node : nodes)
+            node->wait();
+        if (res.isEmpty())
+            firstMs = ms;
+        res.append(QJsonObject{
+            {"nodes", nodeCount},
+            {"ms", ms},
+            {"speedup", ms > 0.0 ? firstMs / ms : 0.0},
+            {"tilesLeasedAgain", coordinator.leases().reassignedCount()},
+        });
+    }
+    return res;
+}
+
+// renders frameCount frames of every sphere drifting along a random direction by up to its radius
+// per frame, refitting the bvh; nodes visited per traversal of the first and last frames show how
+// the refit bvh degrades, applyMs what moving the spheres and refitting costs per frame; frames aren't encoded
+QJsonObject benchmarkAnimation(
+        const FlatScene &scene,
+        const Camera &camera,
+        const TraceSettings &traceSettings,
+        const Antialiasing &antialiasing,
+        const int resolution,
+        const int tileSize,
+        QThreadPool &threadPool,
+        const int frameCount,
+        const quint32 seed)
+{
+    Animation animation;
+    animation.setFrameCount(frameCount);
+    std::mt19937 engine(seed);
+    const QVector3D corner(1, 1, 1);
+    const FlatArray<int> &shapeIndices = scene.sphereBvh().shapeIndices();
+    for (int index = 0; index < shapeIndices.size(); ++index) {
+        const QVector3D center = scene.spheres().center(index);
+        const QVector3D direction = uniform(engine, -corner, corner).normalized();
+        const float distance = scene.spheres().radius(index) * (frameCount - 1) * uniform(engine, -1.0f, 1.0f);
+        animation.addSphereKeyframe(0, shapeIndices.at(index), center);
+        animation.addSphereKeyframe(frameCount - 1, shapeIndices.at(index), center + direction * distance);
+    }
+
+    QVector<int> flatSpheres(shapeIndices.size());
+    for (int index = 0; index < shapeIndices.size(); ++index)
+        flatSpheres[shapeIndices.at(index)] = index;
+    FlatScene applied = scene;
+    QVector<double> applyTimes;
+    QElapsedTimer timer;
+    for (int frame = 0; frame < frameCount; ++frame) {
+        timer.restart();
+        animation.apply(frame, applied, flatSpheres);
+        applyTimes.append(elapsedMs(timer));
+    }
+
+    FlatScene animated = scene;
+    QVector<double> frameTimes;
+    double firstNodesPerTraversal = 0.0;
+    double lastNodesPerTraversal = 0.0;
+    timer.restart();
+    renderAnimation(animation, animated, camera, traceSettings, antialiasing, resolution, threadPool, tileSize,
+                    [&](const int frame, Framebuffer &, const RenderStats &stats) {
+        frameTimes.append(elapsedMs(timer));
+        const double nodesPerTraversal = stats.traversal.nodesVisited / double(std::max<qint64>(1, stats.traversal.traversals));
+        if (frame == 0)
+            firstNodesPerTraversal = nodesPerTraversal;
+        lastNodesPerTraversal = nodesPerTraversal;
+        timer.restart();
+        return true;
+    });
+    return {
+        {"frames", frameCount},
+        {"msPerFrame", median(frameTimes)},
+        {"applyMs", median(applyTimes)},
+        {"firstFrameNodesPerTraversal", firstNodesPerTraversal},
+        {"lastFrameNodesPerTraversal", lastNodesPerTraversal},
+    };
+}
+
+// rms difference of two frames as displayed, over all channels
+double rmsError(const Framebuffer &frame, const Framebuffer &reference)
+{
+    double sum = 0.0;
+    for (int y = 0; y < frame.height(); ++y)
+        for (int x = 0; x < frame.width(); ++x)
+            for (int channel = 0; channel < 3; ++channel) {
+                const double difference = std::clamp(frame.pixel(x, y)[channel], 0.0f, 1.0f)
+                        - std::clamp(reference.pixel(x, y)[channel], 0.0f, 1.0f);
+                sum += difference * difference;
+            }
+    return std::sqrt(sum / std::max(1, frame.width() * frame.height() * 3));
+}
+
+// renders the frame with every pixel supersampled by each sampling pattern at 1, 4, 16 and 64 samples,
+// comparing it to a reference of 256 sobol samples scrambled by another seed; samplesNeeded has the
+// fewest samples of a pattern that got within every noise level, 0 if none of them did; with guides
+// every frame is also denoised and denoisedSamplesNeeded counts the same for the denoised frames
+template <typename BatchShader>
+QJsonObject benchmarkConvergence(
+        const int resolution,
+        QThreadPool &threadPool,
+        const int tileSize,
+        ScratchArenas &scratchArenas,
+        const BatchShader &shader,
+        const QVector<double> &noiseLevels,
+        const DenoiseGuides *guides,
+        const DenoiseSettings &denoiseSettings)
+{
+    const auto renderWith = [&](const Antialiasing &antialiasing, RenderStats &stats) {
+        Framebuffer framebuffer(resolution, resolution);
+        stats = render(framebuffer, threadPool, tileSize, scratchArenas, shader);
+        scratchArenas.reset();
+        stats += antialias(framebuffer, threadPool, tileSize, scratchArenas, shader, antialiasing);
+        scratchArenas.reset();
+        return framebuffer;
+    };
+    const int referenceSamples = 256;
+    Antialiasing referenceAntialiasing;
+    // below the contrast of any pixel
+    referenceAntialiasing.contrastThreshold = -1.0f;
+    referenceAntialiasing.samplesPerPixel = referenceSamples;
+    referenceAntialiasing.pattern = sampling::Sobol;
+    referenceAntialiasing.seed = 1;
+    RenderStats stats;
+    const Framebuffer reference = renderWith(referenceAntialiasing, stats);
+
+    struct NamedPattern
+    {
+        QString name;
+        sampling::Pattern pattern;
+    };
+    const QVector<NamedPattern> patterns = {
+        {"grid", sampling::Grid},
+        {"random", sampling::Random},
+        {"sobol", sampling::Sobol},
+    };
+    QJsonArray levels;
+    for (const double level : noiseLevels)
+        levels.append(level);
+    QJsonArray patternReports;
+    for (const auto &pattern : patterns) {
+        QVector<int> samplesNeeded(noiseLevels.size(), 0);
+        QVector<int> denoisedSamplesNeeded(noiseLevels.size(), 0);
+        QJsonArray errors;
+        for (const int samples : {1, 4, 16, 64}) {
+            Antialiasing antialiasing = referenceAntialiasing;
+            antialiasing.samplesPerPixel = samples;
+            antialiasing.pattern = pattern.pattern;
+            antialiasing.seed = 0;
+            QElapsedTimer timer;
+            timer.start();
+            Framebuffer frame = renderWith(antialiasing, stats);
+            const double ms = elapsedMs(timer);
+            const double error = rmsError(frame, reference);
+            for (int level = 0; level < noiseLevels.size(); ++level)
+                if (samplesNeeded.at(level) == 0 && error <= noiseLevels.at(level))
+                    samplesNeeded[level] = samples;
+            QJsonObject errorReport{
+                {"samples", samples},
+                {"samplesTraced", stats.samplesTraced},
+                {"rmsError", error},
+                {"ms", ms},
+            };
+            if (guides) {
+                timer.restart();
+                denoise(frame, *guides, denoiseSettings, threadPool, tileSize, scratchArenas);
+                errorReport.insert("denoiseMs", elapsedMs(timer));
+                const double denoisedError = rmsError(frame, reference);
+                for (int level = 0; level < noiseLevels.size(); ++level)
+                    if (denoisedSamplesNeeded.at(level) == 0 && denoisedError <= noiseLevels.at(level))
+                        denoisedSamplesNeeded[level] = samples;
+                errorReport.insert("denoisedRmsError", denoisedError);
+            }
+            errors.append(errorReport);
+        }
+        const auto toJson = [](const QVector<int> &counts) {
+            QJsonArray res;
+            for (const int count : counts)
+                res.append(count);
+            return res;
+        };
+        QJsonObject patternReport{
+            {"pattern", pattern.name},
+            {"errors", errors},
+            {"samplesNeeded", toJson(samplesNeeded)},
+        };
+        if (guides)
+            patternReport.insert("denoisedSamplesNeeded", toJson(denoisedSamplesNeeded));
+        patternReports.append(patternReport);
+    }
+    return {
+        {"referenceSamples", referenceSamples},
+        {"noiseLevels", levels},
+        {"patterns", patternReports},
+    };
+}
+
+// submits requestCount requests for the final frame of the scene at once to a Renderer of threadCount
+// threads, then one cancelled right away and one already past its deadline; latencies are from
+// submitting a request to having its frame, the other two shouldn't take any time
+QJsonObject benchmarkRequests(
+        const FlatScene &scene,
+        const Camera &camera,
+        const TraceSettings &traceSettings,
+        const Antialiasing &antialiasing,
+        const int resolution,
+        const int tileSize,
+        const int threadCount,
+        const int requestCount)
+{
+    Renderer renderer(threadCount, tileSize);
+    RenderRequest request;
+    request.scene = renderer.addScene(scene);
+    request.camera = camera;
+    request.resolution = resolution;
+    request.traceSettings = traceSettings;
+    request.antialiasing = antialiasing;
+    request.quantizes = true;
+    QElapsedTimer timer;
+    timer.start();
+    QVector<std::shared_ptr<RenderTicket>> tickets;
+    for (int index = 0; index < requestCount; ++index)
+        tickets.append(renderer.submit(request));
+    tickets.append(renderer.submit(request));
+    tickets.last()->cancel();
+    RenderRequest late = request;
+    late.timeoutMs = 0;
+    tickets.append(renderer.submit(late));
+    for (const auto &ticket : tickets)
+        ticket->wait();
+    const double ms = elapsedMs(timer);
+    const Renderer::Metrics metrics = renderer.metrics();
+    return {
+        {"requests", requestCount},
+        {"ms", ms},
+        {"requestsPerSecond", perSecond(requestCount, ms)},
+        {"done", metrics.done},
+        {"cancelled", metrics.cancelled},
+        {"timedOut", metrics.timedOut},
+        {"maxQueueDepth", metrics.maxQueueDepth},
+        {"medianLatencyMs", metrics.medianLatencyMs},
+        {"p95LatencyMs", metrics.p95LatencyMs},
+        {"maxLatencyMs", metrics.maxLatencyMs},
+    };
+}
+
+// renders the final frame repeats times on the gpu and compares it to cpuFrame, the same frame traced
+// on the cpu, as displayed; speedup is against cpuMs, the time the cpu took to trace and antialias it
+QJsonObject benchmarkGpu(
+        const FlatScene &scene,
+        const Camera &camera,
+        const TraceSettings &traceSettings,
+        const Antialiasing &antialiasing,
+        const Framebuffer &cpuFrame,
+        const double cpuMs,
+        const int repeats)
+{
+    GpuRenderer renderer;
+    QString error;
+    QElapsedTimer timer;
+    timer.start();
+    if (!renderer.load(scene, &error))
+        return {{"error", error}};
+    const double uploadMs = elapsedMs(timer);
+    Framebuffer framebuffer(cpuFrame.width(), cpuFrame.height());
+    QVector<double> frameTimes;
+    RenderStats stats;
+    for (int repeat = 0; repeat < repeats; ++repeat) {
+        timer.restart();
+        if (!renderer.render(framebuffer, camera, traceSettings, antialiasing, &stats, &error))
+            return {{"error", error}};
+        frameTimes.append(elapsedMs(timer));
+    }
+
+    float maxDifference = 0.0f;
+    qint64 pixelsDiffering = 0;
+    for (int y = 0; y < framebuffer.height(); ++y)
+        for (int x = 0; x < framebuffer.width(); ++x) {
+            float difference = 0.0f;
+            for (int channel = 0; channel < 3; ++channel)
+                difference = std::max(difference, std::abs(std::clamp(framebuffer.pixel(x, y)[channel], 0.0f, 1.0f)
+                                                            - std::clamp(cpuFrame.pixel(x, y)[channel], 0.0f, 1.0f)));
+            maxDifference = std::max(maxDifference, difference);
+            // by more than a step of 8 bit output
+            if (difference > 1.0f / 255)
+                ++pixelsDiffering;
+        }
+    const double ms = median(frameTimes);
+    return {
+        {"uploadMs", uploadMs},
+        {"msPerFrame", ms},
+        {"speedup", ms > 0.0 ? cpuMs / ms : 0.0},
+        {"samples", stats.samplesTraced / repeats},
+        {"maxDifference", maxDifference},
+        {"pixelsDiffering", pixelsDiffering},
+    };
+}
+
+}
+
+// renders every scene repeats times at a fixed seed and prints the measurements as json;
+// build with CONFIG += count_allocations to also fail when tracing allocates
+int main(int argc, char **argv)
+{
+#ifdef YART_GPU
+    QGuiApplication application(argc, argv);
+#else
+    QCoreApplication application(argc, argv);
+#endif
+
+    QStringList sceneNames;
+    for (const BenchmarkScene &scene : benchmarkScenes())
+        sceneNames.append(scene.name);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Renders standard scenes and reports their timings as json.");
+    parser.addHelpOption();
+    const QCommandLineOption seedOption("seed", "Seed of random scenes.", "seed", "1");
+    const QCommandLineOption repeatsOption("repeats", "Frames rendered per scene.", "count", "3");
+    const QCommandLineOption resolutionOption("resolution", "Width and height of frames.", "pixels", "512");
+    const QCommandLineOption threadsOption("threads", "Worker threads, all cores by default.", "count",
+                                           QString::number(QThread::idealThreadCount()));
+    const QCommandLineOption scenesOption("scenes", "Comma separated scenes to render: " + sceneNames.join(", ") + ".",
+                                          "names", sceneNames.join(","));
+    const QCommandLineOption outputOption("output", "File to write the report to instead of standard output.", "file");
+    const QCommandLineOption traceOption("trace", "Chrome trace file of all frames, in builds with CONFIG += profiling.", "file");
+    const QCommandLineOption sortRaysOption("sort-rays", "Sort reflected rays of every batch by direction and origin before tracing them.");
+    const QCommandLineOption genericKernelOption("generic-kernel", "Trace with the kernel handling all scene features instead of the one specialized for every scene.");
+    const QCommandLineOption nodesOption("nodes", "Comma separated counts of local worker nodes of a thread each to render every scene with, "
+                                         "leasing them its tiles over tcp; none by default.", "counts");
+    const QCommandLineOption editsOption("edits", "Scene edits applied to an interactive preview of every scene, none by default.", "count", "0");
+    const QCommandLineOption cachePrimaryHitsOption("cache-primary-hits", "Keep the primary hits of every sample of the preview "
+                                                    "across edits that don't move spheres.");
+    const QCommandLineOption framesOption("frames", "Frames of an animation of every scene moving all its spheres, refitting its bvh, "
+                                          "none by default.", "count", "0");
+    const QCommandLineOption perspectiveOption("perspective", "View scenes with a perspective camera of the field of view instead of "
+                                               "the orthographic one.", "degrees");
+    const QCommandLineOption gpuOption("gpu", "Also render every scene with the opengl compute shader and compare it to the cpu frame, "
+                                       "in builds with CONFIG += gpu.");
+    const QCommandLineOption noiseLevelsOption("noise-levels", "Comma separated rms errors, e.g. 0.02,0.01,0.005, to find the samples per pixel "
+                                               "every sampling pattern needs to get within for every scene; none by default.", "errors");
+    const QCommandLineOption denoiseOption("denoise", "Denoise every frame before encoding it, guided by the normals and albedo "
+                                           "of its primary hits, and the frames of --noise-levels as well.");
+    const QCommandLineOption requestsOption("requests", "Requests for the final frame of every scene submitted at once to a Renderer, "
+                                            "none by default.", "count", "0");
+    const QCommandLineOption verifyOption("verify", "Check the packet kernels against the scalar ones on random rays and spheres "
+                                          "before rendering, failing if they disagree.", "rays", "0");
+    parser.addOptions({seedOption, repeatsOption, resolutionOption, threadsOption, scenesOption, outputOption, traceOption, sortRaysOption, genericKernelOption, nodesOption, editsOption, cachePrimaryHitsOption, framesOption, perspectiveOption, gpuOption, noiseLevelsOption, denoiseOption, requestsOption, verifyOption});
+    parser.process(application);
+
+    const quint32 seed = parser.value(seedOption).toUInt();
+    const int repeats = std::max(1, parser.value(repeatsOption).toInt());
+    const int resolution = std::max(1, parser.value(resolutionOption).toInt());
+    const int threadCount = std::max(1, parser.value(threadsOption).toInt());
+    const int editCount = std::max(0, parser.value(editsOption).toInt());
+    const int frameCount = std::max(0, parser.value(framesOption).toInt());
+    const int requestCount = std::max(0, parser.value(requestsOption).toInt());
+    const int verifiedRayCount = std::max(0, parser.value(verifyOption).toInt());
+    QVector<int> nodeCounts;
+    for (const QString &count : parser.value(nodesOption).split(',', Qt::SkipEmptyParts))
+        nodeCounts.append(std::max(1, count.toInt()));
+    QVector<double> noiseLevels;
+    for (const QString &level : parser.value(noiseLevelsOption).split(',', Qt::SkipEmptyParts))
+        noiseLevels.append(level.toDouble());
+    const QStringList requestedScenes = parser.value(scenesOption).split(',', Qt::SkipEmptyParts);
+
+    // same settings as main()
+    const Antialiasing antialiasing;
+    const DenoiseSettings denoiseSettings;
+    const bool denoises = parser.isSet(denoiseOption);
+    TraceSettings traceSettings;
+    traceSettings.colorOnMiss = Color(0, 0, 1);
+    traceSettings.colorOnFullShade = Color(0.1, 0.1, 0.1);
+    traceSettings.maxDepth = 8;
+    traceSettings.minThroughput = 1.0f / 1024;
+    traceSettings.sortSecondaryRays = parser.isSet(sortRaysOption);
+    const int tileSize = 32;
+    const int bvhLeafSize = simd::width;
+    Camera camera = defaultCamera();
+    if (parser.isSet(perspectiveOption)) {
+        camera.projection = Camera::Perspective;
+        camera.size = parser.value(perspectiveOption).toFloat();
+    }
+
+    QThreadPool threadPool;
+    threadPool.setMaxThreadCount(threadCount);
+    ScratchArenas scratchArenas(threadCount);
+
+    qint64 kernelMismatches = 0;
+    const QJsonObject kernelReport = verifiedRayCount > 0 ? verifyKernels(verifiedRayCount, seed, kernelMismatches) : QJsonObject();
+
+    QJsonArray sceneReports;
+    qint64 tracingAllocations = 0;
+    for (const QString &sceneName : requestedScenes) {
+        const auto scene = std::find_if(benchmarkScenes().begin(), benchmarkScenes().end(), [&](const BenchmarkScene &candidate) {
+            return candidate.name == sceneName;
+        });
+        if (scene == benchmarkScenes().end()) {
+            std::cerr << "unknown scene " << sceneName.toStdString() << ", expected one of " << sceneNames.join(", ").toStdString() << "\n";
+            return 1;
+        }
+
+        QElapsedTimer timer;
+        timer.start();
+        const SceneDescription description = scene->generate(seed);
+        const double generateMs = elapsedMs(timer);
+        timer.restart();
+        const FlatScene flatScene = FlatScene::compile(description.shapes, description.lights, bvhLeafSize);
+        const double compileMs = elapsedMs(timer);
+        const int features = parser.isSet(genericKernelOption) ? int(kernel::All) : kernelFeatures(flatScene, traceSettings);
+        const BatchKernel trace = batchKernel(features);
+
+        const auto shader = [&](const Sample *samples, const int count, Color *colors, Arena &scratch) {
+            const ArenaScope scope(scratch);
+            Ray *rays = scratch.allocateArray<Ray>(count);
+            camera.generateRays(samples, count, resolution, rays);
+            trace(flatScene, traceSettings, rays, count, colors, scratch, nullptr, nullptr);
+        };
+
+        QJsonArray frameReports;
+        QVector<double> frameTimes;
+        RayStats rays;
+        Bvh::TraversalStats traversal;
+        double tracingMs = 0.0;
+        QVector<double> tracingTimes;
+        Framebuffer lastFrame;
+        for (int repeat = 0; repeat < repeats; ++repeat) {
+            Framebuffer framebuffer(resolution, resolution);
+            timer.restart();
+            RenderStats stats = render(framebuffer, threadPool, tileSize, scratchArenas, shader);
+            scratchArenas.reset();
+            const double renderMs = elapsedMs(timer);
+            timer.restart();
+            stats += antialias(framebuffer, threadPool, tileSize, scratchArenas, shader, antialiasing);
+            scratchArenas.reset();
+            const double antialiasMs = elapsedMs(timer);
+            tracingTimes.append(renderMs + antialiasMs);
+            if (parser.isSet(gpuOption) && repeat == repeats - 1)
+                lastFrame = framebuffer;
+            // guides are traced again for every frame, as a frame of a moved camera would need
+            double denoiseMs = 0.0;
+            if (denoises) {
+                timer.restart();
+                const DenoiseGuides guides = traceDenoiseGuides(flatScene, camera, resolution, threadPool, tileSize, scratchArenas);
+                denoise(framebuffer, guides, denoiseSettings, threadPool, tileSize, scratchArenas);
+                denoiseMs = elapsedMs(timer);
+            }
+            timer.restart();
+            const QImage image = framebuffer.toImage();
+            const double quantizeMs = elapsedMs(timer);
+            timer.restart();
+            QBuffer encoded;
+            encoded.open(QIODevice::WriteOnly);
+            image.save(&encoded, "PNG");
+            const double encodeMs = elapsedMs(timer);
+
+            const double frameMs = renderMs + antialiasMs + denoiseMs + quantizeMs + encodeMs;
+            frameTimes.append(frameMs);
+            rays += stats.rays;
+            traversal += stats.traversal;
+            tracingMs += renderMs + antialiasMs;
+            tracingAllocations += stats.allocations;
+            QJsonObject frameReport{
+                {"renderMs", renderMs},
+                {"antialiasMs", antialiasMs},
+                {"denoiseMs", denoiseMs},
+                {"quantizeMs", quantizeMs},
+                {"encodeMs", encodeMs},
+                {"frameMs", frameMs},
+                {"samples", stats.samplesTraced},
+                {"allocations", stats.allocations},
+            };
+#ifdef YART_PROFILING
+            // summed over worker threads
+            frameReport.insert("closestHitsMs", stats.stages[Stage::ClosestHits] / 1e6);
+            frameReport.insert("shadingMs", stats.stages[Stage::Shading] / 1e6);
+            frameReport.insert("tilesMs", stats.stages[Stage::Tiles] / 1e6);
+            frameReport.insert("slowestTileMs", stats.slowestTileNanoseconds / 1e6);
+#endif
+            frameReports.append(frameReport);
+        }
+
+        const Bvh::BuildStats &bvhStats = flatScene.sphereBvh().buildStats();
+        QJsonObject sceneReport{
+            {"name", scene->name},
+            {"spheres", bvhStats.shapeCount},
+            {"planes", flatScene.planes().size()},
+            {"instances", flatScene.instances().size()},
+            // stored once per mesh, and as placed by all instances
+            {"triangles", flatScene.triangles().size()},
+            {"instancedTriangles", flatScene.shapeCount() - flatScene.firstTriangleShape()},
+            {"lights", flatScene.bulbs().size()},
+            {"kernelFeatures", features},
+            {"generateMs", generateMs},
+            {"compileMs", compileMs},
+            {"bvhBuildMs", bvhStats.buildTimeMs},
+            {"msPerFrame", median(frameTimes)},
+            {"primaryRaysPerSecond", perSecond(rays.primary, tracingMs)},
+            {"reflectionRaysPerSecond", perSecond(rays.reflection, tracingMs)},
+            {"shadowRaysPerSecond", perSecond(rays.shadow, tracingMs)},
+            {"hits", rays.hits},
+            {"shadowsBlocked", rays.shadowsBlocked},
+            {"shadowsBlockedByLastOccluder", rays.shadowsBlockedByLastOccluder},
+            {"bvhTraversals", traversal.traversals},
+            {"bvhNodesVisited", traversal.nodesVisited},
+            {"shapesTested", traversal.shapesTested},
+            // a high water mark, it includes the scenes before this one
+            {"processPeakMemoryBytesSoFar", peakMemoryBytes()},
+            {"frames", frameReports},
+        };
+        // preview footprints allocate, so these aren't counted with tracing
+        if (!nodeCounts.isEmpty())
+            sceneReport.insert("distributed", benchmarkNodes(flatScene, camera, traceSettings, antialiasing, resolution, tileSize, nodeCounts));
+        if (frameCount > 0)
+            sceneReport.insert("animation", benchmarkAnimation(flatScene, camera, traceSettings, antialiasing, resolution, tileSize, threadPool, frameCount, seed));
+        if (parser.isSet(gpuOption))
+            sceneReport.insert("gpu", benchmarkGpu(flatScene, camera, traceSettings, antialiasing, lastFrame, median(tracingTimes), repeats));
+        if (!noiseLevels.isEmpty()) {
+            const DenoiseGuides guides = denoises ? traceDenoiseGuides(flatScene, camera, resolution, threadPool, tileSize, scratchArenas) : DenoiseGuides();
+            sceneReport.insert("convergence", benchmarkConvergence(resolution, threadPool, tileSize, scratchArenas, shader, noiseLevels,
+                                                                   denoises ? &guides : nullptr, denoiseSettings));
+        }
+        if (requestCount > 0)
+            sceneReport.insert("requests", benchmarkRequests(flatScene, camera, traceSettings, antialiasing, resolution, tileSize, threadCount, requestCount));
+        if (editCount > 0)
+            sceneReport.insert("preview", benchmarkEdits(flatScene, camera, traceSettings, antialiasing, resolution, tileSize, threadCount, editCount,
+                                                         parser.isSet(cachePrimaryHitsOption), seed));
+        sceneReports.append(sceneReport);
+    }
+
+    QJsonObject report{
+        {"seed", static_cast<qint64>(seed)},
+        {"repeats", repeats},
+        {"resolution", resolution},
+        {"threads", threadCount},
+        {"simd", simd::name},
+        {"sortSecondaryRays", traceSettings.sortSecondaryRays},
+        {"camera", camera.projection == Camera::Perspective ? "perspective" : "orthographic"},
+        {"peakMemoryBytes", peakMemoryBytes()},
+        {"scenes", sceneReports},
+    };
+    if (verifiedRayCount > 0)
+        report.insert("kernels", kernelReport);
+#ifdef YART_COUNT_ALLOCATIONS
+    report.insert("tracingAllocations", tracingAllocations);
+#endif
+    const QByteArray json = QJsonDocument(report).toJson();
+    if (parser.isSet(traceOption)) {
+        QString error;
+        if (!profiling::isEnabled)
+            std::cerr << "built without profiling, no trace is recorded\n";
+        else if (!profiling::saveTrace(parser.value(traceOption), &error)) {
+            std::cerr << error.toStdString() << "\n";
+            return 1;
+        }
+    }
+
+    if (parser.isSet(outputOption)) {
+        QFile output(parser.value(outputOption));
+        if (!output.open(QIODevice::WriteOnly) || output.write(json) != json.size()) {
+            std::cerr << "can't write " << output.fileName().toStdString() << "\n";
+            return 1;
+        }
+    } else {
+        std::cout << json.constData();
+    }
+
+    if (kernelMismatches > 0) {
+        std::cerr << kernelMismatches << " rays the " << simd::name << " kernels disagree with the scalar ones on\n";
+        return 1;
+    }
+#ifdef YART_COUNT_ALLOCATIONS
+    if (tracingAllocations > 0) {
+        std::cerr << tracingAllocations << " allocations while tracing\n";
+        return 1;
+    }
+#endif
+    return 0;
+}
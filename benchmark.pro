@@ -0,0 +1,12 @@
+# standard scenes rendered at a fixed seed, timings are printed as json, see benchmark.cpp
+QT += core gui
+CONFIG += console
+CONFIG += c++17
+# the ray rates and hit counts it reports need the rays counted
+CONFIG += ray_stats
+SOURCES += \
+        benchmark.cpp
+
+include(raytracer.pri)
+
+win32: LIBS += -lpsapi
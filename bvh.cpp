@@ -0,0 +1,178 @@
+#include "bvh.h"
+
+#include <numeric>
+
+#include <QElapsedTimer>
+
+#include "profiler.h"
+
+
+namespace {
+
+constexpr int binCount = 16;
+
+struct Bin
+{
+    Aabb bounds;
+    int count = 0;
+};
+
+thread_local Bvh::TraversalStats threadStats;
+
+}
+
+Bvh::TraversalStats &Bvh::TraversalStats::operator+=(const TraversalStats &other)
+{
+    traversals += other.traversals;
+    nodesVisited += other.nodesVisited;
+    shapesTested += other.shapesTested;
+    return *this;
+}
+
+Bvh::TraversalStats Bvh::TraversalStats::operator-(const TraversalStats &other) const
+{
+    TraversalStats res;
+    res.traversals = traversals - other.traversals;
+    res.nodesVisited = nodesVisited - other.nodesVisited;
+    res.shapesTested = shapesTested - other.shapesTested;
+    return res;
+}
+
+Bvh::Bvh(const FlatArray<Node> &nodes, const FlatArray<int> &shapeIndices, const BuildStats &buildStats)
+    : nodes_(nodes), shapeIndices_(shapeIndices), buildStats_(buildStats)
+{
+}
+
+Bvh Bvh::build(const QVector<Aabb> &shapeBounds, const int maxLeafSize)
+{
+    const ProfileEvent event("bvh build", {{"shapes", shapeBounds.size()}});
+    QElapsedTimer timer;
+    timer.start();
+
+    Bvh bvh;
+    const int nShapes = shapeBounds.size();
+    bvh.buildStats_.shapeCount = nShapes;
+    bvh.buildStats_.maxLeafSize = std::max(1, maxLeafSize);
+    if (nShapes == 0)
+        return bvh;
+
+    QVector<QVector3D> shapeCenters;
+    shapeCenters.reserve(nShapes);
+    for (const Aabb &bounds : shapeBounds)
+        shapeCenters.append(bounds.center());
+
+    bvh.shapeIndices_.resize(nShapes);
+    std::iota(bvh.shapeIndices_.begin(), bvh.shapeIndices_.end(), 0);
+    bvh.nodes_.reserve(2 * nShapes - 1);
+    bvh.nodes_.append(Node());
+    bvh.buildNode(0, 0, nShapes, 1, shapeBounds, shapeCenters);
+
+    bvh.buildStats_.nodeCount = bvh.nodes_.size();
+    bvh.buildStats_.buildTimeMs = timer.nsecsElapsed() / 1e6;
+    return bvh;
+}
+
+Bvh::TraversalStats Bvh::threadTraversalStats()
+{
+    return threadStats;
+}
+
+void Bvh::addThreadTraversalStats(const TraversalStats &stats)
+{
+    threadStats += stats;
+}
+
+void Bvh::buildNode(
+        const int nodeIndex,
+        const int first,
+        const int count,
+        const int depth,
+        const QVector<Aabb> &shapeBounds,
+        const QVector<QVector3D> &shapeCenters)
+{
+    Aabb bounds;
+    Aabb centerBounds;
+    for (int index = first; index < first + count; ++index) {
+        const int shapeIndex = shapeIndices_.at(index);
+        bounds.extend(shapeBounds.at(shapeIndex));
+        centerBounds.extend(shapeCenters.at(shapeIndex));
+    }
+    nodes_[nodeIndex].bounds = bounds;
+    buildStats_.depth = std::max(buildStats_.depth, depth);
+
+    if (count <= buildStats_.maxLeafSize || depth >= maxDepth) {
+        nodes_[nodeIndex].first = first;
+        nodes_[nodeIndex].count = count;
+        ++buildStats_.leafCount;
+        return;
+    }
+
+    // surface area heuristic over binned centers: the split minimizing
+    // sum of child area * child shape count wins
+    float bestCost = std::numeric_limits<float>::max();
+    int bestAxis = -1;
+    int bestBin = -1;
+    for (int axis = 0; axis < 3; ++axis) {
+        const float extent = centerBounds.max[axis] - centerBounds.min[axis];
+        if (extent <= 0.0f)
+            continue;
+        const float scale = binCount / extent;
+        const auto binIndex = [&](const QVector3D &center) {
+            return std::min(binCount - 1, static_cast<int>((center[axis] - centerBounds.min[axis]) * scale));
+        };
+
+        Bin bins[binCount];
+        for (int index = first; index < first + count; ++index) {
+            const int shapeIndex = shapeIndices_.at(index);
+            Bin &bin = bins[binIndex(shapeCenters.at(shapeIndex))];
+            bin.bounds.extend(shapeBounds.at(shapeIndex));
+            ++bin.count;
+        }
+
+        // costs of the right sides are gathered first, so a single left to right sweep is enough
+        float rightCosts[binCount - 1];
+        Aabb rightBounds;
+        int rightCount = 0;
+        for (int bin = binCount - 1; bin > 0; --bin) {
+            rightBounds.extend(bins[bin].bounds);
+            rightCount += bins[bin].count;
+            rightCosts[bin - 1] = rightCount ? rightBounds.surfaceArea() * rightCount : -1.0f;
+        }
+        Aabb leftBounds;
+        int leftCount = 0;
+        for (int bin = 0; bin < binCount - 1; ++bin) {
+            leftBounds.extend(bins[bin].bounds);
+            leftCount += bins[bin].count;
+            if (!leftCount || rightCosts[bin] < 0.0f)
+                continue;
+            const float cost = leftBounds.surfaceArea() * leftCount + rightCosts[bin];
+            if (cost >= bestCost)
+                continue;
+            bestCost = cost;
+            bestAxis = axis;
+            bestBin = bin;
+        }
+    }
+
+    int middle = first + count / 2;
+    if (bestAxis >= 0) {
+        const float scale = binCount / (centerBounds.max[bestAxis] - centerBounds.min[bestAxis]);
+        const auto isLeft = [&](const int shapeIndex) {
+            const float offset = shapeCenters.at(shapeIndex)[bestAxis] - centerBounds.min[bestAxis];
+            return std::min(binCount - 1, static_cast<int>(offset * scale)) <= bestBin;
+        };
+        middle = static_cast<int>(std::partition(
+                                      shapeIndices_.begin() + first,
+                                      shapeIndices_.begin() + first + count,
+                                      isLeft) - shapeIndices_.begin());
+    }
+    // else all centers coincide and the shapes are just split in halves
+
+    const int leftIndex = nodes_.size();
+    nodes_.append(Node());
+    nodes_.append(Node());
+    nodes_[nodeIndex].first = leftIndex;
+    nodes_[nodeIndex].count = 0;
+    buildNode(leftIndex, first, middle - first, depth + 1, shapeBounds, shapeCenters);
+    buildNode(leftIndex + 1, middle, first + count - middle, depth + 1, shapeBounds, shapeCenters);
+}
@@ -0,0 +1,188 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <limits>
+#include <utility>
+
+#include <QVector>
+#include <QVector3D>
+
+#include "aabb.h"
+#include "flatarray.h"
+
+// bounding volume hierarchy over shape bounds, built with binned SAH;
+// it knows nothing about shapes themselves, leaves refer to them by index
+class Bvh
+{
+public:
+    struct BuildStats
+    {
+        int shapeCount = 0;
+        int nodeCount = 0;
+        int leafCount = 0;
+        int depth = 0;
+        int maxLeafSize = 0;
+        double buildTimeMs = 0.0;
+    };
+    struct TraversalStats
+    {
+        qint64 traversals = 0;
+        qint64 nodesVisited = 0;
+        qint64 shapesTested = 0;
+
+        TraversalStats &operator+=(const TraversalStats &other);
+        TraversalStats operator-(const TraversalStats &other) const;
+    };
+
+    struct Node
+    {
+        Aabb bounds;
+        // leaf: shapes are shapeIndices()[first, first + count),
+        // otherwise count is zero and children are nodes()[first] and nodes()[first + 1]
+        int first = 0;
+        int count = 0;
+    };
+
+    Bvh() = default;
+    // from nodes and shape indices of a bvh built before
+    Bvh(const FlatArray<Node> &nodes, const FlatArray<int> &shapeIndices, const BuildStats &buildStats);
+
+    static Bvh build(const QVector<Aabb> &shapeBounds, int maxLeafSize = 4);
+
+    const BuildStats &buildStats() const { return buildStats_; }
+    // root first
+    const FlatArray<Node> &nodes() const { return nodes_; }
+    // shape indices in the order leaves refer to them
+    const FlatArray<int> &shapeIndices() const { return shapeIndices_; }
+
+    // accumulated over all traversals made by the calling thread
+    static TraversalStats threadTraversalStats();
+
+    // visits leaves front to back and calls testLeaf(first, count, maxDistance) for every one
+    // with its range in shapeIndices(), which is also the range of its shapes in arrays stored
+    // in leaf order, as the spheres of FlatScene are; testLeaf may lower maxDistance to cull
+    // farther nodes, or return true to stop the traversal; direction is expected to be normalized;
+    // returns whether the traversal was stopped
+    template <typename TestLeaf>
+    bool traverseLeaves(
+            const QVector3D &origin,
+            const QVector3D &direction,
+            float maxDistance,
+            TestLeaf &&testLeaf) const;
+    // calls visitShape(shapeIndex) for every shape of the leaves whose bounds contain point,
+    // their own bounds may not contain it
+    template <typename VisitShape>
+    void visitAt(const QVector3D &point, VisitShape &&visitShape) const;
+
+    // updates node bounds bottom up after shapes moved, leafBounds(first, count) gives
+    // bounds of shapes of a leaf by their range in shapeIndices(); the tree is kept as is,
+    // so it gets slower to traverse the farther shapes go from where it was built for
+    template <typename LeafBounds>
+    void refit(LeafBounds &&leafBounds);
+
+private:
+    static constexpr int maxDepth = 64;
+
+    void buildNode(
+            int nodeIndex,
+            int first,
+            int count,
+            int depth,
+            const QVector<Aabb> &shapeBounds,
+            const QVector<QVector3D> &shapeCenters);
+    static void addThreadTraversalStats(const TraversalStats &stats);
+
+    FlatArray<Node> nodes_;
+    FlatArray<int> shapeIndices_;
+    BuildStats buildStats_;
+};
+
+template <typename TestLeaf>
+bool Bvh::traverseLeaves(
+        const QVector3D &origin,
+        const QVector3D &direction,
+        float maxDistance,
+        TestLeaf &&testLeaf) const
+{
+    if (nodes_.isEmpty())
+        return false;
+
+    struct Entry
+    {
+        int nodeIndex;
+        float distance;
+    };
+    Entry stack[maxDepth + 1];
+    int stackSize = 0;
+
+    const QVector3D inverseDirection(1.0f / direction.x(), 1.0f / direction.y(), 1.0f / direction.z());
+    const float rootDistance = nodes_.at(0).bounds.entryDistance(origin, inverseDirection, maxDistance);
+    if (rootDistance <= maxDistance)
+        stack[stackSize++] = {0, rootDistance};
+
+    TraversalStats stats;
+    stats.traversals = 1;
+    bool isStopped = false;
+    while (stackSize > 0 && !isStopped) {
+        const Entry entry = stack[--stackSize];
+        if (entry.distance > maxDistance)
+            continue;
+        const Node &node = nodes_.at(entry.nodeIndex);
+        ++stats.nodesVisited;
+        if (node.count > 0) {
+            stats.shapesTested += node.count;
+            isStopped = testLeaf(node.first, node.count, maxDistance);
+            continue;
+        }
+        Entry near{node.first, nodes_.at(node.first).bounds.entryDistance(origin, inverseDirection, maxDistance)};
+        Entry far{node.first + 1, nodes_.at(node.first + 1).bounds.entryDistance(origin, inverseDirection, maxDistance)};
+        if (far.distance < near.distance)
+            std::swap(near, far);
+        if (far.distance <= maxDistance)
+            stack[stackSize++] = far;
+        if (near.distance <= maxDistance)
+            stack[stackSize++] = near;
+    }
+    addThreadTraversalStats(stats);
+    return isStopped;
+}
+
+template <typename VisitShape>
+void Bvh::visitAt(const QVector3D &point, VisitShape &&visitShape) const
+{
+    if (nodes_.isEmpty())
+        return;
+
+    int stack[maxDepth + 1];
+    int stackSize = 0;
+    stack[stackSize++] = 0;
+    while (stackSize > 0) {
+        const Node &node = nodes_.at(stack[--stackSize]);
+        if (!node.bounds.contains(point))
+            continue;
+        if (node.count > 0) {
+            for (int index = node.first; index < node.first + node.count; ++index)
+                visitShape(shapeIndices_.at(index));
+            continue;
+        }
+        stack[stackSize++] = node.first + 1;
+        stack[stackSize++] = node.first;
+    }
+}
+
+template <typename LeafBounds>
+void Bvh::refit(LeafBounds &&leafBounds)
+{
+    // children always come after their parent
+    for (int nodeIndex = nodes_.size() - 1; nodeIndex >= 0; --nodeIndex) {
+        Node &node = nodes_[nodeIndex];
+        if (node.count > 0) {
+            node.bounds = leafBounds(node.first, node.count);
+            continue;
+        }
+        node.bounds = nodes_.at(node.first).bounds;
+        node.bounds.extend(nodes_.at(node.first + 1).bounds);
+    }
+}
+
+#endif // BVH_H
@@ -0,0 +1,75 @@
+#ifndef CAMERA_H
+#define CAMERA_H
+
+#include <cmath>
+
+#include <QVector3D>
+
+#include "tracer.h"
+
+// position of a sample in pixel coordinates
+struct Sample
+{
+    float x = 0.0f;
+    float y = 0.0f;
+};
+
+// rays through the pixels of a square image of any resolution centered on direction, pixels x go
+// along right() and rows y along down(); orthographic rays go along direction from a square of size,
+// perspective ones start at origin and spread over a field of view of size degrees
+struct Camera
+{
+    enum Projection
+    {
+        Orthographic,
+        Perspective,
+    };
+
+    Projection projection = Orthographic;
+    QVector3D origin;
+    QVector3D direction = QVector3D(-1, 0, 0);
+    // what the top of the image faces, it doesn't have to be perpendicular to direction
+    QVector3D up = QVector3D(0, 0, -1);
+    float size = 0.0f;
+
+    QVector3D right() const
+    {
+        const QVector3D res = QVector3D::crossProduct(up, direction);
+        // looking along up, any perpendicular will do
+        if (res.lengthSquared() > 0.0f)
+            return res.normalized();
+        const QVector3D other = std::abs(direction.x()) < std::abs(direction.z()) ? QVector3D(1, 0, 0) : QVector3D(0, 0, 1);
+        return QVector3D::crossProduct(other, direction).normalized();
+    }
+    QVector3D down() const { return QVector3D::crossProduct(right(), direction).normalized(); }
+
+    // rays through samples of an image of given resolution; the camera basis and the pixel steps are
+    // computed once for the batch, so the loop over samples is plain multiply adds
+    void generateRays(const Sample *samples, const int count, const int resolution, Ray *rays) const
+    {
+        const QVector3D right = this->right();
+        const QVector3D down = this->down();
+        if (projection == Orthographic) {
+            const float delimeter = resolution / size;
+            const float half = size * 0.5f;
+            for (int index = 0; index < count; ++index) {
+                const float x = samples[index].x / delimeter - half;
+                const float y = samples[index].y / delimeter - half;
+                rays[index] = {origin + right * x + down * y, direction};
+            }
+            return;
+        }
+        // the image spans the field of view on a plane at distance 1
+        const QVector3D forward = direction.normalized();
+        const float span = 2.0f * std::tan(size * float(M_PI) / 360.0f);
+        const float step = span / resolution;
+        const float half = span * 0.5f;
+        for (int index = 0; index < count; ++index) {
+            const float x = samples[index].x * step - half;
+            const float y = samples[index].y * step - half;
+            rays[index] = {origin, (forward + right * x + down * y).normalized()};
+        }
+    }
+};
+
+#endif // CAMERA_H
@@ -0,0 +1,123 @@
+#include "denoiser.h"
+
+#include <cmath>
+#include <algorithm>
+
+#include "tilerenderer.h"
+#include "tracer.h"
+
+namespace {
+
+// the b3 spline, the taps of a pass along each axis
+constexpr float taps[5] = {1.0f / 16, 1.0f / 4, 3.0f / 8, 1.0f / 4, 1.0f / 16};
+
+// one pass of taps step pixels apart from source to target
+void filterPass(
+        const Framebuffer &source,
+        Framebuffer &target,
+        const DenoiseGuides &guides,
+        const Tile &tile,
+        const int step,
+        const float colorSigma,
+        const DenoiseSettings &settings)
+{
+    const float colorFactor = -1.0f / (colorSigma * colorSigma);
+    const float normalFactor = -1.0f / (settings.normalSigma * settings.normalSigma);
+    const float albedoFactor = -1.0f / (settings.albedoSigma * settings.albedoSigma);
+    for (int y = tile.y; y < tile.y + tile.height; ++y)
+        for (int x = tile.x; x < tile.x + tile.width; ++x) {
+            const Color color = source.pixel(x, y);
+            const QVector3D normal = guides.normals.pixel(x, y);
+            const Color albedo = guides.albedo.pixel(x, y);
+            Color sum;
+            float weightSum = 0.0f;
+            for (int tapY = 0; tapY < 5; ++tapY) {
+                const int neighbourY = y + (tapY - 2) * step;
+                if (neighbourY < 0 || neighbourY >= source.height())
+                    continue;
+                for (int tapX = 0; tapX < 5; ++tapX) {
+                    const int neighbourX = x + (tapX - 2) * step;
+                    if (neighbourX < 0 || neighbourX >= source.width())
+                        continue;
+                    const Color neighbour = source.pixel(neighbourX, neighbourY);
+                    const float exponent = (neighbour - color).lengthSquared() * colorFactor
+                            + (guides.normals.pixel(neighbourX, neighbourY) - normal).lengthSquared() * normalFactor
+                            + (guides.albedo.pixel(neighbourX, neighbourY) - albedo).lengthSquared() * albedoFactor;
+                    const float weight = taps[tapX] * taps[tapY] * std::exp(exponent);
+                    sum += neighbour * weight;
+                    weightSum += weight;
+                }
+            }
+            // the pixel itself always has weight
+            target.setPixel(x, y, sum / weightSum);
+        }
+}
+
+}
+
+DenoiseGuides traceDenoiseGuides(
+        const FlatScene &scene,
+        const Camera &camera,
+        const int resolution,
+        QThreadPool &threadPool,
+        const int tileSize,
+        ScratchArenas &scratchArenas)
+{
+    DenoiseGuides guides{Framebuffer(resolution, resolution), Framebuffer(resolution, resolution)};
+    renderTiles(resolution, resolution, threadPool, tileSize, scratchArenas, [&](const Tile &tile, RenderStats &, Arena &scratch) {
+        const ArenaScope scope(scratch);
+        Sample *samples = scratch.allocateArray<Sample>(maxBatchSize);
+        Ray *rays = scratch.allocateArray<Ray>(maxBatchSize);
+        PrimaryHit *hits = scratch.allocateArray<PrimaryHit>(maxBatchSize);
+        const int pixelCount = tile.width * tile.height;
+        for (int first = 0; first < pixelCount; first += maxBatchSize) {
+            const int count = std::min(maxBatchSize, pixelCount - first);
+            for (int index = 0; index < count; ++index)
+                samples[index] = {float(tile.x + (first + index) % tile.width), float(tile.y + (first + index) / tile.width)};
+            camera.generateRays(samples, count, resolution, rays);
+            closestHits(scene, rays, count, hits);
+            for (int index = 0; index < count; ++index) {
+                const PrimaryHit &hit = hits[index];
+                if (hit.shape < 0)
+                    continue;
+                const int x = static_cast<int>(samples[index].x);
+                const int y = static_cast<int>(samples[index].y);
+                // facing the ray, as flat shapes are shaded
+                QVector3D normal = scene.shapeNormal(hit.shape, rays[index].origin + rays[index].direction * hit.distance);
+                if (QVector3D::dotProduct(normal, rays[index].direction) > 0.0f)
+                    normal = -normal;
+                guides.normals.setPixel(x, y, normal);
+                guides.albedo.setPixel(x, y, scene.materials().at(scene.shapeMaterial(hit.shape)).color);
+            }
+        }
+    });
+    scratchArenas.reset();
+    return guides;
+}
+
+void denoise(
+        Framebuffer &framebuffer,
+        const DenoiseGuides &guides,
+        const DenoiseSettings &settings,
+        QThreadPool &threadPool,
+        const int tileSize,
+        ScratchArenas &scratchArenas)
+{
+    const ProfileEvent event("denoise", {{"resolution", framebuffer.width()}});
+    // passes go back and forth between the two
+    Framebuffer other(framebuffer.width(), framebuffer.height());
+    Framebuffer *source = &framebuffer;
+    Framebuffer *target = &other;
+    float colorSigma = settings.colorSigma;
+    for (int pass = 0; pass < settings.passes; ++pass) {
+        const int step = 1 << pass;
+        renderTiles(framebuffer.width(), framebuffer.height(), threadPool, tileSize, scratchArenas, [&](const Tile &tile, RenderStats &, Arena &) {
+            filterPass(*source, *target, guides, tile, step, colorSigma, settings);
+        });
+        std::swap(source, target);
+        colorSigma *= 0.5f;
+    }
+    scratchArenas.reset();
+    if (source != &framebuffer)
+        framebuffer = std::move(other);
+}
@@ -0,0 +1,50 @@
+#ifndef DENOISER_H
+#define DENOISER_H
+
+#include <QThreadPool>
+
+#include "arena.h"
+#include "camera.h"
+#include "flatscene.h"
+#include "framebuffer.h"
+
+// normal and albedo of the surface seen through the corner of every pixel of a square frame,
+// where render() samples it; pixels seeing nothing have a zero normal and albedo
+struct DenoiseGuides
+{
+    Framebuffer normals;
+    Framebuffer albedo;
+};
+
+struct DenoiseSettings
+{
+    // passes of the filter, every one takes its taps twice as far apart as the one before
+    int passes = 3;
+    // how far colors, normals and albedos of two pixels may be apart for them to be averaged;
+    // the one of colors halves with every pass as the noise left does
+    float colorSigma = 0.1f;
+    float normalSigma = 0.3f;
+    float albedoSigma = 0.1f;
+};
+
+// the primary rays of the pixel corners are traced for their closest hits only
+DenoiseGuides traceDenoiseGuides(
+        const FlatScene &scene,
+        const Camera &camera,
+        int resolution,
+        QThreadPool &threadPool,
+        int tileSize,
+        ScratchArenas &scratchArenas);
+
+// edge avoiding a-trous wavelet filter of dammertz et al. over the framebuffer in place, tile by tile
+// on the pool: a pixel is averaged with neighbours of a similar color that see a surface of a similar
+// normal and albedo, so edges of shapes and materials stay sharp while the noise along them is smoothed
+void denoise(
+        Framebuffer &framebuffer,
+        const DenoiseGuides &guides,
+        const DenoiseSettings &settings,
+        QThreadPool &threadPool,
+        int tileSize,
+        ScratchArenas &scratchArenas);
+
+#endif // DENOISER_H
@@ -0,0 +1,379 @@
+#include "distributed.h"
+
+#include <algorithm>
+
+#include <QDataStream>
+#include <QEventLoop>
+#include <QHostAddress>
+#include <QThread>
+#include <QTcpSocket>
+
+// a worker connects and gets the job, then asks for tiles, sending the ones it has done
+// with every request; the coordinator answers with the tiles it leases to it, none when
+// all tiles left are leased to others, and tells it to stop once it has every tile:
+//   job:      kind, resolution, tile size, camera, antialiasing, trace settings, sphere and bulb counts
+//   request:  kind, tiles wanted, done tile count, then index and rgb floats of every done tile
+//   leases:   kind, whether the frame is done, leased tile indices
+namespace {
+
+enum MessageKind : quint8
+{
+    JobMessage = 1,
+    RequestMessage,
+    LeasesMessage,
+};
+
+constexpr int connectTimeoutMs = 10000;
+constexpr int writeTimeoutMs = 1000;
+// workers ask again after that when all tiles left are leased to others
+constexpr int retryMs = 50;
+
+void setUp(QDataStream &stream)
+{
+    stream.setVersion(QDataStream::Qt_5_12);
+    stream.setFloatingPointPrecision(QDataStream::SinglePrecision);
+}
+
+void writeJob(QDataStream &stream, const RenderJob &job)
+{
+    const TraceSettings &settings = job.traceSettings;
+    stream << quint8(JobMessage)
+           << qint32(job.resolution)
+           << qint32(job.tileSize)
+           << quint8(job.camera.projection)
+           << job.camera.origin
+           << job.camera.direction
+           << job.camera.up
+           << job.camera.size
+           << qint32(job.antialiasing.samplesPerPixel)
+           << job.antialiasing.contrastThreshold
+           << quint8(job.antialiasing.pattern)
+           << job.antialiasing.seed
+           << settings.colorOnMiss
+           << settings.colorOnFullShade
+           << qint32(settings.maxDepth)
+           << settings.minThroughput
+           << settings.sortSecondaryRays
+           << qint32(job.sphereCount)
+           << qint32(job.bulbCount);
+}
+
+// false if the stream doesn't start with a job
+bool readJob(QDataStream &stream, RenderJob &job)
+{
+    quint8 kind = 0;
+    qint32 resolution = 0;
+    qint32 tileSize = 0;
+    quint8 projection = 0;
+    qint32 samplesPerPixel = 0;
+    quint8 pattern = 0;
+    qint32 maxDepth = 0;
+    qint32 sphereCount = 0;
+    qint32 bulbCount = 0;
+    TraceSettings &settings = job.traceSettings;
+    stream >> kind
+           >> resolution
+           >> tileSize
+           >> projection
+           >> job.camera.origin
+           >> job.camera.direction
+           >> job.camera.up
+           >> job.camera.size
+           >> samplesPerPixel
+           >> job.antialiasing.contrastThreshold
+           >> pattern
+           >> job.antialiasing.seed
+           >> settings.colorOnMiss
+           >> settings.colorOnFullShade
+           >> maxDepth
+           >> settings.minThroughput
+           >> settings.sortSecondaryRays
+           >> sphereCount
+           >> bulbCount;
+    job.resolution = resolution;
+    job.tileSize = tileSize;
+    job.camera.projection = Camera::Projection(projection);
+    job.antialiasing.samplesPerPixel = samplesPerPixel;
+    job.antialiasing.pattern = sampling::Pattern(pattern);
+    settings.maxDepth = maxDepth;
+    job.sphereCount = sphereCount;
+    job.bulbCount = bulbCount;
+    return kind == JobMessage && resolution > 0 && tileSize > 0 && projection <= Camera::Perspective && pattern <= sampling::Sobol;
+}
+
+void writeLeases(QDataStream &stream, const bool isDone, const QVector<int> &tiles)
+{
+    stream << quint8(LeasesMessage) << isDone << tiles;
+}
+
+}
+
+TileLeases::TileLeases(const int tileCount, const qint64 leaseNanoseconds)
+    : leaseNanoseconds_(leaseNanoseconds),
+      states_(tileCount)
+{
+}
+
+QVector<int> TileLeases::lease(const int count, const qint64 now)
+{
+    QVector<int> res;
+    const auto take = [&](const int tile) {
+        State &state = states_[tile];
+        state.isLeased = true;
+        state.expiresAt = now + leaseNanoseconds_;
+        res.append(tile);
+    };
+    for (; nextFresh_ < states_.size() && res.size() < count; ++nextFresh_)
+        take(nextFresh_);
+    for (int tile = 0; tile < nextFresh_ && res.size() < count; ++tile) {
+        const State &state = states_.at(tile);
+        if (state.isDone || (state.isLeased && state.expiresAt > now))
+            continue;
+        ++reassignedCount_;
+        take(tile);
+    }
+    return res;
+}
+
+void TileLeases::release(const int tile)
+{
+    states_[tile].isLeased = false;
+}
+
+bool TileLeases::complete(const int tile)
+{
+    State &state = states_[tile];
+    if (state.isDone)
+        return false;
+    state.isDone = true;
+    state.isLeased = false;
+    ++doneCount_;
+    return true;
+}
+
+RenderCoordinator::RenderCoordinator(const RenderJob &job, const qint64 leaseMilliseconds)
+    : job_(job),
+      tiles_(splitToTiles(job.resolution, job.resolution, job.tileSize)),
+      leases_(tiles_.size(), leaseMilliseconds * 1000000),
+      framebuffer_(job.resolution, job.resolution)
+{
+    QObject::connect(&server_, &QTcpServer::newConnection, [this] { accept(); });
+    clock_.start();
+}
+
+RenderCoordinator::~RenderCoordinator()
+{
+    // accepted sockets are children of the server, their handlers refer to the coordinator
+    for (QTcpSocket *socket : server_.findChildren<QTcpSocket *>())
+        socket->disconnect();
+}
+
+bool RenderCoordinator::listen(const quint16 port, QString *error)
+{
+    if (server_.listen(QHostAddress::Any, port))
+        return true;
+    if (error)
+        *error = "can't listen on port " + QString::number(port) + ": " + server_.errorString();
+    return false;
+}
+
+void RenderCoordinator::run()
+{
+    if (!leases_.isDone()) {
+        QEventLoop loop;
+        loop_ = &loop;
+        loop.exec();
+        loop_ = nullptr;
+    }
+    // workers still rendering read it after sending their tiles
+    for (QTcpSocket *socket : workers_.keys()) {
+        QDataStream stream(socket);
+        setUp(stream);
+        writeLeases(stream, true, {});
+        socket->waitForBytesWritten(writeTimeoutMs);
+        socket->disconnectFromHost();
+    }
+}
+
+void RenderCoordinator::accept()
+{
+    while (QTcpSocket *socket = server_.nextPendingConnection()) {
+        ++workerCount_;
+        workers_.insert(socket, {});
+        QObject::connect(socket, &QTcpSocket::readyRead, &server_, [this, socket] { read(socket); });
+        QObject::connect(socket, &QTcpSocket::disconnected, &server_, [this, socket] { drop(socket); });
+        QDataStream stream(socket);
+        setUp(stream);
+        writeJob(stream, job_);
+    }
+}
+
+void RenderCoordinator::read(QTcpSocket *socket)
+{
+    QDataStream stream(socket);
+    setUp(stream);
+    while (workers_.contains(socket)) {
+        stream.startTransaction();
+        quint8 kind = 0;
+        qint32 wanted = 0;
+        qint32 doneCount = 0;
+        stream >> kind >> wanted >> doneCount;
+        if (stream.status() == QDataStream::Ok && (kind != RequestMessage || doneCount < 0 || doneCount > tiles_.size())) {
+            stream.abortTransaction();
+            drop(socket);
+            return;
+        }
+        QVector<int> done(std::max(0, doneCount));
+        QVector<QVector<float>> pixels(done.size());
+        for (int index = 0; index < done.size() && stream.status() == QDataStream::Ok; ++index)
+            stream >> done[index] >> pixels[index];
+        if (!stream.commitTransaction()) {
+            // the rest of the message is still to come
+            if (stream.status() == QDataStream::ReadPastEnd)
+                return;
+            drop(socket);
+            return;
+        }
+
+        QVector<int> &leased = workers_[socket];
+        for (int index = 0; index < done.size(); ++index) {
+            const int tileIndex = done.at(index);
+            const QVector<float> &tilePixels = pixels.at(index);
+            if (tileIndex < 0 || tileIndex >= tiles_.size()) {
+                drop(socket);
+                return;
+            }
+            const Tile &tile = tiles_.at(tileIndex);
+            const int floatsPerLine = tile.width * 3;
+            if (tilePixels.size() != floatsPerLine * tile.height) {
+                drop(socket);
+                return;
+            }
+            leased.removeOne(tileIndex);
+            // a tile leased again after expiring may come back twice
+            if (!leases_.complete(tileIndex))
+                continue;
+            for (int y = 0; y < tile.height; ++y)
+                std::copy_n(tilePixels.constData() + y * floatsPerLine, floatsPerLine, framebuffer_.scanLine(tile.y + y) + tile.x * 3);
+        }
+
+        const QVector<int> tiles = leases_.lease(std::clamp<int>(wanted, 0, tiles_.size()), clock_.nsecsElapsed());
+        leased += tiles;
+        writeLeases(stream, leases_.isDone(), tiles);
+        if (leases_.isDone() && loop_)
+            loop_->quit();
+    }
+}
+
+void RenderCoordinator::drop(QTcpSocket *socket)
+{
+    if (!workers_.contains(socket))
+        return;
+    // tiles of a worker that is gone can be leased to the others right away
+    for (const int tile : workers_.take(socket))
+        leases_.release(tile);
+    socket->abort();
+    socket->deleteLater();
+}
+
+bool renderForCoordinator(
+        const QString &host,
+        const quint16 port,
+        const FlatScene &scene,
+        QThreadPool &threadPool,
+        QString *error,
+        int *tileCount)
+{
+    const auto fail = [&](const QString &message) {
+        if (error)
+            *error = message;
+        return false;
+    };
+    const QString address = host + ":" + QString::number(port);
+    QTcpSocket socket;
+    socket.connectToHost(host, port);
+    if (!socket.waitForConnected(connectTimeoutMs))
+        return fail("can't connect to " + address + ": " + socket.errorString());
+    QDataStream stream(&socket);
+    setUp(stream);
+    // waits for the whole of a message, read(stream) returns false if it isn't the expected one
+    const auto receive = [&](const auto &read) {
+        for (;;) {
+            stream.startTransaction();
+            if (!read()) {
+                stream.abortTransaction();
+                return false;
+            }
+            if (stream.commitTransaction())
+                return true;
+            if (stream.status() != QDataStream::ReadPastEnd || !socket.waitForReadyRead(-1))
+                return false;
+        }
+    };
+
+    RenderJob job;
+    if (!receive([&] { return readJob(stream, job) || stream.status() != QDataStream::Ok; }))
+        return fail("no job from " + address);
+    if (job.sphereCount != scene.spheres().size() || job.bulbCount != scene.bulbs().size())
+        return fail(address + " renders another scene, of " + QString::number(job.sphereCount) + " spheres and "
+                    + QString::number(job.bulbCount) + " bulbs");
+
+    const QVector<Tile> tiles = splitToTiles(job.resolution, job.resolution, job.tileSize);
+    const int tilesPerRow = (job.resolution + job.tileSize - 1) / job.tileSize;
+    const BatchKernel trace = batchKernel(kernelFeatures(scene, job.traceSettings));
+    const auto shader = [&](const Sample *samples, const int count, Color *colors, Arena &scratch) {
+        const ArenaScope scope(scratch);
+        Ray *rays = scratch.allocateArray<Ray>(count);
+        job.camera.generateRays(samples, count, job.resolution, rays);
+        trace(scene, job.traceSettings, rays, count, colors, scratch, nullptr, nullptr);
+    };
+    ScratchArenas scratchArenas(threadPool.maxThreadCount());
+
+    QVector<int> done;
+    QVector<QVector<float>> pixels;
+    int sentCount = 0;
+    for (;;) {
+        stream << quint8(RequestMessage) << qint32(threadPool.maxThreadCount()) << qint32(done.size());
+        for (int index = 0; index < done.size(); ++index)
+            stream << done.at(index) << pixels.at(index);
+        sentCount += done.size();
+        // fails once the coordinator has every tile and closed the connection, its answer is read anyway
+        while (socket.bytesToWrite() > 0 && socket.waitForBytesWritten(-1)) {}
+
+        bool isDone = false;
+        QVector<int> leased;
+        if (!receive([&] {
+                quint8 kind = 0;
+                stream >> kind >> isDone >> leased;
+                return kind == LeasesMessage || stream.status() != QDataStream::Ok;
+            }))
+            return fail("lost the connection to " + address);
+        if (isDone) {
+            if (tileCount)
+                *tileCount = sentCount;
+            return true;
+        }
+        done = leased;
+        pixels = QVector<QVector<float>>(leased.size());
+        if (leased.isEmpty()) {
+            QThread::msleep(retryMs);
+            continue;
+        }
+
+        QVector<Tile> leasedTiles;
+        for (const int tile : leased) {
+            if (tile < 0 || tile >= tiles.size())
+                return fail(address + " leased tile " + QString::number(tile) + " of " + QString::number(tiles.size()));
+            leasedTiles.append(tiles.at(tile));
+        }
+        QVector<float> *results = pixels.data();
+        renderTileList(leasedTiles, threadPool, scratchArenas, [&](const Tile &tile, RenderStats &tileStats, Arena &scratch) {
+            const ArenaScope scope(scratch);
+            const TileImage image = renderTileAlone(tile, job.resolution, job.resolution, shader, job.antialiasing, tileStats, scratch);
+            QVector<float> &result = results[leased.indexOf(tile.y / job.tileSize * tilesPerRow + tile.x / job.tileSize)];
+            result.resize(image.floatsPerLine() * tile.height);
+            std::copy_n(image.constData(), result.size(), result.data());
+        });
+        scratchArenas.reset();
+    }
+}
@@ -0,0 +1,121 @@
+#ifndef DISTRIBUTED_H
+#define DISTRIBUTED_H
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QString>
+#include <QTcpServer>
+#include <QThreadPool>
+#include <QVector>
+
+#include "camera.h"
+#include "flatscene.h"
+#include "framebuffer.h"
+#include "tilerenderer.h"
+#include "tracer.h"
+
+class QEventLoop;
+class QTcpSocket;
+
+// a frame rendered by worker processes: the coordinator splits it into the tiles of the local
+// renderer and leases them to workers that loaded the same scene, which send the tiles back
+// antialiased; messages are QDataStream values over tcp, see distributed.cpp
+
+// what workers render, sent to them once they connect
+struct RenderJob
+{
+    int resolution = 0;
+    int tileSize = 32;
+    // workers render with it whatever camera they were started with
+    Camera camera;
+    Antialiasing antialiasing;
+    TraceSettings traceSettings;
+    // of the coordinator scene, workers refuse jobs of another one
+    int sphereCount = 0;
+    int bulbCount = 0;
+};
+
+// tiles of a frame handed out for a limited time, a tile is leased again once its lease
+// expires or is released, so tiles of crashed or stuck workers go to the others
+class TileLeases
+{
+public:
+    TileLeases(int tileCount, qint64 leaseNanoseconds);
+
+    // up to count tiles neither done nor leased, the ones never leased first
+    QVector<int> lease(int count, qint64 now);
+    void release(int tile);
+    // false if the tile was done already
+    bool complete(int tile);
+
+    int tileCount() const { return states_.size(); }
+    int doneCount() const { return doneCount_; }
+    bool isDone() const { return doneCount_ == states_.size(); }
+    // leases given for tiles that had one before
+    int reassignedCount() const { return reassignedCount_; }
+
+private:
+    struct State
+    {
+        // when the lease ends, tiles never leased have none
+        qint64 expiresAt = -1;
+        bool isLeased = false;
+        bool isDone = false;
+    };
+
+    qint64 leaseNanoseconds_ = 0;
+    QVector<State> states_;
+    // tiles before it have all been leased once
+    int nextFresh_ = 0;
+    int doneCount_ = 0;
+    int reassignedCount_ = 0;
+};
+
+class RenderCoordinator
+{
+public:
+    RenderCoordinator(const RenderJob &job, qint64 leaseMilliseconds);
+    ~RenderCoordinator();
+
+    // starts accepting workers, port 0 picks a free one; returns false and sets error on failure
+    bool listen(quint16 port, QString *error = nullptr);
+    quint16 port() const { return server_.serverPort(); }
+    // serves tiles until all of them are back, then tells workers to stop
+    void run();
+
+    Framebuffer &framebuffer() { return framebuffer_; }
+    const TileLeases &leases() const { return leases_; }
+    // connected so far
+    int workerCount() const { return workerCount_; }
+
+private:
+    void accept();
+    void read(QTcpSocket *socket);
+    void drop(QTcpSocket *socket);
+
+    RenderJob job_;
+    QVector<Tile> tiles_;
+    TileLeases leases_;
+    Framebuffer framebuffer_;
+    QTcpServer server_;
+    // tiles leased by every connected worker
+    QHash<QTcpSocket *, QVector<int>> workers_;
+    int workerCount_ = 0;
+    // of leases
+    QElapsedTimer clock_;
+    QEventLoop *loop_ = nullptr;
+};
+
+// renders tiles leased by the coordinator at host:port until it has all of them, tracing scene
+// seen by the camera of the job with the threads of threadPool; returns false and sets error if it
+// can't connect, loses the connection or the coordinator renders another scene; tileCount is set
+// to the tiles sent
+bool renderForCoordinator(
+        const QString &host,
+        quint16 port,
+        const FlatScene &scene,
+        QThreadPool &threadPool,
+        QString *error = nullptr,
+        int *tileCount = nullptr);
+
+#endif // DISTRIBUTED_H
@@ -0,0 +1,93 @@
+#ifndef FLATARRAY_H
+#define FLATARRAY_H
+
+#include <memory>
+
+#include <QVector>
+
+// contiguous values either owned by the array, or living in memory owned by something else,
+// like a mapped scene file, that the array keeps alive; reads don't care which one it is,
+// writes copy external values into the array first
+template <typename T>
+class FlatArray
+{
+public:
+    FlatArray() = default;
+    FlatArray(const QVector<T> &values) : values_(values) { update(); }
+    FlatArray(const T *data, const int size, std::shared_ptr<const void> owner)
+        : owner_(std::move(owner)), data_(data), size_(size) {}
+    FlatArray(const FlatArray &other) { *this = other; }
+    FlatArray &operator=(const FlatArray &other)
+    {
+        values_ = other.values_;
+        owner_ = other.owner_;
+        if (owner_) {
+            data_ = other.data_;
+            size_ = other.size_;
+        } else {
+            update();
+        }
+        return *this;
+    }
+
+    int size() const { return size_; }
+    bool isEmpty() const { return size_ == 0; }
+    // whether values are in memory owned by something else
+    bool isExternal() const { return static_cast<bool>(owner_); }
+
+    const T *constData() const { return data_; }
+    const T &at(const int index) const { return data_[index]; }
+    const T &operator[](const int index) const { return data_[index]; }
+    const T *begin() const { return data_; }
+    const T *end() const { return data_ + size_; }
+
+    T *data()
+    {
+        detach();
+        T *values = values_.data();
+        data_ = values;
+        return values;
+    }
+    T &operator[](const int index) { return data()[index]; }
+    T *begin() { return data(); }
+    T *end() { return data() + size_; }
+    void append(const T &value)
+    {
+        detach();
+        values_.append(value);
+        update();
+    }
+    void resize(const int size)
+    {
+        detach();
+        values_.resize(size);
+        update();
+    }
+    void reserve(const int size)
+    {
+        detach();
+        values_.reserve(size);
+        update();
+    }
+
+private:
+    void detach()
+    {
+        if (!owner_)
+            return;
+        values_ = QVector<T>(data_, data_ + size_);
+        owner_.reset();
+    }
+    void update()
+    {
+        data_ = values_.constData();
+        size_ = values_.size();
+    }
+
+    QVector<T> values_;
+    std::shared_ptr<const void> owner_;
+    const T *data_ = nullptr;
+    int size_ = 0;
+};
+
+#endif // FLATARRAY_H
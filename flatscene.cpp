@@ -0,0 +1,535 @@
+#include "flatscene.h"
+
+#include <cmath>
+#include <algorithm>
+#include <type_traits>
+
+#include <QFile>
+
+namespace {
+
+QAtomicInt lastRevision = 0;
+
+Aabb influenceBounds(const FlatScene::PointLight &bulb)
+{
+    const QVector3D extent(bulb.radius, bulb.radius, bulb.radius);
+    return Aabb(bulb.center - extent, bulb.center + extent);
+}
+
+}
+
+FlatScene FlatScene::compile(
+        const QVector<std::shared_ptr<Shape>> &shapes,
+        const QVector<std::shared_ptr<Light>> &lights,
+        const int bvhLeafSize)
+{
+    FlatScene scene;
+    for (const auto &shape : shapes)
+        shape->addTo(scene);
+    for (const auto &light : lights)
+        light->addTo(scene);
+    scene.buildBvh(bvhLeafSize);
+    scene.buildMeshes(bvhLeafSize);
+    scene.buildBulbBvh();
+    return scene;
+}
+
+int FlatScene::addMaterial(const Color &color, const float mirror)
+{
+    materials_.append({color, mirror});
+    return materials_.size() - 1;
+}
+
+void FlatScene::addSphere(const QVector3D &center, const float radius, const int material)
+{
+    spheres_.append(center, radius);
+    sphereMaterials_.append(material);
+}
+
+void FlatScene::addPlane(const QVector3D &point, const QVector3D &normal, const int material)
+{
+    planes_.append({normal, QVector3D::dotProduct(normal, point)});
+    planeMaterials_.append(material);
+}
+
+void FlatScene::addTriangle(const QVector3D &a, const QVector3D &b, const QVector3D &c, const int material)
+{
+    looseTriangles_.append(a, b, c);
+    looseMaterials_.append(material);
+}
+
+void FlatScene::addInstance(const std::shared_ptr<const Mesh> &mesh, const Transform &transform, const int material)
+{
+    // scenes have a few meshes placed many times
+    int meshIndex = static_cast<int>(std::find(meshSources_.begin(), meshSources_.end(), mesh) - meshSources_.begin());
+    if (meshIndex == meshSources_.size())
+        meshSources_.append(mesh);
+    Instance instance;
+    transform.rotatedAxes(instance.axes);
+    instance.offset = transform.offset;
+    instance.scale = transform.scale;
+    instance.mesh = meshIndex;
+    instance.material = material;
+    instances_.append(instance);
+}
+
+void FlatScene::addBulb(const QVector3D &center, const Color &color, const float radius)
+{
+    bulbs_.append({center, color, radius});
+}
+
+void FlatScene::setSphere(const int index, const QVector3D &center, const float radius)
+{
+    spheres_.set(index, center, radius);
+    refitBvh();
+    revision_ = newRevision();
+}
+
+void FlatScene::setSpheres(const QVector<SphereEdit> &edits)
+{
+    if (edits.isEmpty())
+        return;
+    for (const SphereEdit &edit : edits)
+        spheres_.set(edit.index, edit.center, edit.radius);
+    refitBvh();
+    revision_ = newRevision();
+}
+
+void FlatScene::setMaterial(const int index, const Color &color, const float mirror)
+{
+    materials_[index] = {color, mirror};
+    revision_ = newRevision();
+}
+
+void FlatScene::setBulb(const int index, const PointLight &bulb)
+{
+    setBulbs({{index, bulb}});
+}
+
+void FlatScene::setBulbs(const QVector<BulbEdit> &edits)
+{
+    if (edits.isEmpty())
+        return;
+    bool isRebuilt = false;
+    for (const BulbEdit &edit : edits) {
+        isRebuilt = isRebuilt || std::isinf(bulbs_.at(edit.index).radius) != std::isinf(edit.bulb.radius);
+        bulbs_[edit.index] = edit.bulb;
+    }
+    if (isRebuilt)
+        buildBulbBvh();
+    else
+        refitBulbBvh();
+    revision_ = newRevision();
+}
+
+bool FlatScene::hasMirrors() const
+{
+    return std::any_of(materials_.begin(), materials_.end(), [](const Material &material) {
+        return material.mirror > 0.0f;
+    });
+}
+
+int FlatScene::shapeInstance(const int shape) const
+{
+    const auto next = std::upper_bound(instances_.begin(), instances_.end(), shape, [](const int shape, const Instance &instance) {
+        return shape < instance.firstShape;
+    });
+    return static_cast<int>(next - instances_.begin()) - 1;
+}
+
+int FlatScene::instanceTriangle(const int instance, const int shape) const
+{
+    const Instance &placed = instances_.at(instance);
+    return meshes_.at(placed.mesh).firstTriangle + shape - placed.firstShape;
+}
+
+int FlatScene::shapeMaterial(const int shape) const
+{
+    if (shape < firstPlaneShape())
+        return sphereMaterials_.at(shape);
+    if (shape < firstTriangleShape())
+        return planeMaterials_.at(shape - firstPlaneShape());
+    const int instance = shapeInstance(shape);
+    const int material = instances_.at(instance).material;
+    return material >= 0 ? material : triangleMaterials_.at(instanceTriangle(instance, shape));
+}
+
+QVector3D FlatScene::shapeNormal(const int shape, const QVector3D &point) const
+{
+    if (shape < firstPlaneShape())
+        return (point - spheres_.center(shape)).normalized();
+    if (shape < firstTriangleShape())
+        return planes_.at(shape - firstPlaneShape()).normal;
+    const int instance = shapeInstance(shape);
+    return instances_.at(instance).toWorldDirection(triangles_.normal(instanceTriangle(instance, shape)));
+}
+
+Aabb FlatScene::sphereBounds(const int index) const
+{
+    const QVector3D center = spheres_.center(index);
+    const float radius = spheres_.radius(index);
+    const QVector3D extent(radius, radius, radius);
+    return Aabb(center - extent, center + extent);
+}
+
+void FlatScene::buildBvh(const int leafSize)
+{
+    const int nSpheres = spheres_.size();
+    QVector<Aabb> bounds;
+    bounds.reserve(nSpheres);
+    for (int index = 0; index < nSpheres; ++index)
+        bounds.append(sphereBounds(index));
+    sphereBvh_ = Bvh::build(bounds, leafSize);
+
+    // leaves refer to ranges of bvh order, so spheres are stored in it
+    SphereArray spheres;
+    FlatArray<int> sphereMaterials;
+    sphereMaterials.reserve(nSpheres);
+    for (const int index : sphereBvh_.shapeIndices()) {
+        spheres.append(spheres_.center(index), spheres_.radius(index));
+        sphereMaterials.append(sphereMaterials_.at(index));
+    }
+    spheres_ = spheres;
+    sphereMaterials_ = sphereMaterials;
+}
+
+void FlatScene::refitBvh()
+{
+    sphereBvh_.refit([this](const int first, const int count) {
+        Aabb bounds;
+        for (int sphere = first; sphere < first + count; ++sphere)
+            bounds.extend(sphereBounds(sphere));
+        return bounds;
+    });
+}
+
+void FlatScene::buildMeshes(const int leafSize)
+{
+    for (const std::shared_ptr<const Mesh> &source : meshSources_) {
+        TriangleArray triangles;
+        for (int index = 0; index < source->triangleCount(); ++index)
+            triangles.append(source->corner(index, 0), source->corner(index, 1), source->corner(index, 2));
+        addMesh(triangles, QVector<int>(triangles.size(), -1), leafSize);
+    }
+    meshSources_.clear();
+    if (looseTriangles_.size() > 0) {
+        addMesh(looseTriangles_, looseMaterials_, leafSize);
+        Instance instance;
+        instance.axes[0] = QVector3D(1, 0, 0);
+        instance.axes[1] = QVector3D(0, 1, 0);
+        instance.axes[2] = QVector3D(0, 0, 1);
+        instance.mesh = meshes_.size() - 1;
+        instances_.append(instance);
+        looseTriangles_ = TriangleArray();
+        looseMaterials_.clear();
+    }
+
+    // instances of empty meshes have no bounds
+    QVector<Instance> instances;
+    QVector<Aabb> bounds;
+    for (const Instance &instance : instances_) {
+        const Bvh &bvh = meshBvhs_.at(instance.mesh);
+        if (bvh.nodes().isEmpty())
+            continue;
+        const Aabb &meshBounds = bvh.nodes().at(0).bounds;
+        Aabb placedBounds;
+        for (int corner = 0; corner < 8; ++corner) {
+            const QVector3D point(corner & 1 ? meshBounds.max.x() : meshBounds.min.x(),
+                                  corner & 2 ? meshBounds.max.y() : meshBounds.min.y(),
+                                  corner & 4 ? meshBounds.max.z() : meshBounds.min.z());
+            placedBounds.extend(instance.offset + instance.toWorldDirection(point) * instance.scale);
+        }
+        instances.append(instance);
+        bounds.append(placedBounds);
+    }
+    instanceBvh_ = Bvh::build(bounds, leafSize);
+
+    // leaves refer to ranges of bvh order, so instances are stored in it
+    FlatArray<Instance> sorted;
+    sorted.reserve(instances.size());
+    instancedTriangleCount_ = 0;
+    for (const int index : instanceBvh_.shapeIndices()) {
+        Instance instance = instances.at(index);
+        instance.firstShape = firstTriangleShape() + instancedTriangleCount_;
+        instancedTriangleCount_ += meshes_.at(instance.mesh).triangleCount;
+        sorted.append(instance);
+    }
+    instances_ = sorted;
+}
+
+void FlatScene::addMesh(const TriangleArray &triangles, const QVector<int> &materials, const int leafSize)
+{
+    QVector<Aabb> bounds;
+    bounds.reserve(triangles.size());
+    for (int index = 0; index < triangles.size(); ++index)
+        bounds.append(triangles.bounds(index));
+    const Bvh bvh = Bvh::build(bounds, leafSize);
+    const int firstTriangle = triangles_.size();
+    for (const int index : bvh.shapeIndices()) {
+        triangles_.append(triangles.at(index));
+        triangleMaterials_.append(materials.at(index));
+    }
+    meshes_.append({firstTriangle, triangles.size()});
+    meshBvhs_.append(bvh);
+}
+
+void FlatScene::buildBulbBvh()
+{
+    // bounds of infinite lights would break the bvh build, they are always visited anyway
+    unboundedBulbs_.clear();
+    boundedBulbs_.clear();
+    QVector<Aabb> bounds;
+    for (int index = 0; index < bulbs_.size(); ++index) {
+        const PointLight &bulb = bulbs_.at(index);
+        if (std::isinf(bulb.radius)) {
+            unboundedBulbs_.append(index);
+            continue;
+        }
+        bounds.append(influenceBounds(bulb));
+        boundedBulbs_.append(index);
+    }
+    bulbBvh_ = Bvh::build(bounds);
+}
+
+int FlatScene::newRevision()
+{
+    return lastRevision.fetchAndAddRelaxed(1) + 1;
+}
+
+void FlatScene::refitBulbBvh()
+{
+    bulbBvh_.refit([this](const int first, const int count) {
+        Aabb bounds;
+        for (int index = first; index < first + count; ++index)
+            bounds.extend(influenceBounds(bulbs_.at(boundedBulbs_.at(bulbBvh_.shapeIndices().at(index)))));
+        return bounds;
+    });
+}
+
+namespace {
+
+// binary scene files start with this header, arrays follow it in the order of SceneArray,
+// each at a multiple of arrayAlignment; numbers are stored as they are in memory of little endian machines
+constexpr char sceneFileMagic[8] = {'Y', 'A', 'R', 'T', 'S', 'C', 'N', '\0'};
+constexpr quint32 sceneFileVersion = 1;
+constexpr quint32 byteOrderMark = 0x01020304;
+constexpr qint64 arrayAlignment = 64;
+// sphere arrays in files are padded for packets of up to that many spheres,
+// so files work with any simd::width
+constexpr int spherePacketWidth = 8;
+
+enum SceneArray
+{
+    CenterX,
+    CenterY,
+    CenterZ,
+    RadiusSquared,
+    SphereMaterials,
+    Materials,
+    Bulbs,
+    BvhNodes,
+    BvhShapeIndices,
+    SceneArrayCount
+};
+
+struct SceneFileHeader
+{
+    char magic[8];
+    quint32 version;
+    quint32 byteOrder;
+    qint32 sphereCount;
+    qint32 materialCount;
+    qint32 bulbCount;
+    qint32 bvhNodeCount;
+    qint32 bvhLeafCount;
+    qint32 bvhDepth;
+    qint32 bvhMaxLeafSize;
+    qint32 reserved;
+    // in bytes from the file start
+    qint64 offsets[SceneArrayCount];
+    qint64 sizes[SceneArrayCount];
+};
+
+static_assert(simd::width <= spherePacketWidth, "scene files aren't padded for packets that wide");
+static_assert(std::is_trivially_copyable<FlatScene::Material>::value && sizeof(FlatScene::Material) == 16,
+              "materials are stored as they are in memory");
+static_assert(std::is_trivially_copyable<FlatScene::PointLight>::value && sizeof(FlatScene::PointLight) == 28,
+              "bulbs are stored as they are in memory");
+static_assert(std::is_trivially_copyable<Bvh::Node>::value && sizeof(Bvh::Node) == 32,
+              "bvh nodes are stored as they are in memory");
+
+template <typename Value>
+FlatArray<Value> mappedArray(
+        const uchar *data,
+        const SceneFileHeader &header,
+        const SceneArray index,
+        const std::shared_ptr<const void> &owner)
+{
+    return FlatArray<Value>(
+                reinterpret_cast<const Value *>(data + header.offsets[index]),
+                static_cast<int>(header.sizes[index] / qint64(sizeof(Value))),
+                owner);
+}
+
+bool setError(QString *error, const QString &message)
+{
+    if (error)
+        *error = message;
+    return false;
+}
+
+}
+
+bool FlatScene::save(const QString &fileName, QString *error) const
+{
+    if (hasFlatShapes())
+        return setError(error, "scene files hold spheres only, " + fileName + " isn't written for a scene with planes or triangles");
+    const int sphereCount = spheres_.size();
+    const int paddedSphereCount = sphereCount + spherePacketWidth - 1;
+    struct Array
+    {
+        const void *data;
+        qint64 size;
+        // zeros written after data up to that size
+        qint64 paddedSize;
+    };
+    const auto sphereArray = [&](const FlatArray<float> &values) {
+        const qint64 size = std::min(values.size(), paddedSphereCount) * qint64(sizeof(float));
+        return Array{values.constData(), size, paddedSphereCount * qint64(sizeof(float))};
+    };
+    const auto array = [](const auto &values) {
+        const qint64 size = values.size() * qint64(sizeof(values.at(0)));
+        return Array{values.constData(), size, size};
+    };
+    const Array arrays[SceneArrayCount] = {
+        sphereArray(spheres_.centerX()),
+        sphereArray(spheres_.centerY()),
+        sphereArray(spheres_.centerZ()),
+        sphereArray(spheres_.radiusSquared()),
+        array(sphereMaterials_),
+        array(materials_),
+        array(bulbs_),
+        array(sphereBvh_.nodes()),
+        array(sphereBvh_.shapeIndices()),
+    };
+
+    SceneFileHeader header = {};
+    std::copy_n(sceneFileMagic, sizeof(sceneFileMagic), header.magic);
+    header.version = sceneFileVersion;
+    header.byteOrder = byteOrderMark;
+    header.sphereCount = sphereCount;
+    header.materialCount = materials_.size();
+    header.bulbCount = bulbs_.size();
+    header.bvhNodeCount = sphereBvh_.nodes().size();
+    header.bvhLeafCount = sphereBvh_.buildStats().leafCount;
+    header.bvhDepth = sphereBvh_.buildStats().depth;
+    header.bvhMaxLeafSize = sphereBvh_.buildStats().maxLeafSize;
+    qint64 offset = sizeof(header);
+    for (int index = 0; index < SceneArrayCount; ++index) {
+        offset = (offset + arrayAlignment - 1) / arrayAlignment * arrayAlignment;
+        header.offsets[index] = offset;
+        header.sizes[index] = arrays[index].paddedSize;
+        offset += arrays[index].paddedSize;
+    }
+
+    QFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly))
+        return setError(error, "can't open " + fileName + " for writing");
+    const auto write = [&](const void *data, const qint64 size) {
+        return file.write(static_cast<const char *>(data), size) == size;
+    };
+    const auto writeZeros = [&](qint64 size) {
+        static const char zeros[arrayAlignment] = {};
+        for (; size > 0; size -= arrayAlignment)
+            if (!write(zeros, std::min(size, arrayAlignment)))
+                return false;
+        return true;
+    };
+    bool isWritten = write(&header, sizeof(header));
+    qint64 position = sizeof(header);
+    for (int index = 0; index < SceneArrayCount && isWritten; ++index) {
+        const Array &array = arrays[index];
+        isWritten = writeZeros(header.offsets[index] - position)
+                && write(array.data, array.size)
+                && writeZeros(array.paddedSize - array.size);
+        position = header.offsets[index] + array.paddedSize;
+    }
+    if (!isWritten)
+        return setError(error, "can't write " + fileName);
+    return true;
+}
+
+bool FlatScene::load(const QString &fileName, FlatScene &scene, QString *error)
+{
+    // the arrays refer to the mapping, it stays until the last of them is gone
+    const auto file = std::make_shared<QFile>(fileName);
+    if (!file->open(QIODevice::ReadOnly))
+        return setError(error, "can't open " + fileName);
+    const qint64 fileSize = file->size();
+    if (fileSize < qint64(sizeof(SceneFileHeader)))
+        return setError(error, fileName + " is not a scene file");
+    const uchar *data = file->map(0, fileSize);
+    if (!data)
+        return setError(error, "can't map " + fileName);
+
+    SceneFileHeader header;
+    std::copy_n(data, sizeof(header), reinterpret_cast<uchar *>(&header));
+    if (!std::equal(sceneFileMagic, sceneFileMagic + sizeof(sceneFileMagic), header.magic))
+        return setError(error, fileName + " is not a scene file");
+    if (header.version != sceneFileVersion || header.byteOrder != byteOrderMark)
+        return setError(error, fileName + " is of another version or byte order");
+
+    // sizes are checked, contents are trusted to be written by save()
+    const qint64 paddedSphereCount = qint64(header.sphereCount) + spherePacketWidth - 1;
+    const qint64 expectedSizes[SceneArrayCount] = {
+        paddedSphereCount * qint64(sizeof(float)),
+        paddedSphereCount * qint64(sizeof(float)),
+        paddedSphereCount * qint64(sizeof(float)),
+        paddedSphereCount * qint64(sizeof(float)),
+        header.sphereCount * qint64(sizeof(int)),
+        header.materialCount * qint64(sizeof(Material)),
+        header.bulbCount * qint64(sizeof(PointLight)),
+        header.bvhNodeCount * qint64(sizeof(Bvh::Node)),
+        header.sphereCount * qint64(sizeof(int)),
+    };
+    for (int index = 0; index < SceneArrayCount; ++index) {
+        const qint64 offset = header.offsets[index];
+        const qint64 size = header.sizes[index];
+        if (size != expectedSizes[index] || size < 0 || offset % arrayAlignment || offset < 0 || offset > fileSize - size)
+            return setError(error, fileName + " is truncated or damaged");
+    }
+
+    Bvh::BuildStats bvhStats;
+    bvhStats.shapeCount = header.sphereCount;
+    bvhStats.nodeCount = header.bvhNodeCount;
+    bvhStats.leafCount = header.bvhLeafCount;
+    bvhStats.depth = header.bvhDepth;
+    bvhStats.maxLeafSize = header.bvhMaxLeafSize;
+
+    FlatScene res;
+    res.spheres_ = SphereArray(
+                header.sphereCount,
+                mappedArray<float>(data, header, CenterX, file),
+                mappedArray<float>(data, header, CenterY, file),
+                mappedArray<float>(data, header, CenterZ, file),
+                mappedArray<float>(data, header, RadiusSquared, file));
+    res.sphereMaterials_ = mappedArray<int>(data, header, SphereMaterials, file);
+    res.materials_ = mappedArray<Material>(data, header, Materials, file);
+    res.bulbs_ = mappedArray<PointLight>(data, header, Bulbs, file);
+    res.sphereBvh_ = Bvh(
+                mappedArray<Bvh::Node>(data, header, BvhNodes, file),
+                mappedArray<int>(data, header, BvhShapeIndices, file),
+                bvhStats);
+    res.buildBulbBvh();
+    scene = res;
+    return true;
+}
+
+bool FlatScene::isSceneFile(const QString &fileName)
+{
+    QFile file(fileName);
+    char magic[sizeof(sceneFileMagic)];
+    return file.open(QIODevice::ReadOnly)
+            && file.read(magic, sizeof(magic)) == qint64(sizeof(magic))
+            && std::equal(sceneFileMagic, sceneFileMagic + sizeof(sceneFileMagic), magic);
+}
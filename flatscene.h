@@ -0,0 +1,218 @@
+#ifndef FLATSCENE_H
+#define FLATSCENE_H
+
+#include <limits>
+#include <memory>
+
+#include <QAtomicInt>
+#include <QString>
+#include <QVector>
+#include <QVector3D>
+
+#include "bvh.h"
+#include "flatarray.h"
+#include "scene.h"
+#include "spheres.h"
+#include "triangles.h"
+
+// scene laid out for rendering: every shape type has its own arrays and bvh,
+// shapes refer to a shared material table, lights are plain values;
+// spheres are stored in the order of their bvh leaves;
+// meshes are stored once each, with a bvh of their own, and placed by instances, which have
+// a top level bvh; triangles described on their own make up a mesh placed as it is;
+// shape indices number all shapes: spheres first, then planes, then the triangles of every instance
+class FlatScene
+{
+public:
+    struct Material
+    {
+        Color color;
+        float mirror = 0.0f;
+    };
+    struct PointLight
+    {
+        QVector3D center;
+        Color color;
+        // see Light::radius
+        float radius = std::numeric_limits<float>::infinity();
+    };
+    // points where dot(normal, point) == offset
+    struct Plane
+    {
+        QVector3D normal;
+        float offset = 0.0f;
+
+        // distance along the ray or infinity, hits at zero distance don't count
+        float distance(const QVector3D &origin, const QVector3D &direction) const
+        {
+            const float t = (offset - QVector3D::dotProduct(normal, origin)) / QVector3D::dotProduct(normal, direction);
+            return t > 0.0f ? t : std::numeric_limits<float>::infinity();
+        }
+    };
+    // triangles()[firstTriangle, firstTriangle + triangleCount) in the order of the leaves
+    // of the mesh bvh, whose shape indices are relative to firstTriangle
+    struct MeshRange
+    {
+        int firstTriangle = 0;
+        int triangleCount = 0;
+    };
+    // a mesh placed in the scene, see Transform; rays are moved into the space of the mesh,
+    // where directions keep their length and distances are divided by scale
+    struct Instance
+    {
+        // where the axes of the mesh end up, without scale
+        QVector3D axes[3];
+        QVector3D offset;
+        float scale = 1.0f;
+        int mesh = 0;
+        // -1 for the ones of the triangles
+        int material = -1;
+        // shape index of its first triangle
+        int firstShape = 0;
+
+        QVector3D toMesh(const QVector3D &point) const { return toMeshDirection(point - offset) / scale; }
+        QVector3D toMeshDirection(const QVector3D &direction) const
+        {
+            return QVector3D(QVector3D::dotProduct(axes[0], direction),
+                             QVector3D::dotProduct(axes[1], direction),
+                             QVector3D::dotProduct(axes[2], direction));
+        }
+        QVector3D toWorldDirection(const QVector3D &direction) const
+        {
+            return axes[0] * direction.x() + axes[1] * direction.y() + axes[2] * direction.z();
+        }
+    };
+
+    static FlatScene compile(
+            const QVector<std::shared_ptr<Shape>> &shapes,
+            const QVector<std::shared_ptr<Light>> &lights,
+            int bvhLeafSize);
+
+    // binary scene files hold the arrays below as they are laid out in memory, bvh included;
+    // load() maps them from the file instead of reading them, so it takes about the same time
+    // for any scene size; both return false and set error on failure
+    bool save(const QString &fileName, QString *error = nullptr) const;
+    static bool load(const QString &fileName, FlatScene &scene, QString *error = nullptr);
+    // whether the file starts like the ones save() writes
+    static bool isSceneFile(const QString &fileName);
+
+    // called by Shape::addTo() and Light::addTo()
+    int addMaterial(const Color &color, float mirror);
+    void addSphere(const QVector3D &center, float radius, int material);
+    void addPlane(const QVector3D &point, const QVector3D &normal, int material);
+    void addTriangle(const QVector3D &a, const QVector3D &b, const QVector3D &c, int material);
+    // the mesh is stored once for all instances of it
+    void addInstance(const std::shared_ptr<const Mesh> &mesh, const Transform &transform, int material);
+    void addBulb(const QVector3D &center, const Color &color, float radius);
+
+    struct SphereEdit
+    {
+        int index = 0;
+        QVector3D center;
+        float radius = 0.0f;
+    };
+    struct BulbEdit
+    {
+        int index = 0;
+        PointLight bulb;
+    };
+
+    // edits of a compiled scene, indices are the ones of the arrays below:
+    // moving a sphere refits its bvh, which stays valid but may get slower for large moves
+    void setSphere(int index, const QVector3D &center, float radius);
+    // setSphere() and setBulb() of many at once, refitting their bvhs once
+    void setSpheres(const QVector<SphereEdit> &edits);
+    void setBulbs(const QVector<BulbEdit> &edits);
+    // shapes sharing the material change all together
+    void setMaterial(int index, const Color &color, float mirror);
+    // moving a bulb refits its bvh as moving a sphere does, so the bulbs are visited in the same
+    // order and the light of points it doesn't reach is summed as before; a bulb changing between
+    // finite and infinite radius rebuilds it
+    void setBulb(int index, const PointLight &bulb);
+    // changes with every edit, a new scene gets one no scene had before,
+    // so state kept for a scene is known to be stale when it differs
+    int revision() const { return revision_; }
+
+    const FlatArray<Material> &materials() const { return materials_; }
+    // whether any material reflects, scanning them
+    bool hasMirrors() const;
+    const SphereArray &spheres() const { return spheres_; }
+    // bounds of a sphere, as its bvh uses them
+    Aabb sphereBounds(int index) const;
+    const FlatArray<int> &sphereMaterials() const { return sphereMaterials_; }
+    const Bvh &sphereBvh() const { return sphereBvh_; }
+
+    const FlatArray<Plane> &planes() const { return planes_; }
+    const FlatArray<int> &planeMaterials() const { return planeMaterials_; }
+    const TriangleArray &triangles() const { return triangles_; }
+    // -1 for triangles of meshes of instances, which have a material of their own
+    const FlatArray<int> &triangleMaterials() const { return triangleMaterials_; }
+    const FlatArray<MeshRange> &meshes() const { return meshes_; }
+    const Bvh &meshBvh(int mesh) const { return meshBvhs_.at(mesh); }
+    // in the order of the leaves of their bvh
+    const FlatArray<Instance> &instances() const { return instances_; }
+    const Bvh &instanceBvh() const { return instanceBvh_; }
+    // whether there are planes or triangles besides the spheres
+    bool hasFlatShapes() const { return !planes_.isEmpty() || !instances_.isEmpty(); }
+
+    int firstPlaneShape() const { return spheres_.size(); }
+    int firstTriangleShape() const { return spheres_.size() + planes_.size(); }
+    int shapeCount() const { return firstTriangleShape() + instancedTriangleCount_; }
+    // index of the instance a triangle shape belongs to, and of the triangle in triangles()
+    int shapeInstance(int shape) const;
+    int instanceTriangle(int instance, int shape) const;
+    int shapeMaterial(int shape) const;
+    // normal at point on the shape, outwards for spheres, facing either side for the flat ones
+    QVector3D shapeNormal(int shape, const QVector3D &point) const;
+    const FlatArray<PointLight> &bulbs() const { return bulbs_; }
+    bool hasBoundedBulbs() const { return !boundedBulbs_.isEmpty(); }
+    // calls visitBulb(light) for the bulbs that may reach point: all of infinite radius
+    // and the ones of finite radius found by their bvh, farther ones are left to the caller
+    template <typename VisitBulb>
+    void visitBulbsAt(const QVector3D &point, VisitBulb &&visitBulb) const;
+
+private:
+    void buildBvh(int leafSize);
+    void refitBvh();
+    void buildBulbBvh();
+    void refitBulbBvh();
+    static int newRevision();
+    void buildMeshes(int leafSize);
+    void addMesh(const TriangleArray &triangles, const QVector<int> &materials, int leafSize);
+
+    FlatArray<Material> materials_;
+    SphereArray spheres_;
+    FlatArray<int> sphereMaterials_;
+    Bvh sphereBvh_;
+    FlatArray<Plane> planes_;
+    FlatArray<int> planeMaterials_;
+    TriangleArray triangles_;
+    FlatArray<int> triangleMaterials_;
+    FlatArray<MeshRange> meshes_;
+    QVector<Bvh> meshBvhs_;
+    FlatArray<Instance> instances_;
+    Bvh instanceBvh_;
+    int instancedTriangleCount_ = 0;
+    // gathered until compile() builds the meshes
+    QVector<std::shared_ptr<const Mesh>> meshSources_;
+    TriangleArray looseTriangles_;
+    QVector<int> looseMaterials_;
+    FlatArray<PointLight> bulbs_;
+    QVector<int> unboundedBulbs_;
+    // over bulbs of finite radius, shape indices refer to boundedBulbs_
+    Bvh bulbBvh_;
+    QVector<int> boundedBulbs_;
+    int revision_ = newRevision();
+};
+
+template <typename VisitBulb>
+void FlatScene::visitBulbsAt(const QVector3D &point, VisitBulb &&visitBulb) const
+{
+    for (const int index : unboundedBulbs_)
+        visitBulb(bulbs_.at(index));
+    bulbBvh_.visitAt(point, [&](const int index) {
+        visitBulb(bulbs_.at(boundedBulbs_.at(index)));
+    });
+}
+
+#endif // FLATSCENE_H
@@ -0,0 +1,56 @@
+#include "framebuffer.h"
+
+#include <algorithm>
+#include <new>
+
+#include <QColorSpace>
+
+Framebuffer::Framebuffer(const int width, const int height)
+{
+    allocate(width, height);
+}
+
+Framebuffer::Framebuffer(const Framebuffer &other)
+{
+    *this = other;
+}
+
+Framebuffer &Framebuffer::operator=(const Framebuffer &other)
+{
+    if (this == &other)
+        return *this;
+    allocate(other.width_, other.height_);
+    std::copy_n(other.pixels_.get(), floatsPerLine_ * height_, pixels_.get());
+    return *this;
+}
+
+QImage Framebuffer::toImage()
+{
+    const int bytesPerLine = (width_ * 3 + 3) & ~3;
+    bytes_.resize(bytesPerLine * height_);
+    for (int y = 0; y < height_; ++y) {
+        const float *source = constScanLine(y);
+        uchar *destination = bytes_.data() + y * bytesPerLine;
+        for (int index = 0; index < width_ * 3; ++index)
+            destination[index] = static_cast<uchar>(std::clamp(source[index] * 255.0f, 0.0f, 255.0f));
+    }
+    QImage image(bytes_.data(), width_, height_, bytesPerLine, QImage::Format_RGB888);
+    image.setColorSpace(QColorSpace::SRgbLinear);
+    return image;
+}
+
+void Framebuffer::AlignedDelete::operator()(float *pointer) const
+{
+    ::operator delete[](pointer, std::align_val_t(alignment));
+}
+
+void Framebuffer::allocate(const int width, const int height)
+{
+    constexpr int floatsPerAlignment = alignment / sizeof(float);
+    width_ = width;
+    height_ = height;
+    floatsPerLine_ = (width * 3 + floatsPerAlignment - 1) / floatsPerAlignment * floatsPerAlignment;
+    const int size = floatsPerLine_ * height_;
+    pixels_.reset(static_cast<float *>(::operator new[](size * sizeof(float), std::align_val_t(alignment))));
+    std::fill_n(pixels_.get(), size, 0.0f);
+}
@@ -0,0 +1,65 @@
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include <memory>
+
+#include <QImage>
+#include <QVector>
+#include <QVector3D>
+
+// linear float rgb pixels, every row starts at a cache line boundary, so a row of a tile never shares
+// a cache line with the rows above or below it; tiles side by side share the lines where they meet
+// unless their width of 12 bytes a pixel ends on a boundary too, as widths that are multiples of 16 do
+class Framebuffer
+{
+public:
+    static constexpr int alignment = 64;
+
+    Framebuffer() = default;
+    Framebuffer(int width, int height);
+    Framebuffer(const Framebuffer &other);
+    Framebuffer(Framebuffer &&other) = default;
+    Framebuffer &operator=(const Framebuffer &other);
+    Framebuffer &operator=(Framebuffer &&other) = default;
+
+    bool isNull() const { return !pixels_; }
+    int width() const { return width_; }
+    int height() const { return height_; }
+    bool contains(const int x, const int y) const { return x >= 0 && y >= 0 && x < width_ && y < height_; }
+
+    float *scanLine(const int y) { return pixels_.get() + y * floatsPerLine_; }
+    const float *constScanLine(const int y) const { return pixels_.get() + y * floatsPerLine_; }
+    QVector3D pixel(const int x, const int y) const
+    {
+        const float *rgb = constScanLine(y) + x * 3;
+        return QVector3D(rgb[0], rgb[1], rgb[2]);
+    }
+    void setPixel(const int x, const int y, const QVector3D &color)
+    {
+        float *rgb = scanLine(y) + x * 3;
+        rgb[0] = color.x();
+        rgb[1] = color.y();
+        rgb[2] = color.z();
+    }
+
+    // clamps every channel to [0, 1] and quantizes it to 8 bits in a single pass;
+    // the image wraps a byte buffer owned by the framebuffer without copying it,
+    // so it stays valid until the next toImage() call or framebuffer destruction
+    QImage toImage();
+
+private:
+    struct AlignedDelete
+    {
+        void operator()(float *pointer) const;
+    };
+
+    void allocate(int width, int height);
+
+    int width_ = 0;
+    int height_ = 0;
+    int floatsPerLine_ = 0;
+    std::unique_ptr<float[], AlignedDelete> pixels_;
+    QVector<uchar> bytes_;
+};
+
+#endif // FRAMEBUFFER_H
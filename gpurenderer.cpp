@@ -0,0 +1,570 @@
+#include "gpurenderer.h"
+
+#ifdef YART_GPU
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include <QOffscreenSurface>
+#include <QOpenGLContext>
+#include <QOpenGLExtraFunctions>
+#include <QOpenGLShaderProgram>
+#include <QSurfaceFormat>
+#include <QVector>
+
+namespace {
+
+// the arrays of FlatScene as std430 shader storage lays them out
+struct GpuNode
+{
+    float min[3];
+    qint32 first;
+    float max[3];
+    qint32 count;
+};
+struct GpuSphere
+{
+    float center[3];
+    float radiusSquared;
+};
+struct GpuMaterial
+{
+    float color[3];
+    float mirror;
+};
+struct GpuBulb
+{
+    float center[3];
+    float radius;
+    float color[3];
+    float unused;
+};
+
+enum Binding
+{
+    Nodes,
+    Spheres,
+    SphereMaterials,
+    Materials,
+    Bulbs,
+    // the frame traced at a sample per pixel, then antialiased into the result
+    Source,
+    Result,
+    Counters,
+    BindingCount,
+};
+
+// rows of a dispatch, so one doesn't run long enough for drivers to reset the gpu
+constexpr int bandRows = 64;
+constexpr int groupSize = 8;
+
+// castWavefront() for one path at a time and the antialiasing of renderProgressive(),
+// invocations of the first stage trace a pixel each, the ones of the second supersample it if needed
+const char *const shaderSource = R"(
+layout(local_size_x = GROUP_SIZE, local_size_y = GROUP_SIZE) in;
+
+struct Node { vec3 min; int first; vec3 max; int count; };
+struct Sphere { vec3 center; float radiusSquared; };
+struct Material { vec3 color; float mirror; };
+struct Bulb { vec3 center; float radius; vec3 color; float unused; };
+
+layout(std430, binding = 0) readonly buffer Nodes { Node nodes[]; };
+layout(std430, binding = 1) readonly buffer Spheres { Sphere spheres[]; };
+layout(std430, binding = 2) readonly buffer SphereMaterials { int sphereMaterials[]; };
+layout(std430, binding = 3) readonly buffer Materials { Material materials[]; };
+layout(std430, binding = 4) readonly buffer Bulbs { Bulb bulbs[]; };
+layout(std430, binding = 5) buffer Source { vec4 source[]; };
+layout(std430, binding = 6) buffer Result { vec4 result[]; };
+layout(std430, binding = 7) buffer Counters { uint supersampledCount; };
+
+uniform int stage;
+uniform int resolution;
+uniform int firstRow;
+uniform int nodeCount;
+uniform int bulbCount;
+uniform bool isPerspective;
+uniform vec3 cameraOrigin;
+// normalized for perspective cameras
+uniform vec3 cameraDirection;
+uniform vec3 cameraRight;
+uniform vec3 cameraDown;
+uniform float cameraDelimeter;
+uniform float cameraStep;
+uniform float cameraHalfSpan;
+uniform vec3 colorOnMiss;
+uniform vec3 colorOnFullShade;
+uniform int maxDepth;
+uniform float minThroughput;
+uniform int gridSize;
+uniform float contrastThreshold;
+
+const float infinity = uintBitsToFloat(0x7f800000u);
+const float maxFloat = uintBitsToFloat(0x7f7fffffu);
+
+// shapes hit on the way to the current ray, see ExcludedShapes
+int excluded[MAX_REFLECTION_DEPTH + 1];
+int stack[STACK_SIZE];
+float stackDistances[STACK_SIZE];
+
+bool isExcluded(int sphere, int excludedCount)
+{
+    for (int index = 0; index < excludedCount; ++index)
+        if (excluded[index] == sphere)
+            return true;
+    return false;
+}
+
+float entryDistance(int node, vec3 origin, vec3 inverseDirection, float maxDistance)
+{
+    vec3 t0 = (nodes[node].min - origin) * inverseDirection;
+    vec3 t1 = (nodes[node].max - origin) * inverseDirection;
+    vec3 near = min(t0, t1);
+    vec3 far = max(t0, t1);
+    float entry = max(0.0, max(near.x, max(near.y, near.z)));
+    float exit = min(maxDistance, min(far.x, min(far.y, far.z)));
+    return entry <= exit ? entry : infinity;
+}
+
+// Bvh::traverseLeaves() with SphereArray::closestHit() or anyHit() at its leaves,
+// returns the sphere hit and lowers distance, or -1; any hit returns the first one found
+int traverse(vec3 origin, vec3 direction, inout float distance, int excludedCount, bool isAnyHit)
+{
+    if (nodeCount == 0)
+        return -1;
+    vec3 inverseDirection = 1.0 / direction;
+    int res = -1;
+    int stackSize = 0;
+    float rootDistance = entryDistance(0, origin, inverseDirection, distance);
+    if (rootDistance <= distance) {
+        stack[0] = 0;
+        stackDistances[0] = rootDistance;
+        stackSize = 1;
+    }
+    while (stackSize > 0) {
+        --stackSize;
+        if (stackDistances[stackSize] > distance)
+            continue;
+        Node node = nodes[stack[stackSize]];
+        if (node.count > 0) {
+            for (int sphere = node.first; sphere < node.first + node.count; ++sphere) {
+                // fused into fma, the discriminant would round differently from the cpu kernels,
+                // which it amplifies by cancelling for spheres far from the ray origin
+                precise vec3 m = origin - spheres[sphere].center;
+                precise float b = direction.x * m.x + direction.y * m.y + direction.z * m.z;
+                precise float c = m.x * m.x + m.y * m.y + m.z * m.z - spheres[sphere].radiusSquared;
+                precise float discr = b * b - c;
+                if (isAnyHit) {
+                    float nearest = -b - distance;
+                    if ((c <= 0.0 || (b <= 0.0 && discr >= 0.0 && (nearest <= 0.0 || discr >= nearest * nearest)))
+                            && !isExcluded(sphere, excludedCount))
+                        return sphere;
+                    continue;
+                }
+                if ((c > 0.0 && b > 0.0) || discr < 0.0)
+                    continue;
+                float t = max(0.0, -b - sqrt(discr));
+                if (t >= distance || isExcluded(sphere, excludedCount))
+                    continue;
+                distance = t;
+                res = sphere;
+            }
+            continue;
+        }
+        int near = node.first;
+        int far = node.first + 1;
+        float nearDistance = entryDistance(near, origin, inverseDirection, distance);
+        float farDistance = entryDistance(far, origin, inverseDirection, distance);
+        if (farDistance < nearDistance) {
+            int swapped = near;
+            near = far;
+            far = swapped;
+            float swappedDistance = nearDistance;
+            nearDistance = farDistance;
+            farDistance = swappedDistance;
+        }
+        if (farDistance <= distance) {
+            stack[stackSize] = far;
+            stackDistances[stackSize++] = farDistance;
+        }
+        if (nearDistance <= distance) {
+            stack[stackSize] = near;
+            stackDistances[stackSize++] = nearDistance;
+        }
+    }
+    return res;
+}
+
+// see Bulb::falloff() and Bulb::attenuation()
+float falloff(float cosine)
+{
+    if (cosine <= 0.0)
+        return 0.0;
+    float x = min(cosine, 1.0);
+    float angle = sqrt(1.0 - x) * (1.5707288 + x * (-0.2121144 + x * (0.0742610 - 0.0187293 * x)));
+    return max(0.0, 1.0 - angle * 0.63661977);
+}
+
+float attenuation(float distanceSquared, float radius)
+{
+    if (isinf(radius))
+        return 1.0;
+    float window = max(0.0, 1.0 - distanceSquared / (radius * radius));
+    return window * window;
+}
+
+vec3 trace(vec3 origin, vec3 direction)
+{
+    vec3 color = vec3(0.0);
+    vec3 throughput = vec3(1.0);
+    for (int depth = 0;; ++depth) {
+        float distance = maxFloat;
+        int sphere = traverse(origin, direction, distance, depth, false);
+        if (sphere < 0) {
+            color += throughput * colorOnMiss;
+            break;
+        }
+        vec3 intersectionOrigin = origin + direction * distance;
+        vec3 normalDirection = normalize(intersectionOrigin - spheres[sphere].center);
+        Material material = materials[sphereMaterials[sphere]];
+        excluded[depth] = sphere;
+
+        vec3 colorMask = colorOnFullShade;
+        for (int bulb = 0; bulb < bulbCount; ++bulb) {
+            vec3 lightOffset = intersectionOrigin - bulbs[bulb].center;
+            float distanceSquared = dot(lightOffset, lightOffset);
+            float radius = bulbs[bulb].radius;
+            if (distanceSquared <= 0.0 || distanceSquared >= radius * radius)
+                continue;
+            float lightDistance = sqrt(distanceSquared);
+            vec3 lightDirection = lightOffset / lightDistance;
+            float power = falloff(dot(lightDirection, normalDirection)) * attenuation(distanceSquared, radius);
+            if (power <= 0.0)
+                continue;
+            // the shadow ray goes from the point to the light and stops at it
+            if (traverse(intersectionOrigin, -lightDirection, lightDistance, depth + 1, true) < 0)
+                colorMask += power * bulbs[bulb].color;
+        }
+        color += throughput * material.color * (1.0 - material.mirror) * colorMask;
+
+        if (material.mirror <= 0.0 || depth >= maxDepth)
+            break;
+        throughput *= material.mirror * colorMask;
+        if (max(throughput.x, max(throughput.y, throughput.z)) < minThroughput)
+            break;
+        direction = direction - 2.0 * normalDirection * dot(direction, normalDirection);
+        origin = intersectionOrigin;
+    }
+    return color;
+}
+
+// see Camera::generateRays()
+vec3 trace(vec2 pixel)
+{
+    if (isPerspective) {
+        vec2 offset = pixel * cameraStep - cameraHalfSpan;
+        return trace(cameraOrigin, normalize(cameraDirection + cameraRight * offset.x + cameraDown * offset.y));
+    }
+    vec2 offset = pixel / cameraDelimeter - cameraHalfSpan;
+    return trace(cameraOrigin + cameraRight * offset.x + cameraDown * offset.y, cameraDirection);
+}
+
+float contrast(ivec2 pixel)
+{
+    vec3 color = clamp(source[pixel.y * resolution + pixel.x].rgb, 0.0, 1.0);
+    float res = 0.0;
+    ivec2 neighbours[4] = ivec2[](pixel - ivec2(1, 0), pixel + ivec2(1, 0), pixel - ivec2(0, 1), pixel + ivec2(0, 1));
+    for (int index = 0; index < 4; ++index) {
+        ivec2 neighbour = neighbours[index];
+        if (any(lessThan(neighbour, ivec2(0))) || any(greaterThanEqual(neighbour, ivec2(resolution))))
+            continue;
+        vec3 difference = abs(clamp(source[neighbour.y * resolution + neighbour.x].rgb, 0.0, 1.0) - color);
+        res = max(res, max(difference.x, max(difference.y, difference.z)));
+    }
+    return res;
+}
+
+void main()
+{
+    ivec2 pixel = ivec2(gl_GlobalInvocationID.x, firstRow + int(gl_GlobalInvocationID.y));
+    if (pixel.x >= resolution || pixel.y >= resolution)
+        return;
+    int index = pixel.y * resolution + pixel.x;
+    if (stage == 0) {
+        source[index] = vec4(trace(vec2(pixel)), 0.0);
+        return;
+    }
+    vec3 color = source[index].rgb;
+    if (gridSize < 2 || contrast(pixel) <= contrastThreshold) {
+        result[index] = vec4(color, 0.0);
+        return;
+    }
+    float weight = 1.0 / float(gridSize * gridSize);
+    color *= weight;
+    for (int sampleY = 0; sampleY < gridSize; ++sampleY)
+        for (int sampleX = sampleY != 0 ? 0 : 1; sampleX < gridSize; ++sampleX)
+            color += weight * trace(vec2(pixel) + vec2(sampleX, sampleY) / float(gridSize));
+    atomicAdd(supersampledCount, 1u);
+    result[index] = vec4(color, 0.0);
+}
+)";
+
+void setError(QString *error, const QString &message)
+{
+    if (error)
+        *error = message;
+}
+
+}
+
+struct GpuRenderer::Context
+{
+    ~Context()
+    {
+        if (!context.makeCurrent(&surface))
+            return;
+        context.extraFunctions()->glDeleteBuffers(BindingCount, buffers);
+        program.reset();
+        context.doneCurrent();
+    }
+
+    // uploads values to the buffer of binding, empty arrays get an element so they can be bound
+    template <typename T>
+    void upload(const Binding binding, const QVector<T> &values)
+    {
+        QOpenGLExtraFunctions &gl = *context.extraFunctions();
+        gl.glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers[binding]);
+        gl.glBufferData(GL_SHADER_STORAGE_BUFFER, std::max<qsizetype>(1, values.size()) * sizeof(T), values.constData(), GL_STATIC_DRAW);
+        gl.glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, buffers[binding]);
+    }
+
+    QOpenGLContext context;
+    QOffscreenSurface surface;
+    std::unique_ptr<QOpenGLShaderProgram> program;
+    GLuint buffers[BindingCount] = {};
+    int nodeCount = 0;
+    int bulbCount = 0;
+};
+
+GpuRenderer::GpuRenderer() = default;
+
+GpuRenderer::~GpuRenderer() = default;
+
+bool GpuRenderer::load(const FlatScene &scene, QString *error)
+{
+    if (scene.hasFlatShapes()) {
+        setError(error, "the gpu renderer traces spheres only, not planes or triangles");
+        return false;
+    }
+    if (!context_) {
+        auto context = std::make_unique<Context>();
+        QSurfaceFormat format;
+        format.setVersion(4, 3);
+        format.setProfile(QSurfaceFormat::CoreProfile);
+        context->context.setFormat(format);
+        context->surface.setFormat(format);
+        context->surface.create();
+        if (!context->context.create() || !context->surface.isValid() || !context->context.makeCurrent(&context->surface)) {
+            setError(error, "can't create an opengl context");
+            return false;
+        }
+        if (!QOpenGLShader::hasOpenGLShaders(QOpenGLShader::Compute, &context->context)) {
+            setError(error, "opengl compute shaders aren't supported, they need opengl 4.3");
+            return false;
+        }
+        context->context.extraFunctions()->glGenBuffers(BindingCount, context->buffers);
+        context_ = std::move(context);
+    } else if (!context_->context.makeCurrent(&context_->surface)) {
+        setError(error, "can't make the opengl context current");
+        return false;
+    }
+
+    // the traversal stack holds up to a node per level of the bvh
+    const QByteArray source = "#version 430\n"
+            "#define GROUP_SIZE " + QByteArray::number(groupSize) + "\n"
+            "#define MAX_REFLECTION_DEPTH " + QByteArray::number(maxReflectionDepth) + "\n"
+            "#define STACK_SIZE " + QByteArray::number(scene.sphereBvh().buildStats().depth + 1) + "\n"
+            + shaderSource;
+    context_->program = std::make_unique<QOpenGLShaderProgram>();
+    if (!context_->program->addShaderFromSourceCode(QOpenGLShader::Compute, source) || !context_->program->link()) {
+        setError(error, "can't build the compute shader: " + context_->program->log());
+        context_->program.reset();
+        return false;
+    }
+
+    QVector<GpuNode> nodes;
+    nodes.reserve(scene.sphereBvh().nodes().size());
+    for (const Bvh::Node &node : scene.sphereBvh().nodes())
+        nodes.append({{node.bounds.min.x(), node.bounds.min.y(), node.bounds.min.z()}, node.first,
+                      {node.bounds.max.x(), node.bounds.max.y(), node.bounds.max.z()}, node.count});
+    const SphereArray &sphereArray = scene.spheres();
+    QVector<GpuSphere> spheres;
+    spheres.reserve(sphereArray.size());
+    for (int index = 0; index < sphereArray.size(); ++index)
+        spheres.append({{sphereArray.centerX().at(index), sphereArray.centerY().at(index), sphereArray.centerZ().at(index)},
+                        sphereArray.radiusSquared().at(index)});
+    const QVector<qint32> sphereMaterials(scene.sphereMaterials().begin(), scene.sphereMaterials().end());
+    QVector<GpuMaterial> materials;
+    materials.reserve(scene.materials().size());
+    for (const FlatScene::Material &material : scene.materials())
+        materials.append({{material.color.x(), material.color.y(), material.color.z()}, material.mirror});
+    QVector<GpuBulb> bulbs;
+    bulbs.reserve(scene.bulbs().size());
+    for (const FlatScene::PointLight &bulb : scene.bulbs())
+        bulbs.append({{bulb.center.x(), bulb.center.y(), bulb.center.z()}, bulb.radius,
+                      {bulb.color.x(), bulb.color.y(), bulb.color.z()}, 0.0f});
+
+    context_->upload(Nodes, nodes);
+    context_->upload(Spheres, spheres);
+    context_->upload(SphereMaterials, sphereMaterials);
+    context_->upload(Materials, materials);
+    context_->upload(Bulbs, bulbs);
+    context_->nodeCount = nodes.size();
+    context_->bulbCount = bulbs.size();
+    const GLenum glError = context_->context.extraFunctions()->glGetError();
+    if (glError != GL_NO_ERROR) {
+        setError(error, "can't upload the scene, opengl error " + QString::number(glError, 16));
+        return false;
+    }
+    return true;
+}
+
+bool GpuRenderer::render(
+        Framebuffer &framebuffer,
+        const Camera &camera,
+        const TraceSettings &settings,
+        const Antialiasing &antialiasing,
+        RenderStats *stats,
+        QString *error)
+{
+    if (!context_ || !context_->program) {
+        setError(error, "no scene is loaded");
+        return false;
+    }
+    if (framebuffer.width() != framebuffer.height()) {
+        setError(error, "frames rendered on the gpu are square");
+        return false;
+    }
+    if (antialiasing.pattern != sampling::Grid) {
+        setError(error, "the gpu renderer supersamples on a grid only");
+        return false;
+    }
+    if (!context_->context.makeCurrent(&context_->surface)) {
+        setError(error, "can't make the opengl context current");
+        return false;
+    }
+    QOpenGLExtraFunctions &gl = *context_->context.extraFunctions();
+    const int resolution = framebuffer.width();
+    const qsizetype pixelBytes = qsizetype(resolution) * resolution * 4 * sizeof(float);
+    for (const Binding binding : {Source, Result}) {
+        gl.glBindBuffer(GL_SHADER_STORAGE_BUFFER, context_->buffers[binding]);
+        gl.glBufferData(GL_SHADER_STORAGE_BUFFER, std::max<qsizetype>(1, pixelBytes), nullptr, GL_DYNAMIC_COPY);
+        gl.glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, context_->buffers[binding]);
+    }
+    const GLuint supersampledCount = 0;
+    gl.glBindBuffer(GL_SHADER_STORAGE_BUFFER, context_->buffers[Counters]);
+    gl.glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(supersampledCount), &supersampledCount, GL_DYNAMIC_READ);
+    gl.glBindBufferBase(GL_SHADER_STORAGE_BUFFER, Counters, context_->buffers[Counters]);
+
+    const int gridSize = std::max(1, static_cast<int>(std::sqrt(antialiasing.samplesPerPixel)));
+    QOpenGLShaderProgram &program = *context_->program;
+    program.bind();
+    program.setUniformValue("resolution", resolution);
+    program.setUniformValue("nodeCount", context_->nodeCount);
+    program.setUniformValue("bulbCount", context_->bulbCount);
+    // pixel steps as Camera::generateRays() computes them
+    const bool isPerspective = camera.projection == Camera::Perspective;
+    const float span = isPerspective ? 2.0f * std::tan(camera.size * float(M_PI) / 360.0f) : camera.size;
+    program.setUniformValue("isPerspective", isPerspective);
+    program.setUniformValue("cameraOrigin", camera.origin);
+    program.setUniformValue("cameraDirection", isPerspective ? camera.direction.normalized() : camera.direction);
+    program.setUniformValue("cameraRight", camera.right());
+    program.setUniformValue("cameraDown", camera.down());
+    program.setUniformValue("cameraDelimeter", resolution / camera.size);
+    program.setUniformValue("cameraStep", span / resolution);
+    program.setUniformValue("cameraHalfSpan", span * 0.5f);
+    program.setUniformValue("colorOnMiss", settings.colorOnMiss);
+    program.setUniformValue("colorOnFullShade", settings.colorOnFullShade);
+    program.setUniformValue("maxDepth", std::clamp(settings.maxDepth, 0, maxReflectionDepth));
+    program.setUniformValue("minThroughput", settings.minThroughput);
+    program.setUniformValue("gridSize", gridSize);
+    program.setUniformValue("contrastThreshold", antialiasing.contrastThreshold);
+    for (int stage = 0; stage < 2; ++stage) {
+        program.setUniformValue("stage", stage);
+        for (int firstRow = 0; firstRow < resolution; firstRow += bandRows) {
+            program.setUniformValue("firstRow", firstRow);
+            const int rows = std::min(bandRows, resolution - firstRow);
+            gl.glDispatchCompute((resolution + groupSize - 1) / groupSize, (rows + groupSize - 1) / groupSize, 1);
+        }
+        // the second stage compares pixels with neighbours the first one wrote
+        gl.glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    }
+    program.release();
+
+    gl.glBindBuffer(GL_SHADER_STORAGE_BUFFER, context_->buffers[Result]);
+    const auto *pixels = static_cast<const float *>(gl.glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, pixelBytes, GL_MAP_READ_BIT));
+    if (pixels) {
+        for (int y = 0; y < resolution; ++y) {
+            float *line = framebuffer.scanLine(y);
+            const float *row = pixels + qsizetype(y) * resolution * 4;
+            for (int x = 0; x < resolution; ++x)
+                std::memcpy(line + x * 3, row + x * 4, 3 * sizeof(float));
+        }
+        gl.glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+    }
+    gl.glBindBuffer(GL_SHADER_STORAGE_BUFFER, context_->buffers[Counters]);
+    const auto *counters = static_cast<const GLuint *>(gl.glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, sizeof(GLuint), GL_MAP_READ_BIT));
+    const qint64 pixelsSupersampled = counters ? *counters : 0;
+    if (counters)
+        gl.glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+    const GLenum glError = gl.glGetError();
+    if (!pixels || glError != GL_NO_ERROR) {
+        setError(error, "can't render on the gpu, opengl error " + QString::number(glError, 16));
+        return false;
+    }
+
+    if (stats) {
+        stats->pixelsTraced += qint64(resolution) * resolution;
+        stats->pixelsSupersampled += pixelsSupersampled;
+        stats->samplesTraced += qint64(resolution) * resolution + pixelsSupersampled * (gridSize * gridSize - 1);
+    }
+    return true;
+}
+
+#else
+
+namespace {
+
+const char *const unavailableError = "built without gpu support, see CONFIG += gpu";
+
+}
+
+struct GpuRenderer::Context
+{
+};
+
+GpuRenderer::GpuRenderer() = default;
+
+GpuRenderer::~GpuRenderer() = default;
+
+bool GpuRenderer::load(const FlatScene &, QString *error)
+{
+    if (error)
+        *error = unavailableError;
+    return false;
+}
+
+bool GpuRenderer::render(
+        Framebuffer &,
+        const Camera &,
+        const TraceSettings &,
+        const Antialiasing &,
+        RenderStats *,
+        QString *error)
+{
+    if (error)
+        *error = unavailableError;
+    return false;
+}
+
+#endif
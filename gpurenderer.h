@@ -0,0 +1,43 @@
+#ifndef GPURENDERER_H
+#define GPURENDERER_H
+
+#include <memory>
+
+#include <QString>
+
+#include "camera.h"
+#include "flatscene.h"
+#include "framebuffer.h"
+#include "tilerenderer.h"
+#include "tracer.h"
+
+// traces frames with an opengl 4.3 compute shader instead of castBatch(), in builds with CONFIG += gpu:
+// the flat scene arrays are uploaded as shader storage buffers, every pixel is traced and antialiased
+// the way renderProgressive() renders its last level and the float framebuffer is read back,
+// so frames match the cpu ones up to float rounding; needs a QGuiApplication for its offscreen surface
+class GpuRenderer
+{
+public:
+    GpuRenderer();
+    ~GpuRenderer();
+
+    // creates the context on first use and uploads scene, which is loaded again after it changes;
+    // returns false and sets error without an opengl 4.3 context, in builds without gpu support
+    // or for scenes with planes or triangles
+    bool load(const FlatScene &scene, QString *error = nullptr);
+    // renders the square framebuffer with the scene loaded last; stats get pixels and samples traced;
+    // returns false and sets error on failure or for antialiasing patterns other than the grid
+    bool render(
+            Framebuffer &framebuffer,
+            const Camera &camera,
+            const TraceSettings &settings,
+            const Antialiasing &antialiasing,
+            RenderStats *stats = nullptr,
+            QString *error = nullptr);
+
+private:
+    struct Context;
+    std::unique_ptr<Context> context_;
+};
+
+#endif // GPURENDERER_H
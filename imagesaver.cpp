@@ -0,0 +1,80 @@
+#include "imagesaver.h"
+
+#include <algorithm>
+
+#include <QMutexLocker>
+
+#include "profiler.h"
+
+ImageSaver::ImageSaver(const int quality)
+    : quality_(quality)
+{
+    thread_.setMaxThreadCount(1);
+}
+
+ImageSaver::~ImageSaver()
+{
+    thread_.waitForDone();
+}
+
+void ImageSaver::save(const QImage &image, const QString &fileName, const QSize &size)
+{
+    QMutexLocker locker(&mutex_);
+    const auto pending = std::find_if(pending_.begin(), pending_.end(), [&](const Pending &other) {
+        return other.fileName == fileName;
+    });
+    if (pending != pending_.end()) {
+        pending->image = image;
+        pending->size = size;
+        return;
+    }
+    pending_.append({image, fileName, size});
+    if (isSaving_)
+        return;
+    isSaving_ = true;
+    thread_.start([this] { saveAll(); });
+}
+
+bool ImageSaver::waitForDone(QString *error)
+{
+    thread_.waitForDone();
+    QMutexLocker locker(&mutex_);
+    if (failed_.isEmpty())
+        return true;
+    if (error)
+        *error = "can't save " + failed_.join(", ");
+    failed_.clear();
+    return false;
+}
+
+int ImageSaver::pngQuality(const int compressionLevel)
+{
+    // inverse of the mapping of the png plugin: level = (100 - quality) * 9 / 91
+    return 100 - (std::clamp(compressionLevel, 0, 9) * 91 + 8) / 9;
+}
+
+void ImageSaver::saveAll()
+{
+    for (;;) {
+        Pending pending;
+        {
+            QMutexLocker locker(&mutex_);
+            if (pending_.isEmpty()) {
+                isSaving_ = false;
+                return;
+            }
+            pending = pending_.takeFirst();
+        }
+        const ProfileEvent event("save");
+        const StageTimer timer(Stage::ImageOutput);
+        const QImage image = !pending.size.isValid() || pending.image.size() == pending.size ? pending.image : pending.image.scaled(
+                    pending.size,
+                    Qt::IgnoreAspectRatio,
+                    Qt::SmoothTransformation);
+        if (!image.save(pending.fileName, nullptr, quality_)) {
+            QMutexLocker locker(&mutex_);
+            if (!failed_.contains(pending.fileName))
+                failed_.append(pending.fileName);
+        }
+    }
+}
@@ -0,0 +1,51 @@
+#ifndef IMAGESAVER_H
+#define IMAGESAVER_H
+
+#include <QImage>
+#include <QMutex>
+#include <QSize>
+#include <QString>
+#include <QStringList>
+#include <QThreadPool>
+#include <QVector>
+
+// saves images on a thread of its own, so a render loop never waits for encoding;
+// when encoding falls behind, a save of a file that is still pending replaces the waiting one
+class ImageSaver
+{
+public:
+    // quality as QImage::save() takes it, -1 is the default of the format
+    explicit ImageSaver(int quality = -1);
+    // waits for the pending saves
+    ~ImageSaver();
+
+    // the image has to own its pixels, so Framebuffer::toImage() ones are to be copied
+    // unless the framebuffer stays as it is until waitForDone() returns;
+    // it is scaled to a valid size before saving, on the saver thread too
+    void save(const QImage &image, const QString &fileName, const QSize &size = QSize());
+    // waits for every pending save; returns false and lists the files that weren't saved
+    // since the previous call if any
+    bool waitForDone(QString *error = nullptr);
+
+    // quality of QImage::save() giving a png compressed with zlib level from 0 to 9
+    static int pngQuality(int compressionLevel);
+
+private:
+    struct Pending
+    {
+        QImage image;
+        QString fileName;
+        QSize size;
+    };
+
+    void saveAll();
+
+    int quality_ = -1;
+    QMutex mutex_;
+    QVector<Pending> pending_;
+    QStringList failed_;
+    bool isSaving_ = false;
+    QThreadPool thread_;
+};
+
+#endif // IMAGESAVER_H
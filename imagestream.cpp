@@ -0,0 +1,313 @@
+#include "imagestream.h"
+
+#include <algorithm>
+
+#include <QMutexLocker>
+#include <QSysInfo>
+
+#include "profiler.h"
+
+namespace {
+
+quint32 crc32(quint32 crc, const uchar *data, const qint64 size)
+{
+    static const auto table = [] {
+        QVector<quint32> res(256);
+        for (quint32 index = 0; index < 256; ++index) {
+            quint32 value = index;
+            for (int bit = 0; bit < 8; ++bit)
+                value = value & 1 ? 0xedb88320u ^ (value >> 1) : value >> 1;
+            res[index] = value;
+        }
+        return res;
+    }();
+    crc = ~crc;
+    for (qint64 index = 0; index < size; ++index)
+        crc = table.at((crc ^ data[index]) & 0xff) ^ (crc >> 8);
+    return ~crc;
+}
+
+void appendBigEndian(QVector<uchar> &bytes, const quint32 value)
+{
+    bytes.append(uchar(value >> 24));
+    bytes.append(uchar(value >> 16));
+    bytes.append(uchar(value >> 8));
+    bytes.append(uchar(value));
+}
+
+// png of 8 bit rgb, the zlib stream in it is made of stored deflate blocks, one idat chunk per writeRows()
+class PngStream : public ImageStream
+{
+public:
+    PngStream(const QString &fileName, const int width, const int height)
+        : ImageStream(width, height), file_(fileName) {}
+
+    bool open()
+    {
+        if (!file_.open(QIODevice::WriteOnly))
+            return fail("can't open " + file_.fileName() + " for writing");
+        static const uchar signature[] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+        if (file_.write(reinterpret_cast<const char *>(signature), sizeof(signature)) != qint64(sizeof(signature)))
+            return fail("can't write " + file_.fileName());
+        QVector<uchar> header;
+        appendBigEndian(header, quint32(width_));
+        appendBigEndian(header, quint32(height_));
+        // 8 bits per channel, rgb, deflate, adaptive filtering, no interlace
+        for (const uchar value : {8, 2, 0, 0, 0})
+            header.append(value);
+        QVector<uchar> gamma;
+        // rows are linear like Framebuffer::toImage() ones
+        appendBigEndian(gamma, 100000);
+        return writeChunk("IHDR", header) && writeChunk("gAMA", gamma);
+    }
+
+    bool writeRows(const float *rows, const int count, const int floatsPerLine) override
+    {
+        const int bytesPerRow = 1 + width_ * 3;
+        raw_.resize(count * bytesPerRow);
+        for (int row = 0; row < count; ++row) {
+            const float *source = rows + row * floatsPerLine;
+            uchar *destination = raw_.data() + row * bytesPerRow;
+            // no filter
+            destination[0] = 0;
+            for (int index = 0; index < width_ * 3; ++index)
+                destination[1 + index] = static_cast<uchar>(std::clamp(source[index] * 255.0f, 0.0f, 255.0f));
+        }
+        updateAdler(raw_.constData(), raw_.size());
+
+        chunk_.clear();
+        if (!isStarted_) {
+            // zlib header: deflate with 32k window, no dictionary, fastest
+            chunk_.append(0x78);
+            chunk_.append(0x01);
+            isStarted_ = true;
+        }
+        constexpr int maxBlockSize = 65535;
+        for (int offset = 0; offset < raw_.size(); offset += maxBlockSize)
+            appendStoredBlock(raw_.constData() + offset, std::min(maxBlockSize, raw_.size() - offset), false);
+        return writeChunk("IDAT", chunk_);
+    }
+
+    bool finish() override
+    {
+        chunk_.clear();
+        appendStoredBlock(nullptr, 0, true);
+        appendBigEndian(chunk_, (adlerB_ << 16) | adlerA_);
+        const bool isWritten = writeChunk("IDAT", chunk_) && writeChunk("IEND", QVector<uchar>());
+        file_.close();
+        return isWritten;
+    }
+
+private:
+    void appendStoredBlock(const uchar *data, const int size, const bool isFinal)
+    {
+        chunk_.append(isFinal ? 1 : 0);
+        chunk_.append(uchar(size));
+        chunk_.append(uchar(size >> 8));
+        chunk_.append(uchar(~size));
+        chunk_.append(uchar(~size >> 8));
+        for (int index = 0; index < size; ++index)
+            chunk_.append(data[index]);
+    }
+    void updateAdler(const uchar *data, const int size)
+    {
+        constexpr quint32 modulo = 65521;
+        // the sums can't overflow in that many bytes
+        constexpr int run = 5552;
+        for (int first = 0; first < size; first += run) {
+            for (int index = first; index < std::min(size, first + run); ++index) {
+                adlerA_ += data[index];
+                adlerB_ += adlerA_;
+            }
+            adlerA_ %= modulo;
+            adlerB_ %= modulo;
+        }
+    }
+    bool writeChunk(const char *type, const QVector<uchar> &data)
+    {
+        QVector<uchar> header;
+        appendBigEndian(header, quint32(data.size()));
+        for (int index = 0; index < 4; ++index)
+            header.append(uchar(type[index]));
+        quint32 crc = crc32(0, header.constData() + 4, 4);
+        crc = crc32(crc, data.constData(), data.size());
+        QVector<uchar> footer;
+        appendBigEndian(footer, crc);
+        const auto write = [&](const QVector<uchar> &bytes) {
+            return file_.write(reinterpret_cast<const char *>(bytes.constData()), bytes.size()) == bytes.size();
+        };
+        if (!write(header) || !write(data) || !write(footer))
+            return fail("can't write " + file_.fileName());
+        return true;
+    }
+
+    QFile file_;
+    QVector<uchar> raw_;
+    QVector<uchar> chunk_;
+    bool isStarted_ = false;
+    quint32 adlerA_ = 1;
+    quint32 adlerB_ = 0;
+};
+
+// portable float map, its rows go from bottom to top, so each band is written at its place
+class PfmStream : public ImageStream
+{
+public:
+    PfmStream(const QString &fileName, const int width, const int height)
+        : ImageStream(width, height), file_(fileName) {}
+
+    bool open()
+    {
+        if (!file_.open(QIODevice::WriteOnly))
+            return fail("can't open " + file_.fileName() + " for writing");
+        // negative scale is little endian
+        const QByteArray header = "PF\n" + QByteArray::number(width_) + " " + QByteArray::number(height_)
+                + (QSysInfo::ByteOrder == QSysInfo::LittleEndian ? "\n-1\n" : "\n1\n");
+        headerSize_ = header.size();
+        if (file_.write(header) != header.size())
+            return fail("can't write " + file_.fileName());
+        return true;
+    }
+
+    bool writeRows(const float *rows, const int count, const int floatsPerLine) override
+    {
+        const qint64 bytesPerRow = qint64(width_) * 3 * sizeof(float);
+        for (int row = 0; row < count; ++row) {
+            const qint64 offset = headerSize_ + (height_ - 1 - (nextRow_ + row)) * bytesPerRow;
+            if (!file_.seek(offset)
+                    || file_.write(reinterpret_cast<const char *>(rows + row * floatsPerLine), bytesPerRow) != bytesPerRow)
+                return fail("can't write " + file_.fileName());
+        }
+        nextRow_ += count;
+        return true;
+    }
+
+    bool finish() override
+    {
+        file_.close();
+        return true;
+    }
+
+private:
+    QFile file_;
+    qint64 headerSize_ = 0;
+    int nextRow_ = 0;
+};
+
+}
+
+bool ImageStream::fail(const QString &error)
+{
+    error_ = error;
+    return false;
+}
+
+std::unique_ptr<ImageStream> openImageStream(const QString &fileName, const int width, const int height, QString *error)
+{
+    const auto open = [&](auto stream) -> std::unique_ptr<ImageStream> {
+        if (stream->open())
+            return stream;
+        if (error)
+            *error = stream->errorString();
+        return nullptr;
+    };
+    if (fileName.endsWith(".png", Qt::CaseInsensitive))
+        return open(std::make_unique<PngStream>(fileName, width, height));
+    if (fileName.endsWith(".pfm", Qt::CaseInsensitive))
+        return open(std::make_unique<PfmStream>(fileName, width, height));
+    if (error)
+        *error = "can't stream " + fileName + ", only .png and .pfm files can be";
+    return nullptr;
+}
+
+TileStreamer::TileStreamer(ImageStream &stream, const int bandHeight, const int maxBands)
+    : stream_(stream),
+      bandHeight_(std::max(1, bandHeight)),
+      floatsPerLine_(stream.width() * 3)
+{
+    bandCount_ = (stream.height() + bandHeight_ - 1) / bandHeight_;
+    const int slotCount = std::clamp(maxBands, 1, std::max(1, bandCount_));
+    slots_.resize(slotCount);
+    pixelsMissing_.resize(slotCount);
+    for (int band = 0; band < slotCount; ++band) {
+        slots_[band].resize(floatsPerLine_ * bandHeight_);
+        pixelsMissing_[band] = qint64(stream.width()) * std::min(bandHeight_, stream.height() - band * bandHeight_);
+    }
+    writer_.setMaxThreadCount(1);
+    writer_.start([this] { writeBands(); });
+}
+
+TileStreamer::~TileStreamer()
+{
+    {
+        // bands that will never be complete aren't waited for
+        QMutexLocker locker(&mutex_);
+        isFailed_ = isFailed_ || writtenBands_ < bandCount_;
+        bandAdded_.wakeAll();
+    }
+    writer_.waitForDone();
+}
+
+bool TileStreamer::beginTile(const int y)
+{
+    const int band = y / bandHeight_;
+    QMutexLocker locker(&mutex_);
+    while (!isFailed_ && band >= writtenBands_ + slots_.size())
+        bandWritten_.wait(&mutex_);
+    return !isFailed_;
+}
+
+void TileStreamer::addTile(const int x, const int y, const int width, const int height, const float *pixels, const int floatsPerLine)
+{
+    const int band = y / bandHeight_;
+    const int slot = band % slots_.size();
+    // workers fill disjoint parts of a slot that the writer doesn't touch until they are done
+    float *bandPixels = const_cast<float *>(slots_.at(slot).constData());
+    for (int row = 0; row < height; ++row)
+        std::copy_n(pixels + row * floatsPerLine, width * 3, bandPixels + (y - band * bandHeight_ + row) * floatsPerLine_ + x * 3);
+
+    QMutexLocker locker(&mutex_);
+    pixelsMissing_[slot] -= qint64(width) * height;
+    if (pixelsMissing_.at(slot) <= 0)
+        bandAdded_.wakeAll();
+}
+
+bool TileStreamer::finish()
+{
+    writer_.waitForDone();
+    QMutexLocker locker(&mutex_);
+    if (isFailed_)
+        return false;
+    return stream_.finish();
+}
+
+void TileStreamer::writeBands()
+{
+    for (int band = 0; band < bandCount_; ++band) {
+        const int slot = band % slots_.size();
+        {
+            QMutexLocker locker(&mutex_);
+            while (!isFailed_ && pixelsMissing_.at(slot) > 0)
+                bandAdded_.wait(&mutex_);
+            if (isFailed_)
+                return;
+        }
+        const int rows = std::min(bandHeight_, stream_.height() - band * bandHeight_);
+        bool isWritten = false;
+        {
+            const ProfileEvent event("write band", {{"band", band}});
+            const StageTimer timer(Stage::ImageOutput);
+            isWritten = stream_.writeRows(slots_.at(slot).constData(), rows, floatsPerLine_);
+        }
+
+        QMutexLocker locker(&mutex_);
+        isFailed_ = !isWritten;
+        ++writtenBands_;
+        const int nextBand = band + slots_.size();
+        if (nextBand < bandCount_)
+            pixelsMissing_[slot] = qint64(stream_.width()) * std::min(bandHeight_, stream_.height() - nextBand * bandHeight_);
+        bandWritten_.wakeAll();
+        if (isFailed_)
+            return;
+    }
+}
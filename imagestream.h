@@ -0,0 +1,78 @@
+#ifndef IMAGESTREAM_H
+#define IMAGESTREAM_H
+
+#include <memory>
+
+#include <QFile>
+#include <QMutex>
+#include <QString>
+#include <QThreadPool>
+#include <QVector>
+#include <QWaitCondition>
+
+// image file written row by row from top to bottom, each row given
+// as linear float rgb like Framebuffer ones; nothing but the file holds written rows
+class ImageStream
+{
+public:
+    virtual ~ImageStream() = default;
+
+    int width() const { return width_; }
+    int height() const { return height_; }
+    QString errorString() const { return error_; }
+
+    // rows [y, y + count) continuing the ones written before, row r starts at rows + r * floatsPerLine
+    virtual bool writeRows(const float *rows, int count, int floatsPerLine) = 0;
+    // after the last row
+    virtual bool finish() = 0;
+
+protected:
+    ImageStream(int width, int height) : width_(width), height_(height) {}
+    bool fail(const QString &error);
+
+    int width_ = 0;
+    int height_ = 0;
+    QString error_;
+};
+
+// .png: 8 bit, quantized like Framebuffer::toImage(), stored without compression;
+// .pfm: 32 bit float, as rendered; returns null and sets error if the file can't be created
+std::unique_ptr<ImageStream> openImageStream(const QString &fileName, int width, int height, QString *error = nullptr);
+
+// collects finished tiles into bands of bandHeight whole rows, which are written in order
+// into the stream on a thread of its own, so encoding overlaps rendering;
+// at most maxBands bands are held, tiles of farther ones wait in beginTile()
+class TileStreamer
+{
+public:
+    TileStreamer(ImageStream &stream, int bandHeight, int maxBands);
+    ~TileStreamer();
+
+    // called before rendering a tile starting at row y, waits until its band can be held;
+    // returns false if writing failed and the tile can be skipped
+    bool beginTile(int y);
+    // copies a finished tile, row r starts at pixels + r * floatsPerLine
+    void addTile(int x, int y, int width, int height, const float *pixels, int floatsPerLine);
+    // waits for every band to be written and finishes the stream
+    bool finish();
+
+private:
+    void writeBands();
+
+    ImageStream &stream_;
+    int bandHeight_ = 0;
+    int bandCount_ = 0;
+    int floatsPerLine_ = 0;
+    // band b is held in slot b % slots_.size()
+    QVector<QVector<float>> slots_;
+    QVector<qint64> pixelsMissing_;
+
+    QMutex mutex_;
+    QWaitCondition bandAdded_;
+    QWaitCondition bandWritten_;
+    int writtenBands_ = 0;
+    bool isFailed_ = false;
+    QThreadPool writer_;
+};
+
+#endif // IMAGESTREAM_H
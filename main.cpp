@@ -1,253 +1,378 @@
-#include <cmath>
 #include <algorithm>
 #include <iostream>
-#include <memory>
-#include <numeric>
 
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#ifdef YART_GPU
+#include <QGuiApplication>
+#endif
 #include <QImage>
-#include <QColorSpace>
+#include <QThread>
+#include <QThreadPool>
 #include <QVector>
-#include <QVector3D>
 
+#include "animation.h"
+#include "denoiser.h"
+#include "distributed.h"
+#include "flatscene.h"
+#include "framebuffer.h"
+#include "gpurenderer.h"
+#include "imagesaver.h"
+#include "imagestream.h"
+#include "profiler.h"
+#include "scenes.h"
+#include "tilerenderer.h"
+#include "tracer.h"
 
-namespace {
-
-using Color = QVector3D;
-class Light
-{
-public:
-    virtual float power(
-            const QVector3D &origin,
-            const QVector3D &normalDirection) const = 0;
-    Color color = Color(1, 1, 1);
-    QVector3D center;
-};
-
-class Bulb : public Light
+int main(int argc, char **argv)
 {
-public:
-    Bulb(const QVector3D &center, const Color &color)
-    {
-        this->center = center;
-        this->color = color;
-    }
-    float power(
-                const QVector3D &origin,
-                const QVector3D &normalDirection) const override
-    {
-        const QVector3D v1 = (origin - center).normalized();
-        const QVector3D v2 = normalDirection;
-        const float rad = std::acos(QVector3D::dotProduct(v1, v2));
-        if (std::abs(rad) > M_PI_2)
-            return 0;
-        return 1 - std::abs(rad) / M_PI_2;
-    }
-};
+    using std::cout;
 
-class Shape
-{
-public:
-    virtual ~Shape() = default;
-    virtual bool intersects(
-            const QVector3D &origin,
-            const QVector3D &direction,
-            QVector3D *intersectionOrigin,
-            QVector3D *normalDirection,
-            QVector3D *reflectionDirection) const = 0;
-    Color color = Color(1, 0, 0);
-    float mirror = 0.0f;
-};
-
-class Sphere : public Shape
-{
-public:
-    Sphere(const QVector3D &center, const float &radius, const Color &color, const float mirror)
-        : center_(center), radius_(radius) { this->color = color; this->mirror = mirror; }
-private:
-    QVector3D center_;
-    float radius_ = 0.0f;
-    bool intersects(
-            const QVector3D &origin,
-            const QVector3D &direction,
-            QVector3D *intersectionOrigin,
-            QVector3D *normalDirection,
-            QVector3D *reflectionDirection) const override
-    {
-        const QVector3D m = origin - center_;
-        const float b = QVector3D::dotProduct(direction, m);
-        const float c = QVector3D::dotProduct(m, m) - radius_ * radius_;
-        if (c > 0.0f && b > 0.0f)
-            return false;
+#ifdef YART_GPU
+    // the gpu renderer draws into an offscreen surface, which needs a gui application
+    QGuiApplication application(argc, argv);
+#else
+    QCoreApplication application(argc, argv);
+#endif
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Renders a scene to an image file.");
+    parser.addHelpOption();
+    parser.addPositionalArgument("scene", "Text or binary scene file, the built in scene if not given.", "[scene]");
+    const QCommandLineOption compileOption("compile", "Save the compiled scene as a binary scene file instead of rendering it.", "file");
+    parser.addOption(compileOption);
+    const QCommandLineOption outputOption("output", "Image file to render to, output.png by default.", "file", "output.png");
+    parser.addOption(outputOption);
+    const QCommandLineOption resolutionOption("resolution", "Width and height of the image, 512 by default.", "pixels", "512");
+    parser.addOption(resolutionOption);
+    const QCommandLineOption streamOption("stream", "Render the final image only, writing its tiles to the file as they are done "
+                                                    "instead of holding the whole image, for very large ones; .png and .pfm files can be streamed.");
+    parser.addOption(streamOption);
+    const QCommandLineOption compressionOption("compression", "Zlib compression level of png images, from 0, none, to 9, the smallest.", "level");
+    parser.addOption(compressionOption);
+    const QCommandLineOption finalOnlyOption("final-only", "Save only the final image, not the progressive levels before it.");
+    parser.addOption(finalOnlyOption);
+    const QCommandLineOption traceOption("trace", "Save a chrome trace of the tiles and stages, in builds with CONFIG += profiling.", "file");
+    parser.addOption(traceOption);
+    const QCommandLineOption sortRaysOption("sort-rays", "Sort reflected rays of every batch by direction and origin before tracing them.");
+    parser.addOption(sortRaysOption);
+    const QCommandLineOption coordinateOption("coordinate", "Render the final image only, leasing its tiles to workers connecting on the port "
+                                                            "instead of rendering them here.", "port");
+    parser.addOption(coordinateOption);
+    const QCommandLineOption workerOption("worker", "Render tiles leased by the coordinator at the address for the same scene, "
+                                                    "seen by its camera, instead of an image.", "host:port");
+    parser.addOption(workerOption);
+    const QCommandLineOption leaseTimeoutOption("lease-timeout", "Seconds a worker has for a leased tile before the coordinator leases it "
+                                                                 "to another one, 60 by default.", "seconds", "60");
+    parser.addOption(leaseTimeoutOption);
+    const QCommandLineOption perspectiveOption("perspective", "View the scene with a perspective camera of the field of view "
+                                                              "from where its camera is.", "degrees");
+    parser.addOption(perspectiveOption);
+    const QCommandLineOption animationOption("animation", "Render the frames of the keyframes file, each to the output file "
+                                                          "numbered by frame, e.g. output0000.png.", "file");
+    parser.addOption(animationOption);
+    const QCommandLineOption gpuOption("gpu", "Render the final image only, with an opengl 4.3 compute shader, in builds with CONFIG += gpu.");
+    parser.addOption(gpuOption);
+    const QCommandLineOption samplesOption("samples", "Samples per pixel of high contrast, 4 by default; the grid rounds it down to a square.",
+                                           "count", "4");
+    parser.addOption(samplesOption);
+    const QCommandLineOption samplingOption("sampling", "Where the samples of a pixel are: on a grid, the default, random or sobol, "
+                                                        "scrambled per pixel.", "pattern", "grid");
+    parser.addOption(samplingOption);
+    const QCommandLineOption denoiseOption("denoise", "Denoise the final image before saving it, guided by the normals and albedo "
+                                                      "of what its pixels see; frames that are streamed aren't.");
+    parser.addOption(denoiseOption);
+    const QCommandLineOption threadsOption("threads", "Threads rendering tiles, the ones leased by the coordinator as a worker too; "
+                                                      "all cores by default.", "count", QString::number(QThread::idealThreadCount()));
+    parser.addOption(threadsOption);
+    parser.process(application);
+    const QStringList arguments = parser.positionalArguments();
 
-        const float discr = b * b - c;
-        if (discr < 0.0f)
-            return false;
-
-        // distance?    // aka starts inside the sphere
-        const float t = std::max(0.0f, -b - std::sqrt(discr));
-        const QVector3D intersection = origin + direction * t;
-        const QVector3D normal = (intersection - center_).normalized();
-        const QVector3D reflection = direction - 2 * normal * QVector3D::dotProduct(direction, normal);
-        if (intersectionOrigin)
-            *intersectionOrigin = intersection;
-        if (normalDirection)
-            *normalDirection = normal;
-        if (reflectionDirection)
-            *reflectionDirection = reflection;
-        return true;
+    Camera camera = defaultCamera();
+    const int resolutionPrefered = parser.value(resolutionOption).toInt();
+    const QString outputFileName = parser.value(outputOption);
+    Antialiasing antialiasing;
+    antialiasing.samplesPerPixel = std::max(1, parser.value(samplesOption).toInt());
+    antialiasing.contrastThreshold = 0.05f;
+    const QString pattern = parser.value(samplingOption);
+    if (pattern == "random") {
+        antialiasing.pattern = sampling::Random;
+    } else if (pattern == "sobol") {
+        antialiasing.pattern = sampling::Sobol;
+    } else if (pattern != "grid") {
+        cout << "unknown sampling " << pattern.toStdString() << ", expected grid, random or sobol\n";
+        return 1;
     }
-};
-
-template <typename T>
-QVector<T> allBut(const QVector<T> &vector, const int index)
-{
-    auto res = vector;
-    res.removeAt(index);
-    return res;
-}
+    TraceSettings traceSettings;
+    traceSettings.colorOnMiss = Color(0, 0, 1);
+    traceSettings.colorOnFullShade = Color(0.1, 0.1, 0.1);
+    traceSettings.maxDepth = 8;
+    traceSettings.minThroughput = 1.0f / 1024;
+    traceSettings.sortSecondaryRays = parser.isSet(sortRaysOption);
+    const int threadCount = std::max(1, parser.value(threadsOption).toInt());
+    const int tileSize = 32;
+    const int bvhLeafSize = simd::width;
 
-Color cast(
-        const QVector<std::shared_ptr<Shape>> &shapes,
-        const QVector<std::shared_ptr<Light>> &lights,
-        const QVector3D &origin,
-        const QVector3D &direction,
-        const Color &colorOnMiss,
-        const Color &colorOnFullShade)
-{
-    const int nShapes = shapes.size();
-    float shortestDistanceSquared = std::numeric_limits<float>::max();
-    int shapeIndex = -1;
-    QVector3D intersectionOrigin;
-    QVector3D normalDirection;
-    QVector3D reflectionDirection;
-    for (int index = 0; index < nShapes; ++index) {
-        const auto &shape = shapes.at(index);
-        QVector3D intersection;
-        QVector3D normal;
-        QVector3D reflection;
-        if (!shape->intersects(
-                    origin,
-                    direction,
-                    &intersection,
-                    &normal,
-                    &reflection))
-            continue;
-        const float distanceSquared = (intersection - origin).lengthSquared();
-        if (distanceSquared >= shortestDistanceSquared)
-            continue;
-        shortestDistanceSquared = distanceSquared;
-        intersectionOrigin = intersection;
-        normalDirection = normal;
-        reflectionDirection = reflection;
-        shapeIndex = index;
+    FlatScene scene;
+    QString error;
+    if (arguments.isEmpty()) {
+        const SceneDescription sceneDescription = defaultScene();
+        scene = FlatScene::compile(sceneDescription.shapes, sceneDescription.lights, bvhLeafSize);
+    } else if (FlatScene::isSceneFile(arguments.first())) {
+        if (!FlatScene::load(arguments.first(), scene, &error)) {
+            cout << error.toStdString() << "\n";
+            return 1;
+        }
+    } else {
+        SceneDescription sceneDescription;
+        if (!loadScene(arguments.first(), sceneDescription, &error)) {
+            cout << error.toStdString() << "\n";
+            return 1;
+        }
+        scene = FlatScene::compile(sceneDescription.shapes, sceneDescription.lights, bvhLeafSize);
+        if (sceneDescription.hasCamera)
+            camera = sceneDescription.camera;
     }
-    if (shapeIndex < 0)
-        return colorOnMiss;
-
-    const auto &shape = shapes.at(shapeIndex);
-    const auto otherShapes = allBut(shapes, shapeIndex);
-    Color colorSelf = shape->color;
-    if (shape->mirror > 0.0f) {
-        const Color colorMirrored = cast(
-                    otherShapes,
-                    lights,
-                    intersectionOrigin,
-                    reflectionDirection,
-                    colorOnMiss,
-                    colorOnFullShade);
-        colorSelf = colorSelf * (1 - shape->mirror) + colorMirrored * shape->mirror;
+    if (parser.isSet(perspectiveOption)) {
+        camera.projection = Camera::Perspective;
+        camera.size = parser.value(perspectiveOption).toFloat();
     }
-    Color colorMask = colorOnFullShade;
-    for (const auto &light : lights) {
-        bool isBlocked = false;
-        for (const auto &otherShape : otherShapes) {
-            if (!otherShape->intersects(
-                        intersectionOrigin,
-                        (intersectionOrigin - light->center).normalized(),
-                        nullptr,
-                        nullptr,
-                        nullptr))
-                continue;
-            isBlocked = true;
-            break;
+    const Bvh::BuildStats &bvhStats = scene.sphereBvh().buildStats();
+    cout << "bvh: " << bvhStats.shapeCount << " shapes, "
+         << bvhStats.nodeCount << " nodes, "
+         << bvhStats.leafCount << " leaves of up to " << bvhStats.maxLeafSize << " shapes, "
+         << "depth " << bvhStats.depth << ", "
+         << "built in " << bvhStats.buildTimeMs << " ms, "
+         << "leaves tested with " << simd::name << " kernels\n";
+
+    if (parser.isSet(compileOption)) {
+        if (!scene.save(parser.value(compileOption), &error)) {
+            cout << error.toStdString() << "\n";
+            return 1;
         }
-        if (isBlocked)
-            continue;
-        const float power = light->power(
-                    intersectionOrigin,
-                    normalDirection);
-        if (power <= 0.0f)
-            continue;
-        colorMask += power * light->color;
+        return 0;
     }
-    return colorSelf * colorMask;
-}
-
-inline int toRgbComponent(const float value)
-{
-    return std::clamp(static_cast<int>(value * 255), 0, 255);
-}
 
-QRgb toRgb(const Color &color)
-{
-    return qRgb(toRgbComponent(color.x()), toRgbComponent(color.y()), toRgbComponent(color.z()));
-}
-
-}
+    if (resolutionPrefered <= 0) {
+        cout << "wrong resolution " << parser.value(resolutionOption).toStdString() << "\n";
+        return 1;
+    }
 
-int main(int, char **)
-{
-    using std::cout;
+    if (parser.isSet(traceOption) && !profiling::isEnabled)
+        cout << "built without profiling, no trace is recorded\n";
+    // prints where time went once rendering is done
+    qint64 slowestTileNanoseconds = 0;
+    const auto reportProfile = [&] {
+        if (!profiling::isEnabled)
+            return true;
+        const StageTimes stages = profiling::totalStageTimes();
+        cout << "stages summed over threads: "
+             << stages[Stage::ClosestHits] / 1e6 << " ms in closest hits, "
+             << stages[Stage::Shading] / 1e6 << " ms in shading, "
+             << stages[Stage::Tiles] / 1e6 << " ms in tiles, the slowest of "
+             << slowestTileNanoseconds / 1e6 << " ms, "
+             << stages[Stage::ImageOutput] / 1e6 << " ms in image output\n";
+        if (parser.isSet(traceOption) && !profiling::saveTrace(parser.value(traceOption), &error)) {
+            cout << error.toStdString() << "\n";
+            return false;
+        }
+        return true;
+    };
 
-    const QVector<std::shared_ptr<Shape>> shapes = {
-        std::shared_ptr<Shape>(new Sphere(QVector3D(0, 0, 0), 5,  Color(1.0, 0.5, 0.5), 0.9)),
-        std::shared_ptr<Shape>(new Sphere(QVector3D(0, -12, 0), 4, Color(0.5, 1.0, 0.5), 0.9)),
-        std::shared_ptr<Shape>(new Sphere(QVector3D(5, 8, 7), 3, Color(1, 1, 1), 0.5)),
-        std::shared_ptr<Shape>(new Sphere(QVector3D(7, 5, 5), 2, Color(0.5, 0.5, 1.0), 0)),
-        std::shared_ptr<Shape>(new Sphere(QVector3D(12, 4, 5), 1, Color(0.5, 0.5, 0.2), 0)),
-        std::shared_ptr<Shape>(new Sphere(QVector3D(-100, 0, -50), 100, Color(0.5, 0.5, 0.5), 0.4)),
-        std::shared_ptr<Shape>(new Sphere(QVector3D(-100, 0, 50), 100, Color(1, 1, 1), 0.4)),
+    QThreadPool threadPool;
+    threadPool.setMaxThreadCount(threadCount);
+    const BatchKernel trace = batchKernel(kernelFeatures(scene, traceSettings));
+    const auto shader = [&](const Sample *samples, const int count, Color *colors, Arena &scratch, const int resolution) {
+        const ArenaScope scope(scratch);
+        Ray *rays = scratch.allocateArray<Ray>(count);
+        camera.generateRays(samples, count, resolution, rays);
+        trace(scene, traceSettings, rays, count, colors, scratch, nullptr, nullptr);
     };
-    const QVector<std::shared_ptr<Light>> lights = {
-        std::shared_ptr<Light>(new Bulb(QVector3D(-20, -10, 20), Color(1, 1, 1) * 0.7)),
-        std::shared_ptr<Light>(new Bulb(QVector3D(-20, -12, 22), Color(1, 1, 1) * 0.7)),
+    // guides are traced for the camera the frame was rendered with
+    const DenoiseSettings denoiseSettings;
+    const auto denoiseFrame = [&](Framebuffer &framebuffer, const Camera &frameCamera) {
+        if (!parser.isSet(denoiseOption))
+            return;
+        ScratchArenas scratchArenas(threadPool.maxThreadCount());
+        const DenoiseGuides guides = traceDenoiseGuides(scene, frameCamera, framebuffer.width(), threadPool, tileSize, scratchArenas);
+        denoise(framebuffer, guides, denoiseSettings, threadPool, tileSize, scratchArenas);
     };
+    const int imageQuality = parser.isSet(compressionOption) && outputFileName.endsWith(".png", Qt::CaseInsensitive)
+            ? ImageSaver::pngQuality(parser.value(compressionOption).toInt())
+            : -1;
+
+    if (parser.isSet(workerOption)) {
+        const QString address = parser.value(workerOption);
+        const int separator = address.lastIndexOf(':');
+        bool isPort = false;
+        const quint16 port = address.mid(separator + 1).toUShort(&isPort);
+        if (separator < 0 || !isPort) {
+            cout << "wrong coordinator address " << address.toStdString() << ", expected host:port\n";
+            return 1;
+        }
+        int tileCount = 0;
+        if (!renderForCoordinator(address.left(separator), port, scene, threadPool, &error, &tileCount)) {
+            cout << error.toStdString() << "\n";
+            return 1;
+        }
+        cout << tileCount << " tiles rendered for " << address.toStdString() << "\n";
+        return reportProfile() ? 0 : 1;
+    }
 
-    const float cameraSize = 30.0f;
-    const QVector3D cameraOrigin(100, 0, 0);
-    const QVector3D cameraDirection(-1, 0, 0);
-    const int resolutionPrefered = 512;
-    const int msaaMultiplier = 2;
-    const Color colorOnMiss(0, 0, 1);
-    const Color colorOnFullShade(0.1, 0.1, 0.1);
+    if (parser.isSet(coordinateOption)) {
+        RenderJob job;
+        job.resolution = resolutionPrefered;
+        job.tileSize = tileSize;
+        job.camera = camera;
+        job.antialiasing = antialiasing;
+        job.traceSettings = traceSettings;
+        job.sphereCount = scene.spheres().size();
+        job.bulbCount = scene.bulbs().size();
+        RenderCoordinator coordinator(job, std::max(1, parser.value(leaseTimeoutOption).toInt()) * 1000);
+        if (!coordinator.listen(parser.value(coordinateOption).toUShort(), &error)) {
+            cout << error.toStdString() << "\n";
+            return 1;
+        }
+        cout << "leasing " << coordinator.leases().tileCount() << " tiles to workers on port " << coordinator.port() << "\n";
+        coordinator.run();
+        cout << resolutionPrefered << "x" << resolutionPrefered << " rendered by "
+             << coordinator.workerCount() << " workers, "
+             << coordinator.leases().reassignedCount() << " tiles leased again\n";
+        Framebuffer &framebuffer = coordinator.framebuffer();
+        denoiseFrame(framebuffer, camera);
+        ImageSaver imageSaver(imageQuality);
+        imageSaver.save(framebuffer.toImage(), outputFileName, QSize());
+        if (!imageSaver.waitForDone(&error)) {
+            cout << error.toStdString() << "\n";
+            return 1;
+        }
+        return reportProfile() ? 0 : 1;
+    }
 
-    QVector<int> resolutionsDownscaled;
-    for (int resolutionDownscaled = resolutionPrefered * msaaMultiplier; resolutionDownscaled > 16; resolutionDownscaled /= 2)
-        resolutionsDownscaled.push_front(resolutionDownscaled);
+    if (parser.isSet(animationOption)) {
+        Animation animation;
+        if (!Animation::load(parser.value(animationOption), animation, &error) || !animation.fits(scene, &error)) {
+            cout << error.toStdString() << "\n";
+            return 1;
+        }
+        const int extensionStart = outputFileName.lastIndexOf('.');
+        const QString baseName = extensionStart >= 0 ? outputFileName.left(extensionStart) : outputFileName;
+        const QString extension = extensionStart >= 0 ? outputFileName.mid(extensionStart) : QString();
+        const int digits = std::max(4, int(QString::number(animation.frameCount() - 1).size()));
+        // frame n is encoded while n + 1 renders, its framebuffer stays as it is until then
+        ImageSaver imageSaver(imageQuality);
+        const bool isRendered = renderAnimation(animation, scene, camera, traceSettings, antialiasing, resolutionPrefered, threadPool, tileSize,
+                                                [&](const int frame, Framebuffer &framebuffer, const RenderStats &stats) {
+            const Bvh::TraversalStats &traversal = stats.traversal;
+            cout << "frame " << frame + 1 << " of " << animation.frameCount() << ": "
+                 << stats.samplesTraced << " samples, "
+                 << traversal.nodesVisited / double(std::max<qint64>(1, traversal.traversals)) << " bvh nodes visited per traversal";
+            if (RayStats::isCounted)
+                cout << ", " << stats.rays.hits << " hits";
+#ifdef YART_COUNT_ALLOCATIONS
+            cout << ", " << stats.allocations << " allocations while tracing";
+#endif
+            cout << "\n";
+            slowestTileNanoseconds = std::max(slowestTileNanoseconds, stats.slowestTileNanoseconds);
+            if (!imageSaver.waitForDone(&error))
+                return false;
+            denoiseFrame(framebuffer, animation.camera(frame, camera));
+            imageSaver.save(framebuffer.toImage(), baseName + QString::number(frame).rightJustified(digits, '0') + extension);
+            return true;
+        });
+        if (!isRendered || !imageSaver.waitForDone(&error)) {
+            cout << error.toStdString() << "\n";
+            return 1;
+        }
+        return reportProfile() ? 0 : 1;
+    }
+
+    if (parser.isSet(gpuOption)) {
+        GpuRenderer gpuRenderer;
+        Framebuffer framebuffer(resolutionPrefered, resolutionPrefered);
+        RenderStats stats;
+        if (!gpuRenderer.load(scene, &error) || !gpuRenderer.render(framebuffer, camera, traceSettings, antialiasing, &stats, &error)) {
+            cout << error.toStdString() << "\n";
+            return 1;
+        }
+        cout << resolutionPrefered << "x" << resolutionPrefered << " rendered on the gpu: "
+             << stats.pixelsTraced << " pixels traced, "
+             << stats.pixelsSupersampled << " supersampled, "
+             << stats.samplesTraced << " samples\n";
+        denoiseFrame(framebuffer, camera);
+        ImageSaver imageSaver(imageQuality);
+        imageSaver.save(framebuffer.toImage(), outputFileName, QSize());
+        if (!imageSaver.waitForDone(&error)) {
+            cout << error.toStdString() << "\n";
+            return 1;
+        }
+        return 0;
+    }
 
-    for (int resolution : resolutionsDownscaled){
-        QImage image(resolution, resolution, QImage::Format_RGB888);
-        image.setColorSpace(QColorSpace::SRgbLinear);
-        const float delimeter = image.width() / (cameraSize);
-        for (int y = 0; y < image.height(); ++y){
-            for (int x = 0; x < image.width(); ++x) {
-                const QVector3D origin(
-                            cameraOrigin.x(),
-                            cameraOrigin.y() - cameraSize * 0.5 + x / delimeter,
-                            cameraOrigin.z() - cameraSize * 0.5 + y / delimeter);
-                const Color color = cast(shapes, lights, origin, cameraDirection, colorOnMiss, colorOnFullShade);
-                image.setPixel(x, y, toRgb(color));
-            }
+    if (parser.isSet(streamOption)) {
+        const std::unique_ptr<ImageStream> stream = openImageStream(outputFileName, resolutionPrefered, resolutionPrefered, &error);
+        if (!stream) {
+            cout << error.toStdString() << "\n";
+            return 1;
         }
-        image = image.scaled(
-                    resolutionPrefered,
-                    resolutionPrefered,
-                    Qt::IgnoreAspectRatio,
-                    Qt::SmoothTransformation);
-        if (!image.save("output.png")) {
-            cout << "can't save output image\n";
+        ScratchArenas scratchArenas(threadPool.maxThreadCount());
+        RenderStats stats;
+        const bool isStreamed = renderStreamed(*stream, threadPool, tileSize, scratchArenas, [&](const Sample *samples, const int count, Color *colors, Arena &scratch) {
+            shader(samples, count, colors, scratch, resolutionPrefered);
+        }, antialiasing, &stats);
+        if (!isStreamed) {
+            cout << stream->errorString().toStdString() << "\n";
             return 1;
         }
+        cout << resolutionPrefered << "x" << resolutionPrefered << " streamed: "
+             << stats.pixelsTraced << " pixels traced, "
+             << stats.pixelsSupersampled << " supersampled, "
+             << stats.samplesTraced << " samples";
+#ifdef YART_COUNT_ALLOCATIONS
+        cout << ", " << stats.allocations << " allocations while tracing";
+#endif
+        cout << "\n";
+        slowestTileNanoseconds = stats.slowestTileNanoseconds;
+        return reportProfile() ? 0 : 1;
+    }
+
+    // halves down to above 16 pixels before the final level, which is rendered however small it is
+    QVector<int> resolutionsDownscaled = {resolutionPrefered};
+    for (int resolutionDownscaled = resolutionPrefered / 2; resolutionDownscaled > 16; resolutionDownscaled /= 2)
+        resolutionsDownscaled.push_front(resolutionDownscaled);
+
+    // levels are encoded in the background, the last one is ready after antialiasing
+    ImageSaver imageSaver(imageQuality);
+    const int levelCount = resolutionsDownscaled.size() + 1;
+    int levelsReady = 0;
+    renderProgressive(resolutionsDownscaled, threadPool, tileSize, antialiasing, shader, [&](Framebuffer &framebuffer, const RenderStats &stats) {
+        const Bvh::TraversalStats &traversal = stats.traversal;
+        const double traversals = std::max<qint64>(1, traversal.traversals);
+        cout << framebuffer.width() << "x" << framebuffer.height() << ": "
+             << stats.pixelsTraced << " pixels traced, "
+             << stats.pixelsReused << " reused, "
+             << stats.pixelsSupersampled << " supersampled, "
+             << stats.samplesTraced << " samples, "
+             << traversal.traversals << " bvh traversals, "
+             << traversal.nodesVisited / traversals << " nodes and "
+             << traversal.shapesTested / traversals << " shapes tested per traversal";
+        if (RayStats::isCounted)
+            cout << ", " << stats.rays.hits << " hits, "
+                 << stats.rays.shadowsBlocked << " of " << stats.rays.shadow << " shadow rays blocked, "
+                 << stats.rays.shadowsBlockedByLastOccluder << " of them by the last occluder of their bulb";
+#ifdef YART_COUNT_ALLOCATIONS
+        cout << ", " << stats.allocations << " allocations while tracing";
+#endif
+        cout << "\n";
+        slowestTileNanoseconds = std::max(slowestTileNanoseconds, stats.slowestTileNanoseconds);
+        if (++levelsReady == levelCount)
+            denoiseFrame(framebuffer, camera);
+        if (levelsReady == levelCount || !parser.isSet(finalOnlyOption))
+            imageSaver.save(framebuffer.toImage().copy(), outputFileName, QSize(resolutionPrefered, resolutionPrefered));
+        return true;
+    });
+    if (!imageSaver.waitForDone(&error)) {
+        cout << error.toStdString() << "\n";
+        return 1;
     }
-    return 0;
+    return reportProfile() ? 0 : 1;
 }
@@ -0,0 +1,243 @@
+#include "preview.h"
+
+#include <cmath>
+#include <algorithm>
+
+PreviewRenderer::PreviewRenderer(
+        const FlatScene &scene,
+        const Camera &camera,
+        const TraceSettings &traceSettings,
+        const Antialiasing &antialiasing,
+        const int resolution,
+        const int tileSize,
+        const int threadCount)
+    : scene_(scene),
+      camera_(camera),
+      traceSettings_(traceSettings),
+      antialiasing_(antialiasing),
+      resolution_(resolution),
+      tileSize_(std::max(1, tileSize)),
+      tilesPerRow_((resolution + tileSize_ - 1) / tileSize_),
+      scratchArenas_(std::max(1, threadCount)),
+      traced_(resolution, resolution),
+      image_(resolution, resolution),
+      tiles_(splitToTiles(resolution, resolution, tileSize_))
+{
+    threadPool_.setMaxThreadCount(std::max(1, threadCount));
+    // the primary hit cache is laid out by the grid, scattered samples wouldn't find theirs in it
+    antialiasing_.pattern = sampling::Grid;
+    // spheres are stored in bvh order, its shape indices are the ones of the description
+    const FlatArray<int> &shapeIndices = scene_.sphereBvh().shapeIndices();
+    flatSpheres_.resize(shapeIndices.size());
+    for (int index = 0; index < shapeIndices.size(); ++index)
+        flatSpheres_[shapeIndices.at(index)] = index;
+    footprints_.resize(tiles_.size());
+    isDirty_.fill(true, tiles_.size());
+    isVisibilityDirty_.fill(true, tiles_.size());
+}
+
+void PreviewRenderer::moveSphere(const int sphere, const QVector3D &center)
+{
+    const int index = flatSpheres_.at(sphere);
+    const Aabb oldBounds = scene_.sphereBounds(index);
+    scene_.setSphere(index, center, scene_.spheres().radius(index));
+    const Aabb newBounds = scene_.sphereBounds(index);
+    // rays that hit it, and the ones that may hit it now or that it shadowed
+    markTiles([&](const RayFootprint &footprint) {
+        return std::binary_search(footprint.shapes.begin(), footprint.shapes.end(), index)
+                || footprint.mayReach(oldBounds)
+                || footprint.mayReach(newBounds);
+    }, true);
+}
+
+void PreviewRenderer::setSphereMaterial(const int sphere, const Color &color, const float mirror)
+{
+    const int material = scene_.sphereMaterials().at(flatSpheres_.at(sphere));
+    scene_.setMaterial(material, color, mirror);
+    markTiles([&](const RayFootprint &footprint) {
+        return std::any_of(footprint.shapes.begin(), footprint.shapes.end(), [&](const int index) {
+            return scene_.shapeMaterial(index) == material;
+        });
+    });
+}
+
+void PreviewRenderer::moveLight(const int light, const QVector3D &center)
+{
+    FlatScene::PointLight bulb = scene_.bulbs().at(light);
+    bulb.center = center;
+    const QVector3D extent(bulb.radius, bulb.radius, bulb.radius);
+    const Aabb influence(center - extent, center + extent);
+    // points it lit before, and the ones it reaches now
+    markTiles([&](const RayFootprint &footprint) {
+        if (std::binary_search(footprint.bulbs.begin(), footprint.bulbs.end(), light))
+            return true;
+        if (footprint.shapes.isEmpty())
+            return false;
+        return std::isinf(bulb.radius) || footprint.mayHitWithin(influence);
+    });
+    scene_.setBulb(light, bulb);
+}
+
+void PreviewRenderer::setLightColor(const int light, const Color &color)
+{
+    FlatScene::PointLight bulb = scene_.bulbs().at(light);
+    bulb.color = color;
+    scene_.setBulb(light, bulb);
+    markTiles([&](const RayFootprint &footprint) {
+        return std::binary_search(footprint.bulbs.begin(), footprint.bulbs.end(), light);
+    });
+}
+
+void PreviewRenderer::invalidate()
+{
+    isDirty_.fill(true);
+    isVisibilityDirty_.fill(true);
+}
+
+void PreviewRenderer::setCachesPrimaryHits(const bool cachesPrimaryHits)
+{
+    if (cachesPrimaryHits == this->cachesPrimaryHits())
+        return;
+    if (!cachesPrimaryHits) {
+        primaryHits_ = QVector<PrimaryHit>();
+        return;
+    }
+    const int size = resolution_ * gridSize();
+    primaryHits_.fill(PrimaryHit(), size * size);
+}
+
+int PreviewRenderer::dirtyTileCount() const
+{
+    return static_cast<int>(std::count(isDirty_.begin(), isDirty_.end(), true));
+}
+
+RenderStats PreviewRenderer::update()
+{
+    QVector<Tile> dirtyTiles;
+    QVector<Tile> antialiasedTiles;
+    for (int index = 0; index < tiles_.size(); ++index) {
+        const Tile &tile = tiles_.at(index);
+        if (isDirty_.at(index))
+            dirtyTiles.append(tile);
+        // pixels on the edges of dirty tiles are compared to the ones next to them
+        const int row = index / tilesPerRow_;
+        const int column = index % tilesPerRow_;
+        bool isNearDirty = false;
+        for (int neighbourRow = std::max(0, row - 1); neighbourRow <= std::min(tilesPerRow_ - 1, row + 1); ++neighbourRow)
+            for (int neighbourColumn = std::max(0, column - 1); neighbourColumn <= std::min(tilesPerRow_ - 1, column + 1); ++neighbourColumn)
+                isNearDirty = isNearDirty || isDirty_.at(neighbourRow * tilesPerRow_ + neighbourColumn);
+        if (isNearDirty)
+            antialiasedTiles.append(tile);
+    }
+    if (dirtyTiles.isEmpty())
+        return RenderStats();
+    trace_ = batchKernel(kernelFeatures(scene_, traceSettings_, true, cachesPrimaryHits()));
+
+    // footprints and primary hits are written by the worker of their tile only
+    RayFootprint *footprints = footprints_.data();
+    PrimaryHit *primaryHits = cachesPrimaryHits() ? primaryHits_.data() : nullptr;
+    const int gridSize = this->gridSize();
+    const QVector<bool> &isDirty = isDirty_;
+    RenderStats stats = renderTileList(dirtyTiles, threadPool_, scratchArenas_, [&](const Tile &tile, RenderStats &tileStats, Arena &scratch) {
+        RayFootprint &footprint = footprints[tileIndex(tile.x, tile.y)];
+        footprint = RayFootprint();
+        if (primaryHits && isVisibilityDirty_.at(tileIndex(tile.x, tile.y)))
+            for (int y = tile.y * gridSize; y < (tile.y + tile.height) * gridSize; ++y)
+                std::fill_n(primaryHits + y * resolution_ * gridSize + tile.x * gridSize, tile.width * gridSize, PrimaryHit());
+        const auto shader = [&](const Sample *samples, const int count, Color *colors, Arena &batchScratch) {
+            shade(samples, count, colors, batchScratch, &footprint, primaryHits);
+        };
+        SampleBatch<decltype(shader)> batch(traced_, shader, scratch);
+        for (int y = tile.y; y < tile.y + tile.height; ++y)
+            for (int x = tile.x; x < tile.x + tile.width; ++x) {
+                ++tileStats.pixelsTraced;
+                ++tileStats.samplesTraced;
+                traced_.setPixel(x, y, Color());
+                batch.add({float(x), float(y)}, x, y, 1.0f);
+            }
+        batch.flush();
+    });
+    scratchArenas_.reset();
+
+    const auto isDirtyPixel = [&](const int x, const int y) {
+        return x >= 0 && y >= 0 && x < resolution_ && y < resolution_ && isDirty.at(tileIndex(x, y));
+    };
+    stats += renderTileList(antialiasedTiles, threadPool_, scratchArenas_, [&](const Tile &tile, RenderStats &tileStats, Arena &scratch) {
+        RayFootprint &footprint = footprints[tileIndex(tile.x, tile.y)];
+        const auto shader = [&](const Sample *samples, const int count, Color *colors, Arena &batchScratch) {
+            shade(samples, count, colors, batchScratch, &footprint, primaryHits);
+        };
+        SampleBatch<decltype(shader)> batch(image_, shader, scratch);
+        const bool isTileDirty = isDirty.at(tileIndex(tile.x, tile.y));
+        for (int y = tile.y; y < tile.y + tile.height; ++y)
+            for (int x = tile.x; x < tile.x + tile.width; ++x) {
+                if (!isTileDirty && !isDirtyPixel(x - 1, y) && !isDirtyPixel(x + 1, y) && !isDirtyPixel(x, y - 1) && !isDirtyPixel(x, y + 1))
+                    continue;
+                if (gridSize < 2 || contrast(traced_, x, y) <= antialiasing_.contrastThreshold) {
+                    image_.setPixel(x, y, traced_.pixel(x, y));
+                    continue;
+                }
+                tileStats.samplesTraced += supersample(batch, image_, x, y, traced_.pixel(x, y), antialiasing_);
+                ++tileStats.pixelsSupersampled;
+            }
+        batch.flush();
+        footprint.compact();
+    });
+    scratchArenas_.reset();
+
+    isDirty_.fill(false);
+    isVisibilityDirty_.fill(false);
+    return stats;
+}
+
+void PreviewRenderer::shade(
+        const Sample *samples,
+        const int count,
+        Color *colors,
+        Arena &scratch,
+        RayFootprint *footprint,
+        PrimaryHit *primaryHits) const
+{
+    const ArenaScope scope(scratch);
+    Ray *rays = scratch.allocateArray<Ray>(count);
+    camera_.generateRays(samples, count, resolution_, rays);
+    if (!primaryHits) {
+        trace_(scene_, traceSettings_, rays, count, colors, scratch, footprint, nullptr);
+        return;
+    }
+    // gathered in ray order and stored back with the ones traced
+    PrimaryHit *hits = scratch.allocateArray<PrimaryHit>(count);
+    for (int index = 0; index < count; ++index)
+        hits[index] = primaryHits[primaryHitIndex(samples[index])];
+    trace_(scene_, traceSettings_, rays, count, colors, scratch, footprint, hits);
+    for (int index = 0; index < count; ++index)
+        primaryHits[primaryHitIndex(samples[index])] = hits[index];
+}
+
+void PreviewRenderer::markTiles(const std::function<bool(const RayFootprint &)> &isAffected, const bool movesShapes)
+{
+    for (int index = 0; index < tiles_.size(); ++index) {
+        // a dirty tile may still keep its primary hits
+        if (isDirty_.at(index) && (!movesShapes || isVisibilityDirty_.at(index)))
+            continue;
+        if (!isAffected(footprints_.at(index)))
+            continue;
+        isDirty_[index] = true;
+        if (movesShapes)
+            isVisibilityDirty_[index] = true;
+    }
+}
+
+int PreviewRenderer::gridSize() const
+{
+    return std::max(1, static_cast<int>(std::sqrt(antialiasing_.samplesPerPixel)));
+}
+
+int PreviewRenderer::primaryHitIndex(const Sample &sample) const
+{
+    // samples are on the antialiasing grid of their pixel
+    const int gridSize = this->gridSize();
+    const int x = static_cast<int>(std::lround(sample.x * gridSize));
+    const int y = static_cast<int>(std::lround(sample.y * gridSize));
+    return y * resolution_ * gridSize + x;
+}
@@ -0,0 +1,95 @@
+#ifndef PREVIEW_H
+#define PREVIEW_H
+
+#include <functional>
+
+#include <QThreadPool>
+#include <QVector>
+#include <QVector3D>
+
+#include "arena.h"
+#include "camera.h"
+#include "flatscene.h"
+#include "framebuffer.h"
+#include "tilerenderer.h"
+#include "tracer.h"
+
+// long lived renderer of a scene being edited: it keeps the compiled scene with its bvh,
+// the frame and what the rays of every tile depended on, so after edits update() traces
+// and antialiases again only the tiles whose rays an edit could change; it can keep the
+// primary hit of every sample as well, so tiles that only material and light edits changed
+// are shaded again without tracing their primary rays
+class PreviewRenderer
+{
+public:
+    // pixels are supersampled on the grid whatever the pattern of antialiasing
+    PreviewRenderer(
+            const FlatScene &scene,
+            const Camera &camera,
+            const TraceSettings &traceSettings,
+            const Antialiasing &antialiasing,
+            int resolution,
+            int tileSize,
+            int threadCount);
+
+    const FlatScene &scene() const { return scene_; }
+    // antialiased frame as of the last update()
+    const Framebuffer &framebuffer() const { return image_; }
+
+    // spheres and lights are indexed in the order of the description the scene was compiled from
+    int sphereCount() const { return flatSpheres_.size(); }
+    QVector3D sphereCenter(int sphere) const { return scene_.spheres().center(flatSpheres_.at(sphere)); }
+    int lightCount() const { return scene_.bulbs().size(); }
+    void moveSphere(int sphere, const QVector3D &center);
+    void setSphereMaterial(int sphere, const Color &color, float mirror);
+    void moveLight(int light, const QVector3D &center);
+    void setLightColor(int light, const Color &color);
+    // the next update() renders everything
+    void invalidate();
+
+    // off by default; the cache holds a PrimaryHit per sample of the antialiasing grid of every pixel,
+    // moving spheres forgets the ones of the tiles they may have changed
+    bool cachesPrimaryHits() const { return !primaryHits_.isEmpty(); }
+    void setCachesPrimaryHits(bool cachesPrimaryHits);
+    qint64 primaryHitCacheBytes() const { return qint64(primaryHits_.size()) * sizeof(PrimaryHit); }
+
+    int dirtyTileCount() const;
+    // renders the tiles edits may have changed since the last call, all of them the first time
+    RenderStats update();
+
+private:
+    // primaryHits is the cache or nullptr
+    void shade(const Sample *samples, int count, Color *colors, Arena &scratch, RayFootprint *footprint, PrimaryHit *primaryHits) const;
+    // movesShapes also forgets the primary hits of the tiles marked
+    void markTiles(const std::function<bool(const RayFootprint &footprint)> &isAffected, bool movesShapes = false);
+    int tileIndex(int x, int y) const { return y / tileSize_ * tilesPerRow_ + x / tileSize_; }
+    int gridSize() const;
+    int primaryHitIndex(const Sample &sample) const;
+
+    FlatScene scene_;
+    Camera camera_;
+    TraceSettings traceSettings_;
+    Antialiasing antialiasing_;
+    int resolution_ = 0;
+    int tileSize_ = 0;
+    int tilesPerRow_ = 0;
+    // flat scene index of every sphere of the description
+    QVector<int> flatSpheres_;
+
+    QThreadPool threadPool_;
+    ScratchArenas scratchArenas_;
+    // one sample per pixel, the one antialiasing compares
+    Framebuffer traced_;
+    Framebuffer image_;
+    QVector<Tile> tiles_;
+    QVector<RayFootprint> footprints_;
+    QVector<bool> isDirty_;
+    // tiles whose cached primary hits update() forgets
+    QVector<bool> isVisibilityDirty_;
+    // by primaryHitIndex(), empty if not caching
+    QVector<PrimaryHit> primaryHits_;
+    // picked by update(), edits may change what the scene uses
+    BatchKernel trace_ = nullptr;
+};
+
+#endif // PREVIEW_H
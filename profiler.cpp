@@ -0,0 +1,140 @@
+#include "profiler.h"
+
+#include <algorithm>
+#include <memory>
+
+#include <QElapsedTimer>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QVector>
+
+namespace {
+
+struct Event
+{
+    const char *name;
+    qint64 start;
+    qint64 duration;
+    profiling::EventArgument arguments[2];
+    int argumentCount;
+};
+
+// what a thread measured, kept after it ends to be reported
+struct ThreadRecord
+{
+    int id = 0;
+    StageTimes times;
+    QVector<Event> events;
+};
+
+QMutex recordsMutex;
+QVector<std::shared_ptr<ThreadRecord>> records;
+
+ThreadRecord &threadRecord()
+{
+    thread_local ThreadRecord *record = [] {
+        QMutexLocker locker(&recordsMutex);
+        records.append(std::make_shared<ThreadRecord>());
+        records.last()->id = records.size();
+        // a frame of tiles shouldn't grow it
+        records.last()->events.reserve(4096);
+        return records.last().get();
+    }();
+    return *record;
+}
+
+const QElapsedTimer &processTimer()
+{
+    static const QElapsedTimer timer = [] {
+        QElapsedTimer res;
+        res.start();
+        return res;
+    }();
+    return timer;
+}
+
+}
+
+StageTimes &StageTimes::operator+=(const StageTimes &other)
+{
+    for (int stage = 0; stage < int(Stage::Count); ++stage)
+        nanoseconds[stage] += other.nanoseconds[stage];
+    return *this;
+}
+
+StageTimes StageTimes::operator-(const StageTimes &other) const
+{
+    StageTimes res;
+    for (int stage = 0; stage < int(Stage::Count); ++stage)
+        res.nanoseconds[stage] = nanoseconds[stage] - other.nanoseconds[stage];
+    return res;
+}
+
+qint64 profiling::now()
+{
+    return processTimer().nsecsElapsed();
+}
+
+StageTimes profiling::threadStageTimes()
+{
+    if (!isEnabled)
+        return StageTimes();
+    return threadRecord().times;
+}
+
+StageTimes profiling::totalStageTimes()
+{
+    QMutexLocker locker(&recordsMutex);
+    StageTimes res;
+    for (const auto &record : records)
+        res += record->times;
+    return res;
+}
+
+void profiling::addEvent(const char *name, const qint64 start, const qint64 end, const EventArgument *arguments, const int argumentCount)
+{
+    Event event{name, start, end - start, {}, std::min(argumentCount, 2)};
+    std::copy_n(arguments, event.argumentCount, event.arguments);
+    threadRecord().events.append(event);
+}
+
+void profiling::addStageTime(const Stage stage, const qint64 nanoseconds)
+{
+    threadRecord().times[stage] += nanoseconds;
+}
+
+bool profiling::saveTrace(const QString &fileName, QString *error)
+{
+    QJsonArray events;
+    {
+        QMutexLocker locker(&recordsMutex);
+        for (const auto &record : records)
+            for (const Event &event : record->events) {
+                QJsonObject arguments;
+                for (int index = 0; index < event.argumentCount; ++index)
+                    arguments.insert(event.arguments[index].name, event.arguments[index].value);
+                // complete events, times in microseconds
+                events.append(QJsonObject{
+                    {"name", event.name},
+                    {"ph", "X"},
+                    {"pid", 1},
+                    {"tid", record->id},
+                    {"ts", event.start / 1e3},
+                    {"dur", event.duration / 1e3},
+                    {"args", arguments},
+                });
+            }
+    }
+    const QByteArray json = QJsonDocument(QJsonObject{{"traceEvents", events}}).toJson(QJsonDocument::Compact);
+    QFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly) || file.write(json) != json.size()) {
+        if (error)
+            *error = "can't write " + fileName;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,118 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <initializer_list>
+
+#include <QString>
+#include <QtGlobal>
+
+// time measurements of the hot path, made only in builds with CONFIG += profiling;
+// otherwise StageTimer and ProfileEvent are empty, so they compile to nothing,
+// and every time reads as zero
+
+enum class Stage
+{
+    // closest hits of primary and reflected rays
+    ClosestHits,
+    // lights of the hits with their shadow rays
+    Shading,
+    // whole tiles, the stages above included
+    Tiles,
+    // encoding and writing images, on the threads doing it
+    ImageOutput,
+    Count,
+};
+
+struct StageTimes
+{
+    qint64 nanoseconds[int(Stage::Count)] = {};
+
+    qint64 operator[](const Stage stage) const { return nanoseconds[int(stage)]; }
+    qint64 &operator[](const Stage stage) { return nanoseconds[int(stage)]; }
+    StageTimes &operator+=(const StageTimes &other);
+    StageTimes operator-(const StageTimes &other) const;
+};
+
+namespace profiling {
+
+#ifdef YART_PROFILING
+constexpr bool isEnabled = true;
+#else
+constexpr bool isEnabled = false;
+#endif
+
+// monotonic nanoseconds
+qint64 now();
+// stage times of the calling thread so far
+StageTimes threadStageTimes();
+// summed over every thread that has measured anything, read when none of them measures
+StageTimes totalStageTimes();
+
+struct EventArgument
+{
+    const char *name;
+    qint64 value;
+};
+// at most two arguments are kept, names must be string literals
+void addEvent(const char *name, qint64 start, qint64 end, const EventArgument *arguments = nullptr, int argumentCount = 0);
+void addStageTime(Stage stage, qint64 nanoseconds);
+
+// writes the events every thread recorded so far as chrome trace event json,
+// that chrome://tracing and Perfetto open; call it when no thread records
+bool saveTrace(const QString &fileName, QString *error = nullptr);
+
+}
+
+// adds the time of its scope to a stage of the calling thread,
+// switchTo() ends the time of the stage and starts that of another one
+class StageTimer
+{
+public:
+#ifdef YART_PROFILING
+    explicit StageTimer(const Stage stage) : stage_(stage), start_(profiling::now()) {}
+    ~StageTimer() { profiling::addStageTime(stage_, profiling::now() - start_); }
+    void switchTo(const Stage stage)
+    {
+        const qint64 end = profiling::now();
+        profiling::addStageTime(stage_, end - start_);
+        stage_ = stage;
+        start_ = end;
+    }
+
+private:
+    Stage stage_;
+    qint64 start_;
+#else
+    explicit StageTimer(Stage) {}
+    void switchTo(Stage) {}
+#endif
+};
+
+// records its scope as a trace event of the calling thread
+class ProfileEvent
+{
+public:
+#ifdef YART_PROFILING
+    explicit ProfileEvent(const char *name, const std::initializer_list<profiling::EventArgument> arguments = {})
+        : name_(name), start_(profiling::now())
+    {
+        for (const profiling::EventArgument &argument : arguments)
+            if (argumentCount_ < 2)
+                arguments_[argumentCount_++] = argument;
+    }
+    ~ProfileEvent()
+    {
+        profiling::addEvent(name_, start_, profiling::now(), arguments_, argumentCount_);
+    }
+
+private:
+    const char *name_;
+    qint64 start_;
+    profiling::EventArgument arguments_[2] = {};
+    int argumentCount_ = 0;
+#else
+    explicit ProfileEvent(const char *, std::initializer_list<profiling::EventArgument> = {}) {}
+#endif
+};
+
+#endif // PROFILER_H
@@ -0,0 +1,73 @@
+# renderer sources shared by raytracer.pro, benchmark.pro and the yart.pro library
+CONFIG += c++17
+# coordinator and workers of distributed renders talk over tcp
+QT += network
+INCLUDEPATH += $$PWD
+SOURCES += \
+        $$PWD/allocations.cpp \
+        $$PWD/animation.cpp \
+        $$PWD/arena.cpp \
+        $$PWD/bvh.cpp \
+        $$PWD/denoiser.cpp \
+        $$PWD/distributed.cpp \
+        $$PWD/flatscene.cpp \
+        $$PWD/framebuffer.cpp \
+        $$PWD/gpurenderer.cpp \
+        $$PWD/imagesaver.cpp \
+        $$PWD/imagestream.cpp \
+        $$PWD/preview.cpp \
+        $$PWD/profiler.cpp \
+        $$PWD/renderer.cpp \
+        $$PWD/scene.cpp \
+        $$PWD/scenes.cpp \
+        $$PWD/spheres.cpp \
+        $$PWD/tracer.cpp \
+        $$PWD/triangles.cpp
+HEADERS += \
+        $$PWD/aabb.h \
+        $$PWD/allocations.h \
+        $$PWD/animation.h \
+        $$PWD/arena.h \
+        $$PWD/bvh.h \
+        $$PWD/camera.h \
+        $$PWD/denoiser.h \
+        $$PWD/distributed.h \
+        $$PWD/flatarray.h \
+        $$PWD/flatscene.h \
+        $$PWD/framebuffer.h \
+        $$PWD/gpurenderer.h \
+        $$PWD/imagesaver.h \
+        $$PWD/imagestream.h \
+        $$PWD/preview.h \
+        $$PWD/profiler.h \
+        $$PWD/renderer.h \
+        $$PWD/sampler.h \
+        $$PWD/scene.h \
+        $$PWD/scenes.h \
+        $$PWD/simd.h \
+        $$PWD/spheres.h \
+        $$PWD/tilerenderer.h \
+        $$PWD/tracer.h \
+        $$PWD/triangles.h
+
+# counts global operator new calls to check the render loop doesn't allocate
+count_allocations: DEFINES += YART_COUNT_ALLOCATIONS
+# times stages and tiles of the render loop and records trace events, see profiler.h
+profiling: DEFINES += YART_PROFILING
+# counts the rays the kernels cast, see RayStats; profiling builds count them too
+ray_stats: DEFINES += YART_RAY_STATS
+# traces frames with an opengl compute shader when asked to, see gpurenderer.h
+gpu {
+    DEFINES += YART_GPU
+    QT += gui
+}
+
+# instruction set of the packet kernels, see simd.h; the compiler default is used when none is set
+simd_avx {
+    DEFINES += YART_SIMD_AVX
+    msvc: QMAKE_CXXFLAGS += /arch:AVX
+    else: QMAKE_CXXFLAGS += -mavx
+}
+simd_sse: DEFINES += YART_SIMD_SSE
+simd_neon: DEFINES += YART_SIMD_NEON
+simd_scalar: DEFINES += YART_SIMD_SCALAR
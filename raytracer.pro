@@ -3,3 +3,5 @@ CONFIG -= console
 CONFIG += c++17
 SOURCES += \
         main.cpp
+
+include(raytracer.pri)
@@ -0,0 +1,261 @@
+#include "renderer.h"
+
+#include <algorithm>
+#include <limits>
+
+#include <QMutexLocker>
+
+#include "denoiser.h"
+#include "profiler.h"
+
+namespace {
+
+// latencies the percentiles are of
+constexpr int latencyWindow = 256;
+
+// nanoseconds of a timeout, clamped to decades so that adding them to now() can't overflow
+qint64 timeoutNanoseconds(const qint64 timeoutMs)
+{
+    constexpr qint64 maxTimeoutMs = std::numeric_limits<qint64>::max() / 4 / 1000000;
+    return std::min(timeoutMs, maxTimeoutMs) * 1000000;
+}
+
+}
+
+bool RenderTicket::isFinished() const
+{
+    QMutexLocker locker(&mutex_);
+    return isFinished_;
+}
+
+bool RenderTicket::wait(const qint64 timeoutMs)
+{
+    const qint64 deadline = profiling::now() + timeoutNanoseconds(timeoutMs);
+    QMutexLocker locker(&mutex_);
+    while (!isFinished_) {
+        if (timeoutMs < 0) {
+            finished_.wait(&mutex_);
+            continue;
+        }
+        const qint64 left = deadline - profiling::now();
+        if (left <= 0)
+            return false;
+        // a long wait is split, unsigned long may be 32 bits
+        finished_.wait(&mutex_, static_cast<unsigned long>(std::min<qint64>((left + 999999) / 1000000, std::numeric_limits<int>::max())));
+    }
+    return true;
+}
+
+void RenderTicket::finish(RenderResult result)
+{
+    QMutexLocker locker(&mutex_);
+    result_ = std::move(result);
+    isFinished_ = true;
+    finished_.wakeAll();
+}
+
+Renderer::Renderer(const int threadCount, const int tileSize)
+    : tileSize_(std::max(1, tileSize)),
+      scratchArenas_(std::max(1, threadCount))
+{
+    threadPool_.setMaxThreadCount(std::max(1, threadCount));
+    dispatcher_.setMaxThreadCount(1);
+}
+
+Renderer::~Renderer()
+{
+    QVector<std::shared_ptr<RenderTicket>> dropped;
+    {
+        QMutexLocker locker(&mutex_);
+        dropped.swap(queue_);
+        metrics_.cancelled += dropped.size();
+        metrics_.queueDepth = 0;
+    }
+    for (const auto &ticket : dropped) {
+        RenderResult result;
+        result.status = RenderResult::Cancelled;
+        result.queuedNanoseconds = profiling::now() - ticket->submitted_;
+        ticket->finish(std::move(result));
+    }
+    dispatcher_.waitForDone();
+}
+
+int Renderer::addScene(const SceneDescription &description, const int bvhLeafSize)
+{
+    return addScene(FlatScene::compile(description.shapes, description.lights, bvhLeafSize));
+}
+
+int Renderer::addScene(FlatScene scene)
+{
+    const auto compiled = std::make_shared<const FlatScene>(std::move(scene));
+    QMutexLocker locker(&mutex_);
+    scenes_.insert(nextScene_, compiled);
+    return nextScene_++;
+}
+
+void Renderer::removeScene(const int scene)
+{
+    QMutexLocker locker(&mutex_);
+    scenes_.remove(scene);
+}
+
+std::shared_ptr<RenderTicket> Renderer::submit(const RenderRequest &request)
+{
+    const auto ticket = std::make_shared<RenderTicket>();
+    ticket->request_ = request;
+    ticket->submitted_ = profiling::now();
+    QMutexLocker locker(&mutex_);
+    queue_.append(ticket);
+    ++metrics_.submitted;
+    metrics_.queueDepth = queue_.size();
+    metrics_.maxQueueDepth = std::max(metrics_.maxQueueDepth, metrics_.queueDepth);
+    if (!isRendering_) {
+        isRendering_ = true;
+        dispatcher_.start([this] { renderAll(); });
+    }
+    return ticket;
+}
+
+RenderResult Renderer::render(const RenderRequest &request)
+{
+    const std::shared_ptr<RenderTicket> ticket = submit(request);
+    ticket->wait();
+    // the dispatcher is done with it once it's finished
+    return std::move(ticket->result_);
+}
+
+Renderer::Metrics Renderer::metrics() const
+{
+    QMutexLocker locker(&mutex_);
+    Metrics res = metrics_;
+    if (!latencies_.isEmpty()) {
+        QVector<double> latencies = latencies_;
+        std::sort(latencies.begin(), latencies.end());
+        res.medianLatencyMs = latencies.at(latencies.size() / 2);
+        res.p95LatencyMs = latencies.at(std::min<int>(latencies.size() - 1, latencies.size() * 95 / 100));
+    }
+    return res;
+}
+
+void Renderer::renderAll()
+{
+    for (;;) {
+        std::shared_ptr<RenderTicket> ticket;
+        std::shared_ptr<const FlatScene> scene;
+        {
+            QMutexLocker locker(&mutex_);
+            if (queue_.isEmpty()) {
+                isRendering_ = false;
+                return;
+            }
+            ticket = queue_.takeFirst();
+            metrics_.queueDepth = queue_.size();
+            scene = scenes_.value(ticket->request_.scene);
+        }
+        const qint64 started = profiling::now();
+        RenderResult result = renderOne(*ticket, scene);
+        result.queuedNanoseconds = started - ticket->submitted_;
+        result.renderNanoseconds = profiling::now() - started;
+        {
+            QMutexLocker locker(&mutex_);
+            switch (result.status) {
+            case RenderResult::Done:
+                ++metrics_.done;
+                recordLatency((result.queuedNanoseconds + result.renderNanoseconds) / 1e6);
+                break;
+            case RenderResult::Cancelled:
+                ++metrics_.cancelled;
+                break;
+            case RenderResult::TimedOut:
+                ++metrics_.timedOut;
+                break;
+            case RenderResult::Failed:
+                ++metrics_.failed;
+                break;
+            }
+        }
+        ticket->finish(std::move(result));
+    }
+}
+
+RenderResult Renderer::renderOne(const RenderTicket &ticket, const std::shared_ptr<const FlatScene> &scenePointer)
+{
+    const RenderRequest &request = ticket.request_;
+    RenderResult result;
+    if (!scenePointer) {
+        result.error = "no scene " + QString::number(request.scene);
+        return result;
+    }
+    if (request.resolution <= 0) {
+        result.error = "wrong resolution " + QString::number(request.resolution);
+        return result;
+    }
+    const qint64 deadline = request.timeoutMs < 0
+            ? std::numeric_limits<qint64>::max()
+            : ticket.submitted_ + timeoutNanoseconds(request.timeoutMs);
+    const auto status = [&] {
+        if (ticket.isCancelled())
+            return RenderResult::Cancelled;
+        return profiling::now() > deadline ? RenderResult::TimedOut : RenderResult::Done;
+    };
+    result.status = status();
+    if (result.status != RenderResult::Done)
+        return result;
+
+    const ProfileEvent event("request", {{"resolution", request.resolution}});
+    const FlatScene &scene = *scenePointer;
+    const int resolution = request.resolution;
+    const BatchKernel trace = batchKernel(kernelFeatures(scene, request.traceSettings));
+    // set by the first batch finding the request given up, the ones after it skip tracing
+    QAtomicInt isStopped = 0;
+    const auto shader = [&](const Sample *samples, const int count, Color *colors, Arena &scratch) {
+        if (isStopped.loadRelaxed() || status() != RenderResult::Done) {
+            isStopped.storeRelaxed(1);
+            std::fill_n(colors, count, Color());
+            return;
+        }
+        const ArenaScope scope(scratch);
+        Ray *rays = scratch.allocateArray<Ray>(count);
+        request.camera.generateRays(samples, count, resolution, rays);
+        trace(scene, request.traceSettings, rays, count, colors, scratch, nullptr, nullptr);
+    };
+    Framebuffer framebuffer(resolution, resolution);
+    // the tile renderer's, not the member
+    result.stats = ::render(framebuffer, threadPool_, tileSize_, scratchArenas_, shader);
+    scratchArenas_.reset();
+    if (!isStopped.loadRelaxed()) {
+        result.stats += antialias(framebuffer, threadPool_, tileSize_, scratchArenas_, shader, request.antialiasing);
+        scratchArenas_.reset();
+    }
+    if (!isStopped.loadRelaxed() && request.denoises) {
+        if (status() != RenderResult::Done) {
+            isStopped.storeRelaxed(1);
+        } else {
+            const DenoiseGuides guides = traceDenoiseGuides(scene, request.camera, resolution, threadPool_, tileSize_, scratchArenas_);
+            denoise(framebuffer, guides, DenoiseSettings(), threadPool_, tileSize_, scratchArenas_);
+        }
+    }
+    // a frame that got done in time is kept even if the deadline passes now
+    if (isStopped.loadRelaxed()) {
+        result.status = status();
+        return result;
+    }
+    if (request.quantizes)
+        result.image = framebuffer.toImage().copy();
+    result.framebuffer = std::move(framebuffer);
+    return result;
+}
+
+void Renderer::recordLatency(const double ms)
+{
+    metrics_.lastLatencyMs = ms;
+    metrics_.maxLatencyMs = std::max(metrics_.maxLatencyMs, ms);
+    latencySumMs_ += ms;
+    metrics_.meanLatencyMs = latencySumMs_ / metrics_.done;
+    if (latencies_.size() < latencyWindow) {
+        latencies_.append(ms);
+        return;
+    }
+    latencies_[nextLatency_] = ms;
+    nextLatency_ = (nextLatency_ + 1) % latencyWindow;
+}
@@ -0,0 +1,154 @@
+#ifndef RENDERER_H
+#define RENDERER_H
+
+#include <memory>
+
+#include <QAtomicInt>
+#include <QHash>
+#include <QImage>
+#include <QMutex>
+#include <QString>
+#include <QThread>
+#include <QThreadPool>
+#include <QVector>
+#include <QWaitCondition>
+
+#include "arena.h"
+#include "camera.h"
+#include "flatscene.h"
+#include "framebuffer.h"
+#include "scenes.h"
+#include "simd.h"
+#include "tilerenderer.h"
+#include "tracer.h"
+
+struct RenderRequest
+{
+    // as returned by Renderer::addScene()
+    int scene = -1;
+    Camera camera;
+    int resolution = 512;
+    TraceSettings traceSettings;
+    Antialiasing antialiasing;
+    bool denoises = false;
+    // the result gets 8 bit rgb pixels besides the float ones
+    bool quantizes = false;
+    // from when the request is submitted; once it passes the request is given up,
+    // tracing stops at the next batch of samples; negative for none
+    qint64 timeoutMs = -1;
+};
+
+struct RenderResult
+{
+    enum Status
+    {
+        Done,
+        Cancelled,
+        TimedOut,
+        // the scene isn't there or the request is wrong, see error
+        Failed,
+    };
+
+    Status status = Failed;
+    QString error;
+    // square frame of the request resolution, empty unless done
+    Framebuffer framebuffer;
+    // owns its pixels, null unless the request quantizes
+    QImage image;
+    RenderStats stats;
+    // from submitting to starting, and from starting to finishing
+    qint64 queuedNanoseconds = 0;
+    qint64 renderNanoseconds = 0;
+};
+
+// a submitted request, it can be waited for and cancelled from any thread
+class RenderTicket
+{
+public:
+    // a request not started yet is dropped, one being rendered stops at its next batch of samples
+    void cancel() { isCancelled_.storeRelaxed(1); }
+    bool isCancelled() const { return isCancelled_.loadRelaxed() != 0; }
+    bool isFinished() const;
+    // until finished or timeoutMs pass, negative waits for ever; returns whether it finished
+    bool wait(qint64 timeoutMs = -1);
+    // valid once finished, it doesn't change after that
+    const RenderResult &result() const { return result_; }
+
+private:
+    friend class Renderer;
+
+    void finish(RenderResult result);
+
+    RenderRequest request_;
+    qint64 submitted_ = 0;
+    QAtomicInt isCancelled_ = 0;
+    mutable QMutex mutex_;
+    QWaitCondition finished_;
+    bool isFinished_ = false;
+    RenderResult result_;
+};
+
+// renders frames of kept scenes for callers on any thread: scenes are compiled once, bvhs and all,
+// and shared by the requests naming them; requests are rendered one at a time in the order they
+// are submitted, every one of them on all threads of a single pool, as renderProgressive() renders
+// its last level
+class Renderer
+{
+public:
+    struct Metrics
+    {
+        qint64 submitted = 0;
+        qint64 done = 0;
+        qint64 cancelled = 0;
+        qint64 timedOut = 0;
+        qint64 failed = 0;
+        // requests waiting, not counting the one being rendered
+        int queueDepth = 0;
+        int maxQueueDepth = 0;
+        // from submitting to finishing, of the requests done; percentiles are of the last ones
+        double lastLatencyMs = 0.0;
+        double meanLatencyMs = 0.0;
+        double maxLatencyMs = 0.0;
+        double medianLatencyMs = 0.0;
+        double p95LatencyMs = 0.0;
+    };
+
+    explicit Renderer(int threadCount = QThread::idealThreadCount(), int tileSize = 32);
+    // drops the requests waiting and waits for the one being rendered
+    ~Renderer();
+
+    // returns the handle of the scene compiled from description
+    int addScene(const SceneDescription &description, int bvhLeafSize = simd::width);
+    int addScene(FlatScene scene);
+    // requests already submitted for the scene still render it
+    void removeScene(int scene);
+
+    std::shared_ptr<RenderTicket> submit(const RenderRequest &request);
+    // submits request and waits for it
+    RenderResult render(const RenderRequest &request);
+
+    Metrics metrics() const;
+
+private:
+    void renderAll();
+    RenderResult renderOne(const RenderTicket &ticket, const std::shared_ptr<const FlatScene> &scene);
+    void recordLatency(double ms);
+
+    const int tileSize_;
+    QThreadPool threadPool_;
+    ScratchArenas scratchArenas_;
+    mutable QMutex mutex_;
+    QHash<int, std::shared_ptr<const FlatScene>> scenes_;
+    int nextScene_ = 0;
+    QVector<std::shared_ptr<RenderTicket>> queue_;
+    bool isRendering_ = false;
+    Metrics metrics_;
+    double latencySumMs_ = 0.0;
+    // ring of the latest latencies
+    QVector<double> latencies_;
+    int nextLatency_ = 0;
+    // runs renderAll() while there are requests
+    QThreadPool dispatcher_;
+};
+
+#endif // RENDERER_H
@@ -0,0 +1,118 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include <QtGlobal>
+
+#include "camera.h"
+
+// positions of samples in a pixel that depend only on the pixel, which of its samples they are
+// and a seed, so every worker takes them without locking or state and a frame renders the same
+// on every run; sobol points are owen scrambled by a hash of the pixel, as in burley's practical
+// hash-based owen scrambling, which keeps any power of two of them stratified over the pixel
+namespace sampling {
+
+enum Pattern : quint8
+{
+    // a square grid of samples, the first one at the corner of the pixel
+    Grid,
+    // independent uniform samples, what the others are measured against
+    Random,
+    Sobol,
+};
+
+// lowbias32 by chris wellons
+inline quint32 hash(quint32 value)
+{
+    value ^= value >> 16;
+    value *= 0x7feb352du;
+    value ^= value >> 15;
+    value *= 0x846ca68bu;
+    value ^= value >> 16;
+    return value;
+}
+
+inline quint32 hashCombine(const quint32 seed, const quint32 value)
+{
+    return hash(seed ^ (value + 0x9e3779b9u + (seed << 6) + (seed >> 2)));
+}
+
+// seed of the samples of pixel x, y in a frame of seed
+inline quint32 pixelSeed(const int x, const int y, const quint32 seed)
+{
+    return hashCombine(hashCombine(hash(seed), quint32(x)), quint32(y));
+}
+
+// seed of another pair of dimensions of the same samples, e.g. positions on a light,
+// decorrelated from the pixel positions by a scramble of its own
+inline quint32 dimensionSeed(const quint32 pixelSeed, const int dimension)
+{
+    return hashCombine(pixelSeed, quint32(dimension));
+}
+
+inline quint32 reverseBits(quint32 value)
+{
+    value = ((value >> 1) & 0x55555555u) | ((value & 0x55555555u) << 1);
+    value = ((value >> 2) & 0x33333333u) | ((value & 0x33333333u) << 2);
+    value = ((value >> 4) & 0x0f0f0f0fu) | ((value & 0x0f0f0f0fu) << 4);
+    value = ((value >> 8) & 0x00ff00ffu) | ((value & 0x00ff00ffu) << 8);
+    return (value >> 16) | (value << 16);
+}
+
+// random permutation of every level of binary digits below the ones above it
+inline quint32 nestedUniformScramble(quint32 value, const quint32 seed)
+{
+    value = reverseBits(value);
+    value += seed;
+    value ^= value * 0x6c50b47cu;
+    value ^= value * 0xb82f1e52u;
+    value ^= value * 0xc7afe638u;
+    value ^= value * 0x8d22f6e6u;
+    return reverseBits(value);
+}
+
+// the top 24 bits in [0, 1)
+inline float toUnit(const quint32 bits)
+{
+    return (bits >> 8) * (1.0f / 16777216.0f);
+}
+
+// index-th point of the first two sobol dimensions, as fixed point fractions
+inline void sobol(const quint32 index, quint32 &x, quint32 &y)
+{
+    x = reverseBits(index);
+    y = 0;
+    quint32 direction = 0x80000000u;
+    for (quint32 bits = index; bits; bits >>= 1) {
+        if (bits & 1)
+            y ^= direction;
+        direction ^= direction >> 1;
+    }
+}
+
+// offset in [0, 1) from the corner of a pixel of its index-th sample out of count,
+// seed from pixelSeed(); the grid rounds count down to a square
+inline Sample offset(const Pattern pattern, const quint32 seed, const int index, const int count)
+{
+    switch (pattern) {
+    case Grid: {
+        int gridSize = 1;
+        while ((gridSize + 1) * (gridSize + 1) <= count)
+            ++gridSize;
+        return {(index % gridSize) / float(gridSize), (index / gridSize) / float(gridSize)};
+    }
+    case Random:
+        return {toUnit(hashCombine(seed, 2 * quint32(index))), toUnit(hashCombine(seed, 2 * quint32(index) + 1))};
+    case Sobol:
+        break;
+    }
+    // the index is shuffled too, so pixels don't take the same strata in the same order
+    quint32 x = 0;
+    quint32 y = 0;
+    sobol(nestedUniformScramble(quint32(index), seed), x, y);
+    const quint32 scramble = hash(seed);
+    return {toUnit(nestedUniformScramble(x, hashCombine(scramble, 0))), toUnit(nestedUniformScramble(y, hashCombine(scramble, 1)))};
+}
+
+}
+
+#endif // SAMPLER_H
@@ -0,0 +1,181 @@
+#include "scene.h"
+
+#include <cmath>
+
+#include "flatscene.h"
+#include "triangles.h"
+
+namespace {
+
+// outputs of Shape::intersects() for a flat surface hit at distance, its normal turned to face the ray
+bool flatHit(
+        const QVector3D &origin,
+        const QVector3D &direction,
+        const float distance,
+        const QVector3D &normal,
+        QVector3D *intersectionOrigin,
+        QVector3D *normalDirection,
+        QVector3D *reflectionDirection)
+{
+    if (std::isinf(distance))
+        return false;
+    const QVector3D facing = QVector3D::dotProduct(direction, normal) > 0.0f ? -normal : normal;
+    if (intersectionOrigin)
+        *intersectionOrigin = origin + direction * distance;
+    if (normalDirection)
+        *normalDirection = facing;
+    if (reflectionDirection)
+        *reflectionDirection = direction - 2 * facing * QVector3D::dotProduct(direction, facing);
+    return true;
+}
+
+float planeDistance(const QVector3D &point, const QVector3D &normal, const QVector3D &origin, const QVector3D &direction)
+{
+    const float t = QVector3D::dotProduct(point - origin, normal) / QVector3D::dotProduct(direction, normal);
+    return t > 0.0f ? t : std::numeric_limits<float>::infinity();
+}
+
+TriangleArray::Triangle triangleOf(const QVector3D &a, const QVector3D &b, const QVector3D &c)
+{
+    return {a, b - a, c - a};
+}
+
+}
+
+void Bulb::addTo(FlatScene &scene) const
+{
+    scene.addBulb(center, color, radius);
+}
+
+void Sphere::addTo(FlatScene &scene) const
+{
+    scene.addSphere(center_, radius_, scene.addMaterial(color, mirror));
+}
+
+Aabb Plane::bounds() const
+{
+    const QVector3D extent = QVector3D(1, 1, 1) * std::numeric_limits<float>::infinity();
+    return Aabb(-extent, extent);
+}
+
+void Plane::addTo(FlatScene &scene) const
+{
+    scene.addPlane(point_, normal_, scene.addMaterial(color, mirror));
+}
+
+bool Plane::intersects(
+        const QVector3D &origin,
+        const QVector3D &direction,
+        QVector3D *intersectionOrigin,
+        QVector3D *normalDirection,
+        QVector3D *reflectionDirection) const
+{
+    return flatHit(origin, direction, planeDistance(point_, normal_, origin, direction), normal_,
+                   intersectionOrigin, normalDirection, reflectionDirection);
+}
+
+bool Plane::occludes(const QVector3D &origin, const QVector3D &direction, const float maxDistance) const
+{
+    return planeDistance(point_, normal_, origin, direction) <= maxDistance;
+}
+
+Aabb Triangle::bounds() const
+{
+    Aabb res;
+    for (const QVector3D &corner : corners_)
+        res.extend(corner);
+    return res;
+}
+
+void Triangle::addTo(FlatScene &scene) const
+{
+    scene.addTriangle(corners_[0], corners_[1], corners_[2], scene.addMaterial(color, mirror));
+}
+
+bool Triangle::intersects(
+        const QVector3D &origin,
+        const QVector3D &direction,
+        QVector3D *intersectionOrigin,
+        QVector3D *normalDirection,
+        QVector3D *reflectionDirection) const
+{
+    const TriangleArray::Triangle triangle = triangleOf(corners_[0], corners_[1], corners_[2]);
+    const QVector3D normal = QVector3D::crossProduct(triangle.edge1, triangle.edge2).normalized();
+    return flatHit(origin, direction, TriangleArray::distance(triangle, origin, direction), normal,
+                   intersectionOrigin, normalDirection, reflectionDirection);
+}
+
+bool Triangle::occludes(const QVector3D &origin, const QVector3D &direction, const float maxDistance) const
+{
+    return TriangleArray::distance(triangleOf(corners_[0], corners_[1], corners_[2]), origin, direction) <= maxDistance;
+}
+
+void Transform::rotatedAxes(QVector3D axes[3]) const
+{
+    // rodrigues' formula applied to the unit vectors
+    const QVector3D k = axis.lengthSquared() > 0.0f ? axis.normalized() : QVector3D(0, 0, 1);
+    const float radians = degrees * float(M_PI) / 180.0f;
+    const float cosine = std::cos(radians);
+    const float sine = std::sin(radians);
+    const QVector3D units[3] = {QVector3D(1, 0, 0), QVector3D(0, 1, 0), QVector3D(0, 0, 1)};
+    for (int index = 0; index < 3; ++index) {
+        const QVector3D &v = units[index];
+        axes[index] = v * cosine + QVector3D::crossProduct(k, v) * sine + k * QVector3D::dotProduct(k, v) * (1.0f - cosine);
+    }
+}
+
+QVector3D Transform::apply(const QVector3D &point) const
+{
+    QVector3D axes[3];
+    rotatedAxes(axes);
+    return offset + (axes[0] * point.x() + axes[1] * point.y() + axes[2] * point.z()) * scale;
+}
+
+Aabb MeshInstance::bounds() const
+{
+    Aabb res;
+    for (const QVector3D &vertex : mesh_->vertices)
+        res.extend(transform_.apply(vertex));
+    return res;
+}
+
+void MeshInstance::addTo(FlatScene &scene) const
+{
+    scene.addInstance(mesh_, transform_, scene.addMaterial(color, mirror));
+}
+
+bool MeshInstance::intersects(
+        const QVector3D &origin,
+        const QVector3D &direction,
+        QVector3D *intersectionOrigin,
+        QVector3D *normalDirection,
+        QVector3D *reflectionDirection) const
+{
+    float distance = std::numeric_limits<float>::infinity();
+    QVector3D normal;
+    for (int index = 0; index < mesh_->triangleCount(); ++index) {
+        const TriangleArray::Triangle triangle = triangleOf(
+                    transform_.apply(mesh_->corner(index, 0)),
+                    transform_.apply(mesh_->corner(index, 1)),
+                    transform_.apply(mesh_->corner(index, 2)));
+        const float t = TriangleArray::distance(triangle, origin, direction);
+        if (t >= distance)
+            continue;
+        distance = t;
+        normal = QVector3D::crossProduct(triangle.edge1, triangle.edge2).normalized();
+    }
+    return flatHit(origin, direction, distance, normal, intersectionOrigin, normalDirection, reflectionDirection);
+}
+
+bool MeshInstance::occludes(const QVector3D &origin, const QVector3D &direction, const float maxDistance) const
+{
+    for (int index = 0; index < mesh_->triangleCount(); ++index) {
+        const TriangleArray::Triangle triangle = triangleOf(
+                    transform_.apply(mesh_->corner(index, 0)),
+                    transform_.apply(mesh_->corner(index, 1)),
+                    transform_.apply(mesh_->corner(index, 2)));
+        if (TriangleArray::distance(triangle, origin, direction) <= maxDistance)
+            return true;
+    }
+    return false;
+}
@@ -0,0 +1,273 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <cmath>
+#include <algorithm>
+#include <limits>
+
+#include <memory>
+
+#include <QVector>
+#include <QVector3D>
+
+#include "aabb.h"
+
+class FlatScene;
+
+using Color = QVector3D;
+class Light
+{
+public:
+    virtual ~Light() = default;
+    virtual float power(
+            const QVector3D &origin,
+            const QVector3D &normalDirection) const = 0;
+    // lights and shapes only describe the scene, it is rendered from a FlatScene compiled of them
+    virtual void addTo(FlatScene &scene) const = 0;
+    Color color = Color(1, 1, 1);
+    QVector3D center;
+    // the light fades out towards that distance from center and doesn't reach farther,
+    // so a renderer only needs to consider lights that are near a point
+    float radius = std::numeric_limits<float>::infinity();
+};
+
+class Bulb : public Light
+{
+public:
+    Bulb(const QVector3D &center, const Color &color, const float radius = std::numeric_limits<float>::infinity())
+    {
+        this->center = center;
+        this->color = color;
+        this->radius = radius;
+    }
+    float power(
+                const QVector3D &origin,
+                const QVector3D &normalDirection) const override
+    {
+        return powerAt(center, radius, origin, normalDirection);
+    }
+    void addTo(FlatScene &scene) const override;
+    static float powerAt(
+            const QVector3D &center,
+            const float radius,
+            const QVector3D &origin,
+            const QVector3D &normalDirection)
+    {
+        const QVector3D offset = origin - center;
+        const float distanceSquared = offset.lengthSquared();
+        if (distanceSquared <= 0.0f || distanceSquared >= radius * radius)
+            return 0.0f;
+        return falloff(QVector3D::dotProduct(offset, normalDirection) / std::sqrt(distanceSquared))
+                * attenuation(distanceSquared, radius);
+    }
+    // 1 for the surface facing away from the light, going linearly with the angle
+    // down to 0 for the perpendicular one; acos is approximated by Abramowitz and Stegun 4.4.45,
+    // within 7e-5 radians
+    static float falloff(const float cosine)
+    {
+        if (cosine <= 0.0f)
+            return 0.0f;
+        const float x = std::min(cosine, 1.0f);
+        const float angle = std::sqrt(1.0f - x) * (1.5707288f + x * (-0.2121144f + x * (0.0742610f - 0.0187293f * x)));
+        return std::max(0.0f, 1.0f - angle * float(M_2_PI));
+    }
+    // 1 for lights of infinite radius, otherwise fading smoothly to 0 at radius
+    static float attenuation(const float distanceSquared, const float radius)
+    {
+        if (std::isinf(radius))
+            return 1.0f;
+        const float window = std::max(0.0f, 1.0f - distanceSquared / (radius * radius));
+        return window * window;
+    }
+};
+
+class Shape
+{
+public:
+    virtual ~Shape() = default;
+    virtual bool intersects(
+            const QVector3D &origin,
+            const QVector3D &direction,
+            QVector3D *intersectionOrigin,
+            QVector3D *normalDirection,
+            QVector3D *reflectionDirection) const = 0;
+    // any hit not farther than maxDistance, cheaper than intersects() for shadow rays
+    virtual bool occludes(
+            const QVector3D &origin,
+            const QVector3D &direction,
+            const float maxDistance) const = 0;
+    virtual Aabb bounds() const = 0;
+    virtual void addTo(FlatScene &scene) const = 0;
+    Color color = Color(1, 0, 0);
+    float mirror = 0.0f;
+};
+
+class Sphere : public Shape
+{
+public:
+    Sphere(const QVector3D &center, const float &radius, const Color &color, const float mirror)
+        : center_(center), radius_(radius) { this->color = color; this->mirror = mirror; }
+    QVector3D center() const { return center_; }
+    float radius() const { return radius_; }
+    Aabb bounds() const override
+    {
+        const QVector3D extent(radius_, radius_, radius_);
+        return Aabb(center_ - extent, center_ + extent);
+    }
+    void addTo(FlatScene &scene) const override;
+private:
+    QVector3D center_;
+    float radius_ = 0.0f;
+    bool intersects(
+            const QVector3D &origin,
+            const QVector3D &direction,
+            QVector3D *intersectionOrigin,
+            QVector3D *normalDirection,
+            QVector3D *reflectionDirection) const override
+    {
+        const QVector3D m = origin - center_;
+        const float b = QVector3D::dotProduct(direction, m);
+        const float c = QVector3D::dotProduct(m, m) - radius_ * radius_;
+        if (c > 0.0f && b > 0.0f)
+            return false;
+
+        const float discr = b * b - c;
+        if (discr < 0.0f)
+            return false;
+
+        // distance?    // aka starts inside the sphere
+        const float t = std::max(0.0f, -b - std::sqrt(discr));
+        const QVector3D intersection = origin + direction * t;
+        const QVector3D normal = (intersection - center_).normalized();
+        const QVector3D reflection = direction - 2 * normal * QVector3D::dotProduct(direction, normal);
+        if (intersectionOrigin)
+            *intersectionOrigin = intersection;
+        if (normalDirection)
+            *normalDirection = normal;
+        if (reflectionDirection)
+            *reflectionDirection = reflection;
+        return true;
+    }
+    bool occludes(
+            const QVector3D &origin,
+            const QVector3D &direction,
+            const float maxDistance) const override
+    {
+        const QVector3D m = origin - center_;
+        const float b = QVector3D::dotProduct(direction, m);
+        const float c = QVector3D::dotProduct(m, m) - radius_ * radius_;
+        if (c <= 0.0f)
+            return true;
+        if (b > 0.0f)
+            return false;
+
+        const float discr = b * b - c;
+        if (discr < 0.0f)
+            return false;
+
+        // -b - sqrt(discr) <= maxDistance, without the sqrt
+        const float nearest = -b - maxDistance;
+        return nearest <= 0.0f || discr >= nearest * nearest;
+    }
+};
+
+// infinite plane through point, seen from both sides
+class Plane : public Shape
+{
+public:
+    Plane(const QVector3D &point, const QVector3D &normal, const Color &color, const float mirror)
+        : point_(point), normal_(normal.normalized()) { this->color = color; this->mirror = mirror; }
+    QVector3D point() const { return point_; }
+    QVector3D normal() const { return normal_; }
+    // everything, planes are kept out of bvhs
+    Aabb bounds() const override;
+    void addTo(FlatScene &scene) const override;
+private:
+    QVector3D point_;
+    QVector3D normal_;
+    bool intersects(
+            const QVector3D &origin,
+            const QVector3D &direction,
+            QVector3D *intersectionOrigin,
+            QVector3D *normalDirection,
+            QVector3D *reflectionDirection) const override;
+    bool occludes(
+            const QVector3D &origin,
+            const QVector3D &direction,
+            float maxDistance) const override;
+};
+
+// seen from both sides
+class Triangle : public Shape
+{
+public:
+    Triangle(const QVector3D &a, const QVector3D &b, const QVector3D &c, const Color &color, const float mirror)
+        : corners_{a, b, c} { this->color = color; this->mirror = mirror; }
+    QVector3D corner(const int index) const { return corners_[index]; }
+    Aabb bounds() const override;
+    void addTo(FlatScene &scene) const override;
+private:
+    QVector3D corners_[3];
+    bool intersects(
+            const QVector3D &origin,
+            const QVector3D &direction,
+            QVector3D *intersectionOrigin,
+            QVector3D *normalDirection,
+            QVector3D *reflectionDirection) const override;
+    bool occludes(
+            const QVector3D &origin,
+            const QVector3D &direction,
+            float maxDistance) const override;
+};
+
+// indexed triangle mesh shared by the instances placing it in a scene,
+// a FlatScene stores it once however many instances it has
+struct Mesh
+{
+    QVector<QVector3D> vertices;
+    // three vertex indices per triangle
+    QVector<int> indices;
+
+    int triangleCount() const { return indices.size() / 3; }
+    QVector3D corner(const int triangle, const int corner) const { return vertices.at(indices.at(triangle * 3 + corner)); }
+};
+
+// rotation by degrees around axis, then uniform scale, then offset
+struct Transform
+{
+    QVector3D offset;
+    float scale = 1.0f;
+    QVector3D axis = QVector3D(0, 0, 1);
+    float degrees = 0.0f;
+
+    // where the x, y and z axes of the object end up, without scale and offset
+    void rotatedAxes(QVector3D axes[3]) const;
+    QVector3D apply(const QVector3D &point) const;
+};
+
+class MeshInstance : public Shape
+{
+public:
+    MeshInstance(const std::shared_ptr<const Mesh> &mesh, const Transform &transform, const Color &color, const float mirror)
+        : mesh_(mesh), transform_(transform) { this->color = color; this->mirror = mirror; }
+    const std::shared_ptr<const Mesh> &mesh() const { return mesh_; }
+    const Transform &transform() const { return transform_; }
+    Aabb bounds() const override;
+    void addTo(FlatScene &scene) const override;
+private:
+    std::shared_ptr<const Mesh> mesh_;
+    Transform transform_;
+    // tests every triangle, a FlatScene traces them through the bvh of the mesh
+    bool intersects(
+            const QVector3D &origin,
+            const QVector3D &direction,
+            QVector3D *intersectionOrigin,
+            QVector3D *normalDirection,
+            QVector3D *reflectionDirection) const override;
+    bool occludes(
+            const QVector3D &origin,
+            const QVector3D &direction,
+            float maxDistance) const override;
+};
+
+#endif // SCENE_H
@@ -0,0 +1,302 @@
+#include "scenes.h"
+
+#include <cmath>
+#include <random>
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+
+SceneDescription defaultScene()
+{
+    SceneDescription scene;
+    scene.add<Sphere>(QVector3D(0, 0, 0), 5,  Color(1.0, 0.5, 0.5), 0.9);
+    scene.add<Sphere>(QVector3D(0, -12, 0), 4, Color(0.5, 1.0, 0.5), 0.9);
+    scene.add<Sphere>(QVector3D(5, 8, 7), 3, Color(1, 1, 1), 0.5);
+    scene.add<Sphere>(QVector3D(7, 5, 5), 2, Color(0.5, 0.5, 1.0), 0);
+    scene.add<Sphere>(QVector3D(12, 4, 5), 1, Color(0.5, 0.5, 0.2), 0);
+    scene.add<Sphere>(QVector3D(-100, 0, -50), 100, Color(0.5, 0.5, 0.5), 0.4);
+    scene.add<Sphere>(QVector3D(-100, 0, 50), 100, Color(1, 1, 1), 0.4);
+    scene.add<Bulb>(QVector3D(-20, -10, 20), Color(1, 1, 1) * 0.7);
+    scene.add<Bulb>(QVector3D(-20, -12, 22), Color(1, 1, 1) * 0.7);
+    return scene;
+}
+
+Camera defaultCamera()
+{
+    Camera camera;
+    camera.origin = QVector3D(100, 0, 0);
+    camera.direction = QVector3D(-1, 0, 0);
+    camera.size = 30.0f;
+    return camera;
+}
+
+SceneDescription planesScene()
+{
+    SceneDescription scene = defaultScene();
+    scene.shapes.remove(5, 2);
+    for (const float side : {-1.0f, 1.0f}) {
+        const QVector3D center(-100, 0, 50 * side);
+        const QVector3D normal = -center.normalized();
+        const Color color = side < 0 ? Color(0.5, 0.5, 0.5) : Color(1, 1, 1);
+        scene.add<Plane>(center + normal * 100, normal, color, 0.4);
+    }
+    return scene;
+}
+
+std::shared_ptr<const Mesh> sphereMesh(const int subdivisions)
+{
+    const float t = (1.0f + std::sqrt(5.0f)) / 2.0f;
+    auto mesh = std::make_shared<Mesh>();
+    mesh->vertices = {{-1, t, 0}, {1, t, 0}, {-1, -t, 0}, {1, -t, 0}, {0, -1, t}, {0, 1, t},
+                      {0, -1, -t}, {0, 1, -t}, {t, 0, -1}, {t, 0, 1}, {-t, 0, -1}, {-t, 0, 1}};
+    mesh->indices = {0, 11, 5, 0, 5, 1, 0, 1, 7, 0, 7, 10, 0, 10, 11, 1, 5, 9, 5, 11, 4, 11, 10, 2, 10, 7, 6, 7, 1, 8,
+                     3, 9, 4, 3, 4, 2, 3, 2, 6, 3, 6, 8, 3, 8, 9, 4, 9, 5, 2, 4, 11, 6, 2, 10, 8, 6, 7, 9, 8, 1};
+    for (QVector3D &vertex : mesh->vertices)
+        vertex.normalize();
+    for (int level = 0; level < subdivisions; ++level) {
+        // every edge is split once, by the triangles on both sides of it
+        QHash<qint64, int> middles;
+        const auto middle = [&](const int a, const int b) {
+            const qint64 key = qint64(std::min(a, b)) << 32 | std::max(a, b);
+            const int found = middles.value(key, -1);
+            if (found >= 0)
+                return found;
+            mesh->vertices.append(((mesh->vertices.at(a) + mesh->vertices.at(b)) * 0.5f).normalized());
+            middles.insert(key, mesh->vertices.size() - 1);
+            return mesh->vertices.size() - 1;
+        };
+        QVector<int> indices;
+        indices.reserve(mesh->indices.size() * 4);
+        for (int triangle = 0; triangle < mesh->triangleCount(); ++triangle) {
+            const int a = mesh->indices.at(triangle * 3);
+            const int b = mesh->indices.at(triangle * 3 + 1);
+            const int c = mesh->indices.at(triangle * 3 + 2);
+            const int ab = middle(a, b);
+            const int bc = middle(b, c);
+            const int ca = middle(c, a);
+            indices.append({a, ab, ca, b, bc, ab, c, ca, bc, ab, bc, ca});
+        }
+        mesh->indices = indices;
+    }
+    return mesh;
+}
+
+SceneDescription instancedScene(const int instanceCount, const quint32 seed)
+{
+    std::mt19937 engine(seed);
+
+    const float extent = defaultCamera().size * 0.5f;
+    const float radius = extent / std::cbrt(static_cast<float>(std::max(1, instanceCount)));
+    const QVector3D corner(extent, extent, extent);
+    const std::shared_ptr<const Mesh> mesh = sphereMesh(2);
+    SceneDescription scene;
+    scene.arena->reserve(instanceCount * qsizetype(sizeof(MeshInstance) + 32));
+    scene.shapes.reserve(instanceCount + 1);
+    for (int index = 0; index < instanceCount; ++index) {
+        Transform transform;
+        transform.offset = uniform(engine, -corner, corner);
+        transform.scale = uniform(engine, 0.2f, 0.6f) * radius;
+        transform.axis = uniform(engine, QVector3D(-1, -1, -1), QVector3D(1, 1, 1));
+        transform.degrees = uniform(engine, 0.0f, 360.0f);
+        const Color color = uniform(engine, Color(0.2f, 0.2f, 0.2f), Color(1, 1, 1));
+        const float mirror = uniform(engine, 0.0f, 1.0f) < 0.2f ? uniform(engine, 0.2f, 0.9f) : 0.0f;
+        scene.add<MeshInstance>(mesh, transform, color, mirror);
+    }
+    // below the spheres in the view, up is -z
+    scene.add<Plane>(QVector3D(0, 0, extent * 1.2f), QVector3D(0, 0, -1), Color(0.6, 0.6, 0.6), 0.3);
+    scene.add<Bulb>(QVector3D(-2 * extent, -extent, -extent), Color(1, 1, 1) * 0.7);
+    scene.add<Bulb>(QVector3D(-2 * extent, extent, -extent), Color(1, 1, 1) * 0.7);
+    return scene;
+}
+
+SceneDescription randomScene(
+        const int sphereCount,
+        const int lightCount,
+        const quint32 seed,
+        const float lightRadius)
+{
+    std::mt19937 engine(seed);
+
+    const float extent = defaultCamera().size * 0.5f;
+    const float radius = extent / std::cbrt(static_cast<float>(std::max(1, sphereCount)));
+    const QVector3D corner(extent, extent, extent);
+    SceneDescription scene;
+    scene.arena->reserve(sphereCount * qsizetype(sizeof(Sphere) + 32) + lightCount * qsizetype(sizeof(Bulb) + 32));
+    scene.shapes.reserve(sphereCount);
+    for (int index = 0; index < sphereCount; ++index) {
+        const QVector3D center = uniform(engine, -corner, corner);
+        const Color color = uniform(engine, Color(0.2f, 0.2f, 0.2f), Color(1, 1, 1));
+        const float mirror = uniform(engine, 0.0f, 1.0f) < 0.2f ? uniform(engine, 0.2f, 0.9f) : 0.0f;
+        scene.add<Sphere>(center, uniform(engine, 0.2f, 0.6f) * radius, color, mirror);
+    }
+    const Color lightColor = Color(1, 1, 1) * (1.4f / std::max(1, lightCount));
+    for (int index = 0; index < lightCount; ++index) {
+        const QVector3D center = uniform(engine, QVector3D(-2 * extent, -extent, -extent), QVector3D(-extent, extent, extent));
+        scene.add<Bulb>(center, lightColor, lightRadius);
+    }
+    return scene;
+}
+
+bool loadScene(const QString &fileName, SceneDescription &scene, QString *error)
+{
+    const auto fail = [&](const QString &message) {
+        if (error)
+            *error = message;
+        return false;
+    };
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text))
+        return fail("can't open " + fileName);
+
+    SceneDescription res;
+    QHash<QString, std::shared_ptr<const Mesh>> meshes;
+    for (int lineNumber = 1; !file.atEnd(); ++lineNumber) {
+        QString line = QString::fromUtf8(file.readLine());
+        const int commentStart = line.indexOf('#');
+        if (commentStart >= 0)
+            line.truncate(commentStart);
+        const QStringList words = line.simplified().split(' ', Qt::SkipEmptyParts);
+        if (words.isEmpty())
+            continue;
+
+        const QString where = fileName + ":" + QString::number(lineNumber) + ": ";
+        const QString &type = words.first();
+        // meshes and instances are named by the word after their type
+        const int nameCount = type == "mesh" ? 2 : type == "instance" ? 1 : 0;
+        if (words.size() <= nameCount)
+            return fail(where + "expected the name of a mesh after " + type);
+        QVector<float> numbers;
+        for (int index = 1 + nameCount; index < words.size(); ++index) {
+            bool isNumber = false;
+            numbers.append(words.at(index).toFloat(&isNumber));
+            if (!isNumber)
+                return fail(where + "expected a number instead of " + words.at(index));
+        }
+        const auto color = [&](const int first) {
+            return Color(numbers.at(first), numbers.at(first + 1), numbers.at(first + 2));
+        };
+        const auto mirror = [&](const int index) {
+            return numbers.size() > index ? numbers.at(index) : 0.0f;
+        };
+        if (type == "sphere") {
+            if (numbers.size() != 7 && numbers.size() != 8)
+                return fail(where + "expected sphere <x> <y> <z> <radius> <r> <g> <b> [<mirror>]");
+            res.add<Sphere>(QVector3D(numbers.at(0), numbers.at(1), numbers.at(2)), numbers.at(3), color(4), mirror(7));
+        } else if (type == "plane") {
+            if (numbers.size() != 9 && numbers.size() != 10)
+                return fail(where + "expected plane <x> <y> <z> <normal x> <normal y> <normal z> <r> <g> <b> [<mirror>]");
+            const QVector3D normal(numbers.at(3), numbers.at(4), numbers.at(5));
+            if (normal.lengthSquared() <= 0.0f)
+                return fail(where + "expected a plane normal");
+            res.add<Plane>(QVector3D(numbers.at(0), numbers.at(1), numbers.at(2)), normal, color(6), mirror(9));
+        } else if (type == "triangle") {
+            if (numbers.size() != 12 && numbers.size() != 13)
+                return fail(where + "expected triangle <ax> <ay> <az> <bx> <by> <bz> <cx> <cy> <cz> <r> <g> <b> [<mirror>]");
+            res.add<Triangle>(QVector3D(numbers.at(0), numbers.at(1), numbers.at(2)),
+                              QVector3D(numbers.at(3), numbers.at(4), numbers.at(5)),
+                              QVector3D(numbers.at(6), numbers.at(7), numbers.at(8)),
+                              color(9), mirror(12));
+        } else if (type == "mesh") {
+            if (words.size() != 3)
+                return fail(where + "expected mesh <name> <obj file>");
+            auto mesh = std::make_shared<Mesh>();
+            QString meshError;
+            if (!loadMesh(QFileInfo(fileName).dir().filePath(words.at(2)), *mesh, &meshError))
+                return fail(where + meshError);
+            meshes.insert(words.at(1), mesh);
+        } else if (type == "instance") {
+            const bool isRotated = numbers.size() >= 11;
+            if (numbers.size() < 7 || numbers.size() > 12 || numbers.size() == 9 || numbers.size() == 10)
+                return fail(where + "expected instance <mesh name> <x> <y> <z> <scale> [<axis x> <axis y> <axis z> <degrees>] <r> <g> <b> [<mirror>]");
+            const std::shared_ptr<const Mesh> mesh = meshes.value(words.at(1));
+            if (!mesh)
+                return fail(where + "no mesh named " + words.at(1) + " before");
+            Transform transform;
+            transform.offset = QVector3D(numbers.at(0), numbers.at(1), numbers.at(2));
+            transform.scale = numbers.at(3);
+            if (isRotated) {
+                transform.axis = QVector3D(numbers.at(4), numbers.at(5), numbers.at(6));
+                transform.degrees = numbers.at(7);
+            }
+            const int first = isRotated ? 8 : 4;
+            res.add<MeshInstance>(mesh, transform, color(first), mirror(first + 3));
+        } else if (type == "bulb") {
+            if (numbers.size() != 6 && numbers.size() != 7)
+                return fail(where + "expected bulb <x> <y> <z> <r> <g> <b> [<radius>]");
+            const float radius = numbers.size() > 6 ? numbers.at(6) : std::numeric_limits<float>::infinity();
+            res.add<Bulb>(QVector3D(numbers.at(0), numbers.at(1), numbers.at(2)), color(3), radius);
+        } else if (type == "orthographic" || type == "perspective") {
+            if (numbers.size() != 7)
+                return fail(where + "expected " + type + " <x> <y> <z> <direction x> <direction y> <direction z> <size>");
+            res.hasCamera = true;
+            res.camera.projection = type == "perspective" ? Camera::Perspective : Camera::Orthographic;
+            res.camera.origin = QVector3D(numbers.at(0), numbers.at(1), numbers.at(2));
+            res.camera.direction = QVector3D(numbers.at(3), numbers.at(4), numbers.at(5));
+            res.camera.size = numbers.at(6);
+            if (res.camera.direction.lengthSquared() <= 0.0f || res.camera.size <= 0.0f)
+                return fail(where + "expected a camera direction and a positive size");
+        } else {
+            return fail(where + "unknown element " + type);
+        }
+    }
+    scene = res;
+    return true;
+}
+
+bool loadMesh(const QString &fileName, Mesh &mesh, QString *error)
+{
+    const auto fail = [&](const QString &message) {
+        if (error)
+            *error = message;
+        return false;
+    };
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text))
+        return fail("can't open " + fileName);
+
+    Mesh res;
+    for (int lineNumber = 1; !file.atEnd(); ++lineNumber) {
+        QString line = QString::fromUtf8(file.readLine());
+        const int commentStart = line.indexOf('#');
+        if (commentStart >= 0)
+            line.truncate(commentStart);
+        const QStringList words = line.simplified().split(' ', Qt::SkipEmptyParts);
+        if (words.isEmpty())
+            continue;
+
+        const QString where = fileName + ":" + QString::number(lineNumber) + ": ";
+        const QString &type = words.first();
+        if (type == "v") {
+            if (words.size() < 4)
+                return fail(where + "expected v <x> <y> <z>");
+            float coordinates[3];
+            for (int axis = 0; axis < 3; ++axis) {
+                bool isNumber = false;
+                coordinates[axis] = words.at(axis + 1).toFloat(&isNumber);
+                if (!isNumber)
+                    return fail(where + "expected a number instead of " + words.at(axis + 1));
+            }
+            res.vertices.append(QVector3D(coordinates[0], coordinates[1], coordinates[2]));
+        } else if (type == "f") {
+            if (words.size() < 4)
+                return fail(where + "expected f with at least three vertices");
+            // vertex/texture/normal, negative indices count back from the last vertex
+            QVector<int> corners;
+            for (int index = 1; index < words.size(); ++index) {
+                bool isNumber = false;
+                const int vertex = words.at(index).split('/').first().toInt(&isNumber);
+                const int corner = vertex < 0 ? res.vertices.size() + vertex : vertex - 1;
+                if (!isNumber || vertex == 0 || corner < 0 || corner >= res.vertices.size())
+                    return fail(where + "expected a vertex index instead of " + words.at(index));
+                corners.append(corner);
+            }
+            for (int index = 2; index < corners.size(); ++index)
+                res.indices.append({corners.first(), corners.at(index - 1), corners.at(index)});
+        }
+        // normals, texture coordinates, groups and materials don't matter here
+    }
+    mesh = res;
+    return true;
+}
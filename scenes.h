@@ -0,0 +1,97 @@
+#ifndef SCENES_H
+#define SCENES_H
+
+#include <limits>
+#include <memory>
+#include <random>
+#include <type_traits>
+#include <utility>
+
+#include <QString>
+#include <QVector>
+#include <QVector3D>
+
+#include "arena.h"
+#include "camera.h"
+#include "scene.h"
+
+struct SceneDescription
+{
+    // shapes and lights made by add() live in the arena, they point to it
+    // instead of each having their own allocation and reference count
+    std::shared_ptr<Arena> arena = std::make_shared<Arena>();
+    QVector<std::shared_ptr<Shape>> shapes;
+    QVector<std::shared_ptr<Light>> lights;
+    // the view of the scene if it has one
+    bool hasCamera = false;
+    Camera camera;
+
+    template <typename T, typename... Args>
+    void add(Args &&...args)
+    {
+        const std::shared_ptr<T> element(arena, arena->create<T>(std::forward<Args>(args)...));
+        if constexpr (std::is_base_of<Shape, T>::value)
+            shapes.append(element);
+        else
+            lights.append(element);
+    }
+};
+
+// the mirror spheres scene main() renders, seen by defaultCamera()
+SceneDescription defaultScene();
+Camera defaultCamera();
+// defaultScene() with the two spheres of radius 100 faking its walls replaced by the planes
+// touching them nearest to the origin
+SceneDescription planesScene();
+// copies of a sphere mesh of 320 triangles, of random placements and colors, filling the view
+// of defaultCamera() above a floor plane; the mesh is stored once however many instances there are
+SceneDescription instancedScene(int instanceCount, quint32 seed);
+// unit sphere of 20 * 4^subdivisions triangles, subdividing an icosahedron
+std::shared_ptr<const Mesh> sphereMesh(int subdivisions);
+
+// random numbers in [min, max) and [min, max] that are the same for a seed on every platform:
+// std distributions differ between standard libraries, the engine itself doesn't
+inline float uniform(std::mt19937 &engine, const float min, const float max)
+{
+    return min + (max - min) * static_cast<float>(engine() / 4294967296.0);
+}
+inline int uniformInt(std::mt19937 &engine, const int min, const int max)
+{
+    return min + static_cast<int>(engine() / 4294967296.0 * (double(max) - min + 1));
+}
+// a point of the box from min to max; its coordinates are drawn x first, as arguments of a call
+// may be evaluated in any order
+inline QVector3D uniform(std::mt19937 &engine, const QVector3D &min, const QVector3D &max)
+{
+    const float x = uniform(engine, min.x(), max.x());
+    const float y = uniform(engine, min.y(), max.y());
+    return QVector3D(x, y, uniform(engine, min.z(), max.z()));
+}
+
+// spheres of random sizes, colors and mirror values filling the view of defaultCamera(),
+// lit by bulbs of given influence radius; the same seed gives the same scene on every platform
+SceneDescription randomScene(
+        int sphereCount,
+        int lightCount,
+        quint32 seed,
+        float lightRadius = std::numeric_limits<float>::infinity());
+
+// reads a scene from a text file, one shape or light per line, '#' starts a comment:
+//   sphere <x> <y> <z> <radius> <r> <g> <b> [<mirror>]
+//   plane <x> <y> <z> <normal x> <normal y> <normal z> <r> <g> <b> [<mirror>]
+//   triangle <ax> <ay> <az> <bx> <by> <bz> <cx> <cy> <cz> <r> <g> <b> [<mirror>]
+//   mesh <name> <obj file>
+//   instance <mesh name> <x> <y> <z> <scale> [<axis x> <axis y> <axis z> <degrees>] <r> <g> <b> [<mirror>]
+//   bulb <x> <y> <z> <r> <g> <b> [<radius>]
+//   orthographic <x> <y> <z> <direction x> <direction y> <direction z> <size>
+//   perspective <x> <y> <z> <direction x> <direction y> <direction z> <field of view degrees>
+// a mesh line loads a mesh for the instance lines after it, its file is relative to the scene file;
+// an instance places it rotated around the axis, scaled and moved to x, y, z, see Transform;
+// a camera line sets the view, see Camera;
+// returns false and sets error, naming the line, if the file can't be read
+bool loadScene(const QString &fileName, SceneDescription &scene, QString *error = nullptr);
+// reads the vertices and faces of a wavefront obj file, faces of more than three corners
+// are split into triangles; returns false and sets error, naming the line, if the file can't be read
+bool loadMesh(const QString &fileName, Mesh &mesh, QString *error = nullptr);
+
+#endif // SCENES_H
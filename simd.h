@@ -0,0 +1,172 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <cmath>
+#include <algorithm>
+
+// packet math for the intersection kernels, the instruction set is chosen at build time:
+// CONFIG += simd_avx, simd_sse, simd_neon or simd_scalar in raytracer.pro,
+// otherwise the widest one the compiler targets by default
+#if !defined(YART_SIMD_AVX) && !defined(YART_SIMD_SSE) && !defined(YART_SIMD_NEON) && !defined(YART_SIMD_SCALAR)
+#if defined(__AVX__)
+#define YART_SIMD_AVX
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define YART_SIMD_SSE
+#elif defined(__ARM_NEON)
+#define YART_SIMD_NEON
+#else
+#define YART_SIMD_SCALAR
+#endif
+#endif
+
+#if defined(YART_SIMD_AVX)
+#include <immintrin.h>
+#elif defined(YART_SIMD_SSE)
+#include <emmintrin.h>
+#elif defined(YART_SIMD_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace simd {
+
+#if defined(YART_SIMD_AVX)
+
+constexpr int width = 8;
+constexpr const char *name = "avx";
+
+struct Floats { __m256 v; };
+struct Mask { __m256 v; };
+
+inline Floats load(const float *values) { return {_mm256_loadu_ps(values)}; }
+inline Floats broadcast(const float value) { return {_mm256_set1_ps(value)}; }
+inline void store(float *values, const Floats a) { _mm256_storeu_ps(values, a.v); }
+inline Floats operator+(const Floats a, const Floats b) { return {_mm256_add_ps(a.v, b.v)}; }
+inline Floats operator-(const Floats a, const Floats b) { return {_mm256_sub_ps(a.v, b.v)}; }
+inline Floats operator*(const Floats a, const Floats b) { return {_mm256_mul_ps(a.v, b.v)}; }
+inline Floats max(const Floats a, const Floats b) { return {_mm256_max_ps(a.v, b.v)}; }
+inline Floats sqrt(const Floats a) { return {_mm256_sqrt_ps(a.v)}; }
+inline Mask operator<(const Floats a, const Floats b) { return {_mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ)}; }
+inline Mask operator<=(const Floats a, const Floats b) { return {_mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ)}; }
+inline Mask operator>=(const Floats a, const Floats b) { return {_mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ)}; }
+inline Mask operator&(const Mask a, const Mask b) { return {_mm256_and_ps(a.v, b.v)}; }
+inline Mask operator|(const Mask a, const Mask b) { return {_mm256_or_ps(a.v, b.v)}; }
+inline int bits(const Mask a) { return _mm256_movemask_ps(a.v); }
+
+#elif defined(YART_SIMD_SSE)
+
+constexpr int width = 4;
+constexpr const char *name = "sse";
+
+struct Floats { __m128 v; };
+struct Mask { __m128 v; };
+
+inline Floats load(const float *values) { return {_mm_loadu_ps(values)}; }
+inline Floats broadcast(const float value) { return {_mm_set1_ps(value)}; }
+inline void store(float *values, const Floats a) { _mm_storeu_ps(values, a.v); }
+inline Floats operator+(const Floats a, const Floats b) { return {_mm_add_ps(a.v, b.v)}; }
+inline Floats operator-(const Floats a, const Floats b) { return {_mm_sub_ps(a.v, b.v)}; }
+inline Floats operator*(const Floats a, const Floats b) { return {_mm_mul_ps(a.v, b.v)}; }
+inline Floats max(const Floats a, const Floats b) { return {_mm_max_ps(a.v, b.v)}; }
+inline Floats sqrt(const Floats a) { return {_mm_sqrt_ps(a.v)}; }
+inline Mask operator<(const Floats a, const Floats b) { return {_mm_cmplt_ps(a.v, b.v)}; }
+inline Mask operator<=(const Floats a, const Floats b) { return {_mm_cmple_ps(a.v, b.v)}; }
+inline Mask operator>=(const Floats a, const Floats b) { return {_mm_cmpge_ps(a.v, b.v)}; }
+inline Mask operator&(const Mask a, const Mask b) { return {_mm_and_ps(a.v, b.v)}; }
+inline Mask operator|(const Mask a, const Mask b) { return {_mm_or_ps(a.v, b.v)}; }
+inline int bits(const Mask a) { return _mm_movemask_ps(a.v); }
+
+#elif defined(YART_SIMD_NEON)
+
+constexpr int width = 4;
+constexpr const char *name = "neon";
+
+struct Floats { float32x4_t v; };
+struct Mask { uint32x4_t v; };
+
+inline Floats load(const float *values) { return {vld1q_f32(values)}; }
+inline Floats broadcast(const float value) { return {vdupq_n_f32(value)}; }
+inline void store(float *values, const Floats a) { vst1q_f32(values, a.v); }
+inline Floats operator+(const Floats a, const Floats b) { return {vaddq_f32(a.v, b.v)}; }
+inline Floats operator-(const Floats a, const Floats b) { return {vsubq_f32(a.v, b.v)}; }
+inline Floats operator*(const Floats a, const Floats b) { return {vmulq_f32(a.v, b.v)}; }
+inline Floats max(const Floats a, const Floats b) { return {vmaxq_f32(a.v, b.v)}; }
+#if defined(__aarch64__) || defined(_M_ARM64)
+inline Floats sqrt(const Floats a) { return {vsqrtq_f32(a.v)}; }
+#else
+// armv7 has only an estimate of the reciprocal square root, lanes are taken one at a time to stay exact
+inline Floats sqrt(const Floats a)
+{
+    float values[width];
+    vst1q_f32(values, a.v);
+    for (float &value : values)
+        value = std::sqrt(value);
+    return {vld1q_f32(values)};
+}
+#endif
+inline Mask operator<(const Floats a, const Floats b) { return {vcltq_f32(a.v, b.v)}; }
+inline Mask operator<=(const Floats a, const Floats b) { return {vcleq_f32(a.v, b.v)}; }
+inline Mask operator>=(const Floats a, const Floats b) { return {vcgeq_f32(a.v, b.v)}; }
+inline Mask operator&(const Mask a, const Mask b) { return {vandq_u32(a.v, b.v)}; }
+inline Mask operator|(const Mask a, const Mask b) { return {vorrq_u32(a.v, b.v)}; }
+inline int bits(const Mask a)
+{
+    static const uint32_t laneBits[width] = {1, 2, 4, 8};
+    const uint32x4_t masked = vandq_u32(a.v, vld1q_u32(laneBits));
+#if defined(__aarch64__) || defined(_M_ARM64)
+    return static_cast<int>(vaddvq_u32(masked));
+#else
+    // armv7 has no add across the vector either, the halves are added pairwise
+    const uint32x2_t pairs = vpadd_u32(vget_low_u32(masked), vget_high_u32(masked));
+    return static_cast<int>(vget_lane_u32(vpadd_u32(pairs, pairs), 0));
+#endif
+}
+
+#else
+
+constexpr int width = 4;
+constexpr const char *name = "scalar";
+
+struct Floats { float v[width]; };
+struct Mask { bool v[width]; };
+
+template <typename Result, typename Operation>
+inline Result lanes(const Operation &operation)
+{
+    Result res;
+    for (int lane = 0; lane < width; ++lane)
+        res.v[lane] = operation(lane);
+    return res;
+}
+
+inline Floats load(const float *values) { return lanes<Floats>([&](int i) { return values[i]; }); }
+inline Floats broadcast(const float value) { return lanes<Floats>([&](int) { return value; }); }
+inline void store(float *values, const Floats a) { std::copy_n(a.v, width, values); }
+inline Floats operator+(const Floats a, const Floats b) { return lanes<Floats>([&](int i) { return a.v[i] + b.v[i]; }); }
+inline Floats operator-(const Floats a, const Floats b) { return lanes<Floats>([&](int i) { return a.v[i] - b.v[i]; }); }
+inline Floats operator*(const Floats a, const Floats b) { return lanes<Floats>([&](int i) { return a.v[i] * b.v[i]; }); }
+inline Floats max(const Floats a, const Floats b) { return lanes<Floats>([&](int i) { return std::max(a.v[i], b.v[i]); }); }
+inline Floats sqrt(const Floats a) { return lanes<Floats>([&](int i) { return std::sqrt(a.v[i]); }); }
+inline Mask operator<(const Floats a, const Floats b) { return lanes<Mask>([&](int i) { return a.v[i] < b.v[i]; }); }
+inline Mask operator<=(const Floats a, const Floats b) { return lanes<Mask>([&](int i) { return a.v[i] <= b.v[i]; }); }
+inline Mask operator>=(const Floats a, const Floats b) { return lanes<Mask>([&](int i) { return a.v[i] >= b.v[i]; }); }
+inline Mask operator&(const Mask a, const Mask b) { return lanes<Mask>([&](int i) { return a.v[i] && b.v[i]; }); }
+inline Mask operator|(const Mask a, const Mask b) { return lanes<Mask>([&](int i) { return a.v[i] || b.v[i]; }); }
+inline int bits(const Mask a)
+{
+    int res = 0;
+    for (int lane = 0; lane < width; ++lane)
+        res |= a.v[lane] << lane;
+    return res;
+}
+
+#endif
+
+// bits of the first count lanes
+inline int firstLanes(const int count)
+{
+    return (1 << std::clamp(count, 0, width)) - 1;
+}
+
+}
+
+#endif // SIMD_H
@@ -0,0 +1,43 @@
+#include "spheres.h"
+
+SphereArray::SphereArray(
+        const int size,
+        const FlatArray<float> &centerX,
+        const FlatArray<float> &centerY,
+        const FlatArray<float> &centerZ,
+        const FlatArray<float> &radiusSquared)
+    : centerX_(centerX), centerY_(centerY), centerZ_(centerZ), radiusSquared_(radiusSquared), size_(size)
+{
+}
+
+void SphereArray::append(const QVector3D &center, const float radius)
+{
+    const int index = size_++;
+    const int paddedSize = size_ + simd::width - 1;
+    centerX_.resize(paddedSize);
+    centerY_.resize(paddedSize);
+    centerZ_.resize(paddedSize);
+    radiusSquared_.resize(paddedSize);
+    centerX_[index] = center.x();
+    centerY_[index] = center.y();
+    centerZ_[index] = center.z();
+    radiusSquared_[index] = radius * radius;
+}
+
+void SphereArray::set(const int index, const QVector3D &center, const float radius)
+{
+    centerX_[index] = center.x();
+    centerY_[index] = center.y();
+    centerZ_[index] = center.z();
+    radiusSquared_[index] = radius * radius;
+}
+
+QVector3D SphereArray::center(const int index) const
+{
+    return QVector3D(centerX_.at(index), centerY_.at(index), centerZ_.at(index));
+}
+
+float SphereArray::radius(const int index) const
+{
+    return std::sqrt(radiusSquared_.at(index));
+}
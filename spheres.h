@@ -0,0 +1,217 @@
+#ifndef SPHERES_H
+#define SPHERES_H
+
+#include <cmath>
+#include <algorithm>
+
+#include <QVector>
+#include <QVector3D>
+
+#include "flatarray.h"
+#include "simd.h"
+
+// spheres as a structure of arrays, the kernels test one ray against simd::width spheres at once;
+// arrays are padded by simd::width - 1 elements, so a packet may start at any sphere
+class SphereArray
+{
+public:
+    SphereArray() = default;
+    // from arrays as the ones below, padded by at least simd::width - 1 elements
+    SphereArray(
+            int size,
+            const FlatArray<float> &centerX,
+            const FlatArray<float> &centerY,
+            const FlatArray<float> &centerZ,
+            const FlatArray<float> &radiusSquared);
+
+    void append(const QVector3D &center, float radius);
+    void set(int index, const QVector3D &center, float radius);
+    int size() const { return size_; }
+    QVector3D center(int index) const;
+    float radius(int index) const;
+
+    // closest hit among spheres [first, first + count) nearer than distance, except the ones
+    // isSkipped(sphereIndex) is true for; lowers distance and returns index of the sphere or -1
+    template <typename IsSkipped>
+    int closestHit(
+            int first,
+            int count,
+            const QVector3D &origin,
+            const QVector3D &direction,
+            float &distance,
+            const IsSkipped &isSkipped) const;
+    // whether any of these spheres is hit not farther than maxDistance, the index of the first one
+    // found or -1
+    template <typename IsSkipped>
+    int anyHit(
+            int first,
+            int count,
+            const QVector3D &origin,
+            const QVector3D &direction,
+            float maxDistance,
+            const IsSkipped &isSkipped) const;
+
+    // same as above, one sphere at a time, to check the kernels against
+    template <typename IsSkipped>
+    int closestHitScalar(
+            int first,
+            int count,
+            const QVector3D &origin,
+            const QVector3D &direction,
+            float &distance,
+            const IsSkipped &isSkipped) const;
+    template <typename IsSkipped>
+    int anyHitScalar(
+            int first,
+            int count,
+            const QVector3D &origin,
+            const QVector3D &direction,
+            float maxDistance,
+            const IsSkipped &isSkipped) const;
+
+    // the padded arrays themselves, for scene files
+    const FlatArray<float> &centerX() const { return centerX_; }
+    const FlatArray<float> &centerY() const { return centerY_; }
+    const FlatArray<float> &centerZ() const { return centerZ_; }
+    const FlatArray<float> &radiusSquared() const { return radiusSquared_; }
+
+private:
+    FlatArray<float> centerX_;
+    FlatArray<float> centerY_;
+    FlatArray<float> centerZ_;
+    FlatArray<float> radiusSquared_;
+    int size_ = 0;
+};
+
+template <typename IsSkipped>
+int SphereArray::closestHit(
+        const int first,
+        const int count,
+        const QVector3D &origin,
+        const QVector3D &direction,
+        float &distance,
+        const IsSkipped &isSkipped) const
+{
+    using namespace simd;
+    const Floats originX = broadcast(origin.x());
+    const Floats originY = broadcast(origin.y());
+    const Floats originZ = broadcast(origin.z());
+    const Floats directionX = broadcast(direction.x());
+    const Floats directionY = broadcast(direction.y());
+    const Floats directionZ = broadcast(direction.z());
+    const Floats zero = broadcast(0.0f);
+
+    int res = -1;
+    for (int packet = first; packet < first + count; packet += width) {
+        const Floats mX = originX - load(centerX_.constData() + packet);
+        const Floats mY = originY - load(centerY_.constData() + packet);
+        const Floats mZ = originZ - load(centerZ_.constData() + packet);
+        const Floats b = directionX * mX + directionY * mY + directionZ * mZ;
+        const Floats c = mX * mX + mY * mY + mZ * mZ - load(radiusSquared_.constData() + packet);
+        const Floats discr = b * b - c;
+        // starting inside a sphere hits it at zero distance
+        const Floats t = max(zero, zero - b - simd::sqrt(max(zero, discr)));
+        const Mask isHit = ((c <= zero) | (b <= zero)) & (discr >= zero) & (t < broadcast(distance));
+        int hits = bits(isHit) & firstLanes(first + count - packet);
+        if (!hits)
+            continue;
+
+        float distances[width];
+        store(distances, t);
+        for (int lane = 0; hits; ++lane, hits >>= 1) {
+            if (!(hits & 1) || distances[lane] >= distance || isSkipped(packet + lane))
+                continue;
+            distance = distances[lane];
+            res = packet + lane;
+        }
+    }
+    return res;
+}
+
+template <typename IsSkipped>
+int SphereArray::anyHit(
+        const int first,
+        const int count,
+        const QVector3D &origin,
+        const QVector3D &direction,
+        const float maxDistance,
+        const IsSkipped &isSkipped) const
+{
+    using namespace simd;
+    const Floats originX = broadcast(origin.x());
+    const Floats originY = broadcast(origin.y());
+    const Floats originZ = broadcast(origin.z());
+    const Floats directionX = broadcast(direction.x());
+    const Floats directionY = broadcast(direction.y());
+    const Floats directionZ = broadcast(direction.z());
+    const Floats zero = broadcast(0.0f);
+    const Floats distance = broadcast(maxDistance);
+
+    for (int packet = first; packet < first + count; packet += width) {
+        const Floats mX = originX - load(centerX_.constData() + packet);
+        const Floats mY = originY - load(centerY_.constData() + packet);
+        const Floats mZ = originZ - load(centerZ_.constData() + packet);
+        const Floats b = directionX * mX + directionY * mY + directionZ * mZ;
+        const Floats c = mX * mX + mY * mY + mZ * mZ - load(radiusSquared_.constData() + packet);
+        const Floats discr = b * b - c;
+        // -b - sqrt(discr) <= maxDistance, without the sqrt
+        const Floats nearest = zero - b - distance;
+        const Mask isHit = (c <= zero) | ((b <= zero) & (discr >= zero) & ((nearest <= zero) | (discr >= nearest * nearest)));
+        int hits = bits(isHit) & firstLanes(first + count - packet);
+        for (int lane = 0; hits; ++lane, hits >>= 1)
+            if ((hits & 1) && !isSkipped(packet + lane))
+                return packet + lane;
+    }
+    return -1;
+}
+
+template <typename IsSkipped>
+int SphereArray::closestHitScalar(
+        const int first,
+        const int count,
+        const QVector3D &origin,
+        const QVector3D &direction,
+        float &distance,
+        const IsSkipped &isSkipped) const
+{
+    int res = -1;
+    for (int index = first; index < first + count; ++index) {
+        const QVector3D m = origin - center(index);
+        const float b = QVector3D::dotProduct(direction, m);
+        const float c = QVector3D::dotProduct(m, m) - radiusSquared_.at(index);
+        if (c > 0.0f && b > 0.0f)
+            continue;
+        const float discr = b * b - c;
+        if (discr < 0.0f)
+            continue;
+        const float t = std::max(0.0f, -b - std::sqrt(discr));
+        if (t >= distance || isSkipped(index))
+            continue;
+        distance = t;
+        res = index;
+    }
+    return res;
+}
+
+template <typename IsSkipped>
+int SphereArray::anyHitScalar(
+        const int first,
+        const int count,
+        const QVector3D &origin,
+        const QVector3D &direction,
+        const float maxDistance,
+        const IsSkipped &isSkipped) const
+{
+    for (int index = first; index < first + count; ++index) {
+        const QVector3D m = origin - center(index);
+        const float b = QVector3D::dotProduct(direction, m);
+        const float c = QVector3D::dotProduct(m, m) - radiusSquared_.at(index);
+        if (c > 0.0f && (b > 0.0f || b * b - c < 0.0f || -b - std::sqrt(b * b - c) > maxDistance))
+            continue;
+        if (!isSkipped(index))
+            return index;
+    }
+    return -1;
+}
+
+#endif // SPHERES_H
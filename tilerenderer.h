@@ -0,0 +1,449 @@
+#ifndef TILERENDERER_H
+#define TILERENDERER_H
+
+#include <cmath>
+#include <algorithm>
+
+#include <QAtomicInt>
+#include <QThreadPool>
+#include <QVector>
+
+#include "allocations.h"
+#include "arena.h"
+#include "bvh.h"
+#include "camera.h"
+#include "framebuffer.h"
+#include "imagestream.h"
+#include "profiler.h"
+#include "sampler.h"
+#include "scene.h"
+#include "tracer.h"
+
+struct RenderStats
+{
+    qint64 pixelsTraced = 0;
+    qint64 pixelsReused = 0;
+    qint64 pixelsSupersampled = 0;
+    qint64 samplesTraced = 0;
+    qint64 allocations = 0;
+    RayStats rays;
+    Bvh::TraversalStats traversal;
+    // measured only with YART_PROFILING
+    StageTimes stages;
+    qint64 slowestTileNanoseconds = 0;
+
+    RenderStats &operator+=(const RenderStats &other)
+    {
+        pixelsTraced += other.pixelsTraced;
+        pixelsReused += other.pixelsReused;
+        pixelsSupersampled += other.pixelsSupersampled;
+        samplesTraced += other.samplesTraced;
+        allocations += other.allocations;
+        rays += other.rays;
+        traversal += other.traversal;
+        stages += other.stages;
+        slowestTileNanoseconds = std::max(slowestTileNanoseconds, other.slowestTileNanoseconds);
+        return *this;
+    }
+};
+
+struct Tile
+{
+    int x = 0;
+    int y = 0;
+    int width = 0;
+    int height = 0;
+    RenderStats stats;
+};
+
+inline QVector<Tile> splitToTiles(const int width, const int height, const int tileSize)
+{
+    QVector<Tile> tiles;
+    for (int y = 0; y < height; y += tileSize)
+        for (int x = 0; x < width; x += tileSize) {
+            Tile tile;
+            tile.x = x;
+            tile.y = y;
+            tile.width = std::min(tileSize, width - x);
+            tile.height = std::min(tileSize, height - y);
+            tiles.append(tile);
+        }
+    return tiles;
+}
+
+// pixels of a rectangle of an image held in a scratch arena, addressed in image coordinates
+class TileImage
+{
+public:
+    TileImage(const int x, const int y, const int width, const int height, Arena &arena)
+        : x_(x), y_(y), width_(width), height_(height), pixels_(arena.allocateArray<float>(qsizetype(width) * height * 3)) {}
+
+    bool contains(const int x, const int y) const { return x >= x_ && y >= y_ && x < x_ + width_ && y < y_ + height_; }
+    QVector3D pixel(const int x, const int y) const
+    {
+        const float *rgb = pixels_ + ((y - y_) * width_ + x - x_) * 3;
+        return QVector3D(rgb[0], rgb[1], rgb[2]);
+    }
+    void setPixel(const int x, const int y, const QVector3D &color)
+    {
+        float *rgb = pixels_ + ((y - y_) * width_ + x - x_) * 3;
+        rgb[0] = color.x();
+        rgb[1] = color.y();
+        rgb[2] = color.z();
+    }
+    const float *constData() const { return pixels_; }
+    int floatsPerLine() const { return width_ * 3; }
+
+private:
+    int x_ = 0;
+    int y_ = 0;
+    int width_ = 0;
+    int height_ = 0;
+    float *pixels_ = nullptr;
+};
+
+// samples of the pixels of a tile, gathered to be shaded together by
+// shader(samples, count, colors, scratch), flush() adds weight * color of each of them
+// to its pixel of the image, a Framebuffer or a TileImage
+template <typename BatchShader, typename Image = Framebuffer>
+class SampleBatch
+{
+public:
+    static constexpr int capacity = maxBatchSize;
+
+    SampleBatch(Image &image, const BatchShader &shader, Arena &scratch)
+        : image_(image), shader_(shader), scratch_(scratch) {}
+
+    void add(const Sample &sample, const int pixelX, const int pixelY, const float weight)
+    {
+        if (size_ == capacity)
+            flush();
+        samples_[size_] = sample;
+        targets_[size_] = {pixelX, pixelY, weight};
+        ++size_;
+    }
+    void flush()
+    {
+        if (size_ == 0)
+            return;
+        shader_(samples_, size_, colors_, scratch_);
+        for (int index = 0; index < size_; ++index) {
+            const Target &target = targets_[index];
+            image_.setPixel(target.x, target.y, image_.pixel(target.x, target.y) + colors_[index] * target.weight);
+        }
+        size_ = 0;
+    }
+
+private:
+    struct Target
+    {
+        int x;
+        int y;
+        float weight;
+    };
+
+    Image &image_;
+    const BatchShader &shader_;
+    Arena &scratch_;
+    Sample samples_[capacity];
+    Target targets_[capacity];
+    Color colors_[capacity];
+    int size_ = 0;
+};
+
+// every pool worker takes tiles one by one in their order and calls renderTile(tile, stats, scratch)
+// for them, that writes right into its part of the image; scratch is an arena of the worker,
+// kept until scratchArenas is reset;
+// returns what was counted while tracing, allocations only with YART_COUNT_ALLOCATIONS
+template <typename TileRenderer>
+RenderStats renderTileList(
+        QVector<Tile> tiles,
+        QThreadPool &threadPool,
+        ScratchArenas &scratchArenas,
+        const TileRenderer &renderTile)
+{
+    QAtomicInt nextTile = 0;
+    const int tileCount = tiles.size();
+    // detached here, workers don't touch the vector itself
+    Tile *tileData = tiles.data();
+    const int workerCount = std::min(tileCount, std::max(1, threadPool.maxThreadCount()));
+    for (int worker = 0; worker < workerCount; ++worker)
+        threadPool.start([tileData, tileCount, &nextTile, &scratchArenas, &renderTile] {
+            Arena &scratch = scratchArenas.acquire();
+            for (int index = nextTile.fetchAndAddRelaxed(1); index < tileCount; index = nextTile.fetchAndAddRelaxed(1)) {
+                Tile &tile = tileData[index];
+                const qint64 allocationsBefore = allocationCount();
+                const RayStats raysBefore = threadRayStats();
+                const Bvh::TraversalStats traversalBefore = Bvh::threadTraversalStats();
+                const StageTimes stagesBefore = profiling::threadStageTimes();
+                {
+                    const ProfileEvent event("tile", {{"x", tile.x}, {"y", tile.y}});
+                    const StageTimer timer(Stage::Tiles);
+                    renderTile(tile, tile.stats, scratch);
+                }
+                tile.stats.allocations = allocationCount() - allocationsBefore;
+                tile.stats.rays = threadRayStats() - raysBefore;
+                tile.stats.traversal = Bvh::threadTraversalStats() - traversalBefore;
+                tile.stats.stages = profiling::threadStageTimes() - stagesBefore;
+                tile.stats.slowestTileNanoseconds = tile.stats.stages[Stage::Tiles];
+            }
+            scratchArenas.release(scratch);
+        });
+    threadPool.waitForDone();
+
+    RenderStats stats;
+    for (const Tile &tile : tiles)
+        stats += tile.stats;
+    return stats;
+}
+
+// same for all tiles of an image, in rows from the top
+template <typename TileRenderer>
+RenderStats renderTiles(
+        const int width,
+        const int height,
+        QThreadPool &threadPool,
+        const int tileSize,
+        ScratchArenas &scratchArenas,
+        const TileRenderer &renderTile)
+{
+    return renderTileList(splitToTiles(width, height, tileSize), threadPool, scratchArenas, renderTile);
+}
+
+// shader(samples, count, colors, scratch) gives colors of samples at pixel coordinates, see SampleBatch;
+// pixels (2x, 2y) are the same samples as pixels (x, y) of a framebuffer of half the resolution,
+// so when such coarser one is given they are copied from it instead
+template <typename BatchShader>
+RenderStats render(
+        Framebuffer &framebuffer,
+        QThreadPool &threadPool,
+        const int tileSize,
+        ScratchArenas &scratchArenas,
+        const BatchShader &shader,
+        const Framebuffer *coarser = nullptr)
+{
+    return renderTiles(framebuffer.width(), framebuffer.height(), threadPool, tileSize, scratchArenas, [&](const Tile &tile, RenderStats &stats, Arena &scratch) {
+        SampleBatch<BatchShader> batch(framebuffer, shader, scratch);
+        for (int y = tile.y; y < tile.y + tile.height; ++y)
+            for (int x = tile.x; x < tile.x + tile.width; ++x) {
+                if (coarser && x % 2 == 0 && y % 2 == 0) {
+                    ++stats.pixelsReused;
+                    framebuffer.setPixel(x, y, coarser->pixel(x / 2, y / 2));
+                    continue;
+                }
+                ++stats.pixelsTraced;
+                ++stats.samplesTraced;
+                framebuffer.setPixel(x, y, Color());
+                batch.add({float(x), float(y)}, x, y, 1.0f);
+            }
+        batch.flush();
+    });
+}
+
+struct Antialiasing
+{
+    // samples taken in a pixel that is supersampled, rounded down to a square for the grid
+    int samplesPerPixel = 4;
+    // pixels differing from a neighbour by more than that in any channel are supersampled
+    float contrastThreshold = 0.05f;
+    // where in the pixel they are; the grid keeps the sample already traced at the corner
+    // of the pixel as its first one, the other patterns trace all of theirs
+    sampling::Pattern pattern = sampling::Grid;
+    // of the per pixel scrambles, frames of the same seed get the same samples
+    quint32 seed = 0;
+
+    int supersampleCount() const
+    {
+        if (pattern != sampling::Grid)
+            return std::max(1, samplesPerPixel);
+        const int gridSize = std::max(1, static_cast<int>(std::sqrt(samplesPerPixel)));
+        return gridSize * gridSize;
+    }
+};
+
+// adds the samples supersampling pixel x, y to batch and sets the pixel to what it keeps of traced,
+// its sample at the corner; returns the count of samples added
+template <typename Batch, typename Image>
+int supersample(Batch &batch, Image &image, const int x, const int y, const Color &traced, const Antialiasing &antialiasing)
+{
+    const int count = antialiasing.supersampleCount();
+    const float weight = 1.0f / count;
+    const bool keepsTraced = antialiasing.pattern == sampling::Grid;
+    image.setPixel(x, y, keepsTraced ? traced * weight : Color());
+    const quint32 seed = keepsTraced ? 0 : sampling::pixelSeed(x, y, antialiasing.seed);
+    for (int index = keepsTraced ? 1 : 0; index < count; ++index) {
+        const Sample offset = sampling::offset(antialiasing.pattern, seed, index, count);
+        batch.add({x + offset.x, y + offset.y}, x, y, weight);
+    }
+    return keepsTraced ? count - 1 : count;
+}
+
+// compares colors as they are displayed, clamped to [0, 1], with neighbours the image contains
+template <typename Image>
+float contrast(const Image &image, const int x, const int y)
+{
+    const auto displayed = [](const Color &color) {
+        return QVector3D(std::clamp(color.x(), 0.0f, 1.0f), std::clamp(color.y(), 0.0f, 1.0f), std::clamp(color.z(), 0.0f, 1.0f));
+    };
+    const Color pixel = displayed(image.pixel(x, y));
+    float res = 0.0f;
+    const auto compare = [&](const int neighbourX, const int neighbourY) {
+        if (!image.contains(neighbourX, neighbourY))
+            return;
+        const Color difference = displayed(image.pixel(neighbourX, neighbourY)) - pixel;
+        res = std::max({res, std::abs(difference.x()), std::abs(difference.y()), std::abs(difference.z())});
+    };
+    compare(x - 1, y);
+    compare(x + 1, y);
+    compare(x, y - 1);
+    compare(x, y + 1);
+    return res;
+}
+
+// supersamples only pixels of high contrast with their neighbours, averaging
+// samples of the antialiasing pattern over the pixel, see supersample();
+// the rest of the framebuffer is kept as is
+template <typename BatchShader>
+RenderStats antialias(
+        Framebuffer &framebuffer,
+        QThreadPool &threadPool,
+        const int tileSize,
+        ScratchArenas &scratchArenas,
+        const BatchShader &shader,
+        const Antialiasing &antialiasing)
+{
+    if (antialiasing.supersampleCount() < 2)
+        return RenderStats();
+    const Framebuffer source = framebuffer;
+    return renderTiles(framebuffer.width(), framebuffer.height(), threadPool, tileSize, scratchArenas, [&](const Tile &tile, RenderStats &stats, Arena &scratch) {
+        SampleBatch<BatchShader> batch(framebuffer, shader, scratch);
+        for (int y = tile.y; y < tile.y + tile.height; ++y)
+            for (int x = tile.x; x < tile.x + tile.width; ++x) {
+                if (contrast(source, x, y) <= antialiasing.contrastThreshold)
+                    continue;
+                stats.samplesTraced += supersample(batch, framebuffer, x, y, source.pixel(x, y), antialiasing);
+                ++stats.pixelsSupersampled;
+            }
+        batch.flush();
+    });
+}
+
+// renders square frames of given resolutions one by one, each resolution that is twice
+// the previous one traces only three quarters of its pixels, see render(),
+// the last one is antialiased afterwards; shader(samples, count, colors, scratch, resolution)
+// gives sample colors, worker scratch arenas are reset after every level;
+// levelReady(framebuffer, stats) is called per finished level and returns false to stop
+template <typename BatchShader, typename LevelReady>
+bool renderProgressive(
+        const QVector<int> &resolutions,
+        QThreadPool &threadPool,
+        const int tileSize,
+        const Antialiasing &antialiasing,
+        const BatchShader &shader,
+        const LevelReady &levelReady)
+{
+    ScratchArenas scratchArenas(threadPool.maxThreadCount());
+    Framebuffer previous;
+    for (const int resolution : resolutions) {
+        Framebuffer framebuffer(resolution, resolution);
+        const bool isRefinement = !previous.isNull() && previous.width() * 2 == resolution;
+        const auto shaderAtResolution = [&](const Sample *samples, const int count, Color *colors, Arena &scratch) {
+            shader(samples, count, colors, scratch, resolution);
+        };
+        const ProfileEvent event("level", {{"resolution", resolution}});
+        const RenderStats stats = render(framebuffer, threadPool, tileSize, scratchArenas, shaderAtResolution, isRefinement ? &previous : nullptr);
+        scratchArenas.reset();
+        if (!levelReady(framebuffer, stats))
+            return false;
+        if (resolution == resolutions.last()) {
+            const ProfileEvent antialiasingEvent("antialias", {{"resolution", resolution}});
+            const RenderStats antialiasingStats = antialias(framebuffer, threadPool, tileSize, scratchArenas, shaderAtResolution, antialiasing);
+            scratchArenas.reset();
+            if (!levelReady(framebuffer, antialiasingStats))
+                return false;
+        }
+        previous = std::move(framebuffer);
+    }
+    return true;
+}
+
+// traces the tile of a width by height frame with a border of a pixel for the contrast of its edges
+// and antialiases it on its own, giving the same pixels as antialias() over the whole frame;
+// the result and its border are allocated in scratch, shader is the one of antialias()
+template <typename BatchShader>
+TileImage renderTileAlone(
+        const Tile &tile,
+        const int width,
+        const int height,
+        const BatchShader &shader,
+        const Antialiasing &antialiasing,
+        RenderStats &tileStats,
+        Arena &scratch)
+{
+    const int left = std::max(0, tile.x - 1);
+    const int top = std::max(0, tile.y - 1);
+    const int right = std::min(width, tile.x + tile.width + 1);
+    const int bottom = std::min(height, tile.y + tile.height + 1);
+    TileImage source(left, top, right - left, bottom - top, scratch);
+    {
+        SampleBatch<BatchShader, TileImage> batch(source, shader, scratch);
+        for (int y = top; y < bottom; ++y)
+            for (int x = left; x < right; ++x) {
+                ++tileStats.pixelsTraced;
+                ++tileStats.samplesTraced;
+                batch.add({float(x), float(y)}, x, y, 1.0f);
+            }
+        batch.flush();
+    }
+    TileImage result(tile.x, tile.y, tile.width, tile.height, scratch);
+    {
+        SampleBatch<BatchShader, TileImage> batch(result, shader, scratch);
+        for (int y = tile.y; y < tile.y + tile.height; ++y)
+            for (int x = tile.x; x < tile.x + tile.width; ++x) {
+                if (antialiasing.supersampleCount() < 2 || contrast(source, x, y) <= antialiasing.contrastThreshold) {
+                    result.setPixel(x, y, source.pixel(x, y));
+                    continue;
+                }
+                tileStats.samplesTraced += supersample(batch, result, x, y, source.pixel(x, y), antialiasing);
+                ++tileStats.pixelsSupersampled;
+            }
+        batch.flush();
+    }
+    return result;
+}
+
+// renders a square frame of the stream resolution the way renderProgressive() renders its last level,
+// antialiasing included, without holding it: every tile is rendered with renderTileAlone(),
+// then handed to a TileStreamer that writes bands of tile rows as they are done;
+// shader(samples, count, colors, scratch) gives sample colors, worker scratch arenas are reset at the end;
+// returns false if the stream failed, see its errorString()
+template <typename BatchShader>
+bool renderStreamed(
+        ImageStream &stream,
+        QThreadPool &threadPool,
+        const int tileSize,
+        ScratchArenas &scratchArenas,
+        const BatchShader &shader,
+        const Antialiasing &antialiasing,
+        RenderStats *stats = nullptr)
+{
+    const int width = stream.width();
+    const int height = stream.height();
+    // enough bands for the rows of tiles workers are at, and one being written
+    const int tilesPerRow = (width + tileSize - 1) / tileSize;
+    const int maxBands = std::max(2, (threadPool.maxThreadCount() + tilesPerRow - 1) / tilesPerRow + 1);
+    TileStreamer streamer(stream, tileSize, maxBands);
+    const RenderStats renderStats = renderTiles(width, height, threadPool, tileSize, scratchArenas, [&](const Tile &tile, RenderStats &tileStats, Arena &scratch) {
+        if (!streamer.beginTile(tile.y))
+            return;
+        const ArenaScope scope(scratch);
+        const TileImage result = renderTileAlone(tile, width, height, shader, antialiasing, tileStats, scratch);
+        streamer.addTile(tile.x, tile.y, tile.width, tile.height, result.constData(), result.floatsPerLine());
+    });
+    scratchArenas.reset();
+    if (stats)
+        *stats = renderStats;
+    return streamer.finish();
+}
+
+#endif // TILERENDERER_H
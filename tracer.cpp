@@ -0,0 +1,571 @@
+#include "tracer.h"
+
+#include <cmath>
+#include <algorithm>
+#include <array>
+#include <limits>
+#include <utility>
+
+#include "profiler.h"
+
+namespace {
+
+thread_local RayStats threadStats;
+
+// bulbs past the first ones don't keep their last occluder, so the array doesn't need allocating
+constexpr int maxLastOccluders = 1024;
+
+// the shapes that blocked the last shadow rays of the calling thread to each bulb, kept across
+// castBatch() calls while their scene isn't edited
+struct LastOccluders
+{
+    const FlatScene *scene = nullptr;
+    int sceneRevision = 0;
+    int shapes[maxLastOccluders];
+};
+
+thread_local LastOccluders threadLastOccluders;
+
+// adds to a counter of threadStats, nothing is left of it when rays aren't counted
+inline void count(qint64 &counter, const qint64 amount = 1)
+{
+    if constexpr (RayStats::isCounted)
+        counter += amount;
+}
+
+}
+
+RayStats &RayStats::operator+=(const RayStats &other)
+{
+    primary += other.primary;
+    reflection += other.reflection;
+    shadow += other.shadow;
+    hits += other.hits;
+    shadowsBlocked += other.shadowsBlocked;
+    shadowsBlockedByLastOccluder += other.shadowsBlockedByLastOccluder;
+    cachedPrimary += other.cachedPrimary;
+    return *this;
+}
+
+RayStats RayStats::operator-(const RayStats &other) const
+{
+    RayStats res;
+    res.primary = primary - other.primary;
+    res.reflection = reflection - other.reflection;
+    res.shadow = shadow - other.shadow;
+    res.hits = hits - other.hits;
+    res.shadowsBlocked = shadowsBlocked - other.shadowsBlocked;
+    res.shadowsBlockedByLastOccluder = shadowsBlockedByLastOccluder - other.shadowsBlockedByLastOccluder;
+    res.cachedPrimary = cachedPrimary - other.cachedPrimary;
+    return res;
+}
+
+RayStats threadRayStats()
+{
+    return threadStats;
+}
+
+void RayFootprint::compact()
+{
+    for (QVector<int> *indices : {&shapes, &bulbs}) {
+        std::sort(indices->begin(), indices->end());
+        indices->erase(std::unique(indices->begin(), indices->end()), indices->end());
+    }
+}
+
+void RayFootprint::Bounds::extend(const Bounds &other)
+{
+    hits.extend(other.hits);
+    segments.extend(other.segments);
+    shadowSegments.extend(other.shadowSegments);
+    missOrigins.extend(other.missOrigins);
+    missDirections.extend(other.missDirections);
+}
+
+bool RayFootprint::Bounds::mayReach(const Aabb &bounds) const
+{
+    if (segments.intersects(bounds) || shadowSegments.intersects(bounds))
+        return true;
+    if (missOrigins.isEmpty())
+        return false;
+    // missed rays sweep their origin bounds to infinity along every axis they may go along
+    Aabb swept = missOrigins;
+    for (int axis = 0; axis < 3; ++axis) {
+        if (missDirections.max[axis] > 0.0f)
+            swept.max[axis] = std::numeric_limits<float>::max();
+        if (missDirections.min[axis] < 0.0f)
+            swept.min[axis] = -std::numeric_limits<float>::max();
+    }
+    return swept.intersects(bounds);
+}
+
+bool RayFootprint::mayReach(const Aabb &bounds) const
+{
+    return std::any_of(rays.begin(), rays.end(), [&](const Bounds &depthRays) {
+        return depthRays.mayReach(bounds);
+    });
+}
+
+bool RayFootprint::mayHitWithin(const Aabb &bounds) const
+{
+    return std::any_of(rays.begin(), rays.end(), [&](const Bounds &depthRays) {
+        return depthRays.hits.intersects(bounds);
+    });
+}
+
+namespace {
+
+struct Path
+{
+    Ray ray;
+    Color throughput;
+    // index of the ray, its color and its hits
+    int index;
+    const ExcludedShapes *excludedShapes;
+    // as in FlatScene
+    int shape;
+    float distance;
+    quint32 sortKey;
+};
+
+int clampedDepth(const TraceSettings &settings)
+{
+    return std::clamp(settings.maxDepth, 0, maxReflectionDepth);
+}
+
+// spreads 9 bits to every third bit
+quint32 spreadBits(quint32 value)
+{
+    value = (value | (value << 16)) & 0x030000ff;
+    value = (value | (value << 8)) & 0x0300f00f;
+    value = (value | (value << 4)) & 0x030c30c3;
+    value = (value | (value << 2)) & 0x09249249;
+    return value;
+}
+
+// direction octant above the morton code of the origin cell in a grid of 512 cells along each axis of bounds
+quint32 coherenceKey(const Ray &ray, const Aabb &bounds)
+{
+    const QVector3D size = bounds.max - bounds.min;
+    const auto cell = [](const float offset, const float size) {
+        return size > 0.0f ? static_cast<quint32>(std::clamp(offset / size, 0.0f, 1.0f) * 511) : 0u;
+    };
+    const quint32 morton = spreadBits(cell(ray.origin.x() - bounds.min.x(), size.x()))
+            | spreadBits(cell(ray.origin.y() - bounds.min.y(), size.y())) << 1
+            | spreadBits(cell(ray.origin.z() - bounds.min.z(), size.z())) << 2;
+    const quint32 octant = (ray.direction.x() < 0.0f) | (ray.direction.y() < 0.0f) << 1 | (ray.direction.z() < 0.0f) << 2;
+    return octant << 27 | morton;
+}
+
+// closest plane or instanced triangle nearer than distance, except the shapes isSkipped(shape) is true for;
+// lowers distance and sets shape to the one hit
+template <typename IsSkipped>
+void closestFlatHit(
+        const FlatScene &scene,
+        const QVector3D &origin,
+        const QVector3D &direction,
+        int &shape,
+        float &distance,
+        const IsSkipped &isSkipped)
+{
+    const FlatArray<FlatScene::Plane> &planes = scene.planes();
+    for (int index = 0; index < planes.size(); ++index) {
+        const float t = planes.at(index).distance(origin, direction);
+        if (t >= distance || isSkipped(scene.firstPlaneShape() + index))
+            continue;
+        distance = t;
+        shape = scene.firstPlaneShape() + index;
+    }
+    const FlatArray<FlatScene::Instance> &instances = scene.instances();
+    scene.instanceBvh().traverseLeaves(origin, direction, distance, [&](const int first, const int count, float &shortestDistance) {
+        for (int index = first; index < first + count; ++index) {
+            const FlatScene::Instance &instance = instances.at(index);
+            const FlatScene::MeshRange &mesh = scene.meshes().at(instance.mesh);
+            const QVector3D meshOrigin = instance.toMesh(origin);
+            const QVector3D meshDirection = instance.toMeshDirection(direction);
+            // triangle shapes of an instance follow the order of the triangles of its mesh
+            const int shapeOffset = instance.firstShape - mesh.firstTriangle;
+            float meshDistance = shortestDistance / instance.scale;
+            int triangle = -1;
+            scene.meshBvh(instance.mesh).traverseLeaves(meshOrigin, meshDirection, meshDistance, [&](const int leafFirst, const int leafCount, float &leafDistance) {
+                const int hit = scene.triangles().closestHit(mesh.firstTriangle + leafFirst, leafCount, meshOrigin, meshDirection, leafDistance, [&](const int candidate) {
+                    return isSkipped(shapeOffset + candidate);
+                });
+                if (hit >= 0) {
+                    triangle = hit;
+                    meshDistance = leafDistance;
+                }
+                return false;
+            });
+            if (triangle < 0)
+                continue;
+            shortestDistance = std::min(shortestDistance, meshDistance * instance.scale);
+            distance = shortestDistance;
+            shape = shapeOffset + triangle;
+        }
+        return false;
+    });
+}
+
+// any plane or instanced triangle hit not farther than maxDistance, except the shapes isSkipped(shape)
+// is true for; the shape found or -1
+template <typename IsSkipped>
+int anyFlatHit(
+        const FlatScene &scene,
+        const QVector3D &origin,
+        const QVector3D &direction,
+        const float maxDistance,
+        const IsSkipped &isSkipped)
+{
+    const FlatArray<FlatScene::Plane> &planes = scene.planes();
+    for (int index = 0; index < planes.size(); ++index)
+        if (planes.at(index).distance(origin, direction) <= maxDistance && !isSkipped(scene.firstPlaneShape() + index))
+            return scene.firstPlaneShape() + index;
+    const FlatArray<FlatScene::Instance> &instances = scene.instances();
+    int res = -1;
+    scene.instanceBvh().traverseLeaves(origin, direction, maxDistance, [&](const int first, const int count, float &distance) {
+        for (int index = first; index < first + count; ++index) {
+            const FlatScene::Instance &instance = instances.at(index);
+            const FlatScene::MeshRange &mesh = scene.meshes().at(instance.mesh);
+            const QVector3D meshOrigin = instance.toMesh(origin);
+            const QVector3D meshDirection = instance.toMeshDirection(direction);
+            const int shapeOffset = instance.firstShape - mesh.firstTriangle;
+            int triangle = -1;
+            scene.meshBvh(instance.mesh).traverseLeaves(meshOrigin, meshDirection, distance / instance.scale, [&](const int leafFirst, const int leafCount, float &leafDistance) {
+                triangle = scene.triangles().anyHit(mesh.firstTriangle + leafFirst, leafCount, meshOrigin, meshDirection, leafDistance, [&](const int candidate) {
+                    return isSkipped(shapeOffset + candidate);
+                });
+                return triangle >= 0;
+            });
+            if (triangle >= 0) {
+                res = shapeOffset + triangle;
+                return true;
+            }
+        }
+        return false;
+    });
+    return res;
+}
+
+// whether a single shape is hit not farther than maxDistance, the same way as the tests above
+template <typename IsSkipped>
+bool occludes(
+        const FlatScene &scene,
+        const int shape,
+        const QVector3D &origin,
+        const QVector3D &direction,
+        const float maxDistance,
+        const IsSkipped &isSkipped)
+{
+    if (shape < scene.firstPlaneShape())
+        return scene.spheres().anyHit(shape, 1, origin, direction, maxDistance, isSkipped) >= 0;
+    if (isSkipped(shape))
+        return false;
+    if (shape < scene.firstTriangleShape())
+        return scene.planes().at(shape - scene.firstPlaneShape()).distance(origin, direction) <= maxDistance;
+    const int instance = scene.shapeInstance(shape);
+    const FlatScene::Instance &placed = scene.instances().at(instance);
+    const TriangleArray::Triangle &triangle = scene.triangles().at(scene.instanceTriangle(instance, shape));
+    return TriangleArray::distance(triangle, placed.toMesh(origin), placed.toMeshDirection(direction)) <= maxDistance / placed.scale;
+}
+
+// closest sphere and, with hasFlatShapes, flat shape nearer than distance, see closestFlatHit()
+template <bool hasFlatShapes, typename IsSkipped>
+void closestHit(
+        const FlatScene &scene,
+        const QVector3D &origin,
+        const QVector3D &direction,
+        int &shape,
+        float &distance,
+        const IsSkipped &isSkipped)
+{
+    scene.sphereBvh().traverseLeaves(origin, direction, distance, [&](const int first, const int count, float &shortestDistance) {
+        const int index = scene.spheres().closestHit(first, count, origin, direction, shortestDistance, isSkipped);
+        if (index < 0)
+            return false;
+        shape = index;
+        distance = shortestDistance;
+        return false;
+    });
+    if constexpr (hasFlatShapes)
+        closestFlatHit(scene, origin, direction, shape, distance, isSkipped);
+}
+
+// paths has room for rayCount elements, hits for rayCount * (clampedDepth() + 1),
+// hits[index * (clampedDepth() + 1) + depth] is the shape hit by ray index at that depth;
+// lastOccluders has an element for each of the first lastOccluderCount bulbs, -1 or the shape
+// that blocked its last shadow ray;
+// code of the features left out of the kernel isn't compiled in
+template <int features>
+void castWavefront(
+        const FlatScene &scene,
+        const TraceSettings &settings,
+        const Ray *rays,
+        const int rayCount,
+        Color *colors,
+        Path *paths,
+        ExcludedShapes *hits,
+        int *lastOccluders,
+        const int lastOccluderCount,
+        RayFootprint *footprint,
+        PrimaryHit *primaryHits)
+{
+    RayStats &rayStats = threadStats;
+    const Bvh &bvh = scene.sphereBvh();
+    const SphereArray &spheres = scene.spheres();
+    const int maxDepth = features & kernel::Reflections ? clampedDepth(settings) : 0;
+    const bool recordsFootprint = features & kernel::Footprints && footprint;
+    const bool cachesPrimaryHits = features & kernel::PrimaryHits && primaryHits;
+    constexpr bool hasFlatShapes = features & kernel::FlatShapes;
+
+    for (int index = 0; index < rayCount; ++index) {
+        paths[index] = {rays[index], Color(1, 1, 1), index, nullptr, -1, 0.0f, 0};
+        colors[index] = Color();
+    }
+    int pathCount = rayCount;
+    for (int depth = 0; pathCount > 0; ++depth) {
+        count(depth ? rayStats.reflection : rayStats.primary, pathCount);
+        StageTimer timer(Stage::ClosestHits);
+        RayFootprint::Bounds depthRays;
+
+        for (int pathIndex = 0; pathIndex < pathCount; ++pathIndex) {
+            Path &path = paths[pathIndex];
+            const QVector3D &origin = path.ray.origin;
+            const QVector3D &direction = path.ray.direction;
+            path.shape = -1;
+            path.distance = std::numeric_limits<float>::max();
+            // primary paths are still in ray order
+            if (cachesPrimaryHits && depth == 0 && primaryHits[path.index].shape != PrimaryHit::unknown) {
+                path.shape = primaryHits[path.index].shape;
+                path.distance = primaryHits[path.index].distance;
+                count(rayStats.cachedPrimary);
+                continue;
+            }
+            closestHit<hasFlatShapes>(scene, origin, direction, path.shape, path.distance, [&](const int candidate) {
+                return isExcluded(path.excludedShapes, candidate);
+            });
+            if (cachesPrimaryHits && depth == 0)
+                primaryHits[path.index] = {path.shape, path.distance};
+        }
+
+        timer.switchTo(Stage::Shading);
+        int nextPathCount = 0;
+        for (int pathIndex = 0; pathIndex < pathCount; ++pathIndex) {
+            const Path path = paths[pathIndex];
+            if (path.shape < 0) {
+                colors[path.index] += path.throughput * settings.colorOnMiss;
+                if (recordsFootprint) {
+                    depthRays.missOrigins.extend(path.ray.origin);
+                    depthRays.missDirections.extend(path.ray.direction);
+                }
+                continue;
+            }
+            count(rayStats.hits);
+
+            const QVector3D intersectionOrigin = path.ray.origin + path.ray.direction * path.distance;
+            if (recordsFootprint) {
+                footprint->shapes.append(path.shape);
+                depthRays.hits.extend(intersectionOrigin);
+                depthRays.segments.extend(path.ray.origin);
+                depthRays.segments.extend(intersectionOrigin);
+            }
+            const bool isSphere = !hasFlatShapes || path.shape < scene.firstPlaneShape();
+            QVector3D normalDirection;
+            if (isSphere) {
+                normalDirection = (intersectionOrigin - spheres.center(path.shape)).normalized();
+            } else {
+                // flat shapes are seen from both sides, their normal faces the ray as the one of a sphere hit from outside
+                normalDirection = scene.shapeNormal(path.shape, intersectionOrigin);
+                if (QVector3D::dotProduct(normalDirection, path.ray.direction) > 0.0f)
+                    normalDirection = -normalDirection;
+            }
+            const int materialIndex = isSphere ? scene.sphereMaterials().at(path.shape) : scene.shapeMaterial(path.shape);
+            const FlatScene::Material &material = scene.materials().at(materialIndex);
+            ExcludedShapes &otherShapes = hits[path.index * (maxDepth + 1) + depth];
+            otherShapes = {path.shape, path.excludedShapes};
+
+            Color colorMask = settings.colorOnFullShade;
+            const auto shadeLight = [&](const FlatScene::PointLight &light) {
+                const QVector3D lightOffset = intersectionOrigin - light.center;
+                const float distanceSquared = lightOffset.lengthSquared();
+                if (distanceSquared <= 0.0f || distanceSquared >= light.radius * light.radius)
+                    return;
+                const float lightDistance = std::sqrt(distanceSquared);
+                const QVector3D lightDirection = lightOffset / lightDistance;
+                const float power = Bulb::falloff(QVector3D::dotProduct(lightDirection, normalDirection))
+                        * Bulb::attenuation(distanceSquared, light.radius);
+                if (power <= 0.0f)
+                    return;
+                // the shadow ray goes from the point to the light and stops at it
+                const QVector3D shadowDirection = -lightDirection;
+                count(rayStats.shadow);
+                if (recordsFootprint) {
+                    footprint->bulbs.append(int(&light - scene.bulbs().constData()));
+                    depthRays.shadowSegments.extend(intersectionOrigin);
+                    depthRays.shadowSegments.extend(light.center);
+                }
+                const auto isOtherShape = [&](const int candidate) {
+                    return otherShapes.contains(candidate);
+                };
+                // neighbouring points are mostly shadowed by the same shape
+                const int bulb = int(&light - scene.bulbs().constData());
+                int *lastOccluder = bulb < lastOccluderCount ? lastOccluders + bulb : nullptr;
+                const bool isLastOccluderHit = lastOccluder && *lastOccluder >= 0 && (hasFlatShapes
+                        ? occludes(scene, *lastOccluder, intersectionOrigin, shadowDirection, lightDistance, isOtherShape)
+                        : spheres.anyHit(*lastOccluder, 1, intersectionOrigin, shadowDirection, lightDistance, isOtherShape) >= 0);
+                if (isLastOccluderHit) {
+                    count(rayStats.shadowsBlocked);
+                    count(rayStats.shadowsBlockedByLastOccluder);
+                    return;
+                }
+                int occluder = -1;
+                bvh.traverseLeaves(intersectionOrigin, shadowDirection, lightDistance, [&](const int first, const int count, float &maxDistance) {
+                    occluder = spheres.anyHit(first, count, intersectionOrigin, shadowDirection, maxDistance, isOtherShape);
+                    return occluder >= 0;
+                });
+                if constexpr (hasFlatShapes)
+                    if (occluder < 0)
+                        occluder = anyFlatHit(scene, intersectionOrigin, shadowDirection, lightDistance, isOtherShape);
+                if (occluder >= 0) {
+                    count(rayStats.shadowsBlocked);
+                    if (lastOccluder)
+                        *lastOccluder = occluder;
+                } else {
+                    colorMask += power * light.color;
+                }
+            };
+            // without bulbs of finite radius all of them are unbounded ones, visited in the same order
+            if constexpr (features & kernel::BoundedBulbs)
+                scene.visitBulbsAt(intersectionOrigin, shadeLight);
+            else
+                for (const FlatScene::PointLight &light : scene.bulbs())
+                    shadeLight(light);
+            colors[path.index] += path.throughput * material.color * (1 - material.mirror) * colorMask;
+
+            if (!(features & kernel::Reflections) || material.mirror <= 0.0f || depth >= maxDepth)
+                continue;
+            const Color throughput = path.throughput * material.mirror * colorMask;
+            if (std::max({throughput.x(), throughput.y(), throughput.z()}) < settings.minThroughput)
+                continue;
+            const QVector3D reflectionDirection = path.ray.direction - 2 * normalDirection * QVector3D::dotProduct(path.ray.direction, normalDirection);
+            paths[nextPathCount++] = {{intersectionOrigin, reflectionDirection}, throughput, path.index, &otherShapes, -1, 0.0f, 0};
+        }
+        pathCount = nextPathCount;
+        if (recordsFootprint) {
+            if (footprint->rays.size() <= depth)
+                footprint->rays.resize(depth + 1);
+            footprint->rays[depth].extend(depthRays);
+        }
+        if (features & kernel::SortedRays && settings.sortSecondaryRays && pathCount > 1 && !bvh.nodes().isEmpty()) {
+            const Aabb &bounds = bvh.nodes().at(0).bounds;
+            for (int pathIndex = 0; pathIndex < pathCount; ++pathIndex)
+                paths[pathIndex].sortKey = coherenceKey(paths[pathIndex].ray, bounds);
+            std::sort(paths, paths + pathCount, [](const Path &a, const Path &b) {
+                return a.sortKey < b.sortKey;
+            });
+        }
+    }
+}
+
+template <int features>
+void castBatchWith(
+        const FlatScene &scene,
+        const TraceSettings &settings,
+        const Ray *rays,
+        const int count,
+        Color *colors,
+        Arena &scratch,
+        RayFootprint *footprint,
+        PrimaryHit *primaryHits)
+{
+    const ArenaScope scope(scratch);
+    Path *paths = scratch.allocateArray<Path>(count);
+    ExcludedShapes *hits = scratch.allocateArray<ExcludedShapes>(count * (clampedDepth(settings) + 1));
+    // neighbouring batches are shadowed by the same shapes too
+    LastOccluders &lastOccluders = threadLastOccluders;
+    const int lastOccluderCount = std::min(int(scene.bulbs().size()), maxLastOccluders);
+    if (lastOccluders.scene != &scene || lastOccluders.sceneRevision != scene.revision()) {
+        lastOccluders.scene = &scene;
+        lastOccluders.sceneRevision = scene.revision();
+        std::fill_n(lastOccluders.shapes, lastOccluderCount, -1);
+    }
+    castWavefront<features>(scene, settings, rays, count, colors, paths, hits, lastOccluders.shapes, lastOccluderCount, footprint, primaryHits);
+}
+
+template <int... features>
+constexpr std::array<BatchKernel, sizeof...(features)> batchKernels(std::integer_sequence<int, features...>)
+{
+    return {&castBatchWith<features>...};
+}
+
+// indexed by features
+constexpr std::array<BatchKernel, kernel::All + 1> kernels = batchKernels(std::make_integer_sequence<int, kernel::All + 1>());
+
+}
+
+Color cast(const FlatScene &scene, const TraceSettings &settings, const Ray &ray)
+{
+    Path path;
+    ExcludedShapes hits[maxReflectionDepth + 1];
+    Color color;
+    castWavefront<kernel::All>(scene, settings, &ray, 1, &color, &path, hits, nullptr, 0, nullptr, nullptr);
+    return color;
+}
+
+void castBatch(
+        const FlatScene &scene,
+        const TraceSettings &settings,
+        const Ray *rays,
+        const int count,
+        Color *colors,
+        Arena &scratch,
+        RayFootprint *footprint,
+        PrimaryHit *primaryHits)
+{
+    castBatchWith<kernel::All>(scene, settings, rays, count, colors, scratch, footprint, primaryHits);
+}
+
+void closestHits(const FlatScene &scene, const Ray *rays, const int count, PrimaryHit *hits)
+{
+    const auto isSkipped = [](int) {
+        return false;
+    };
+    for (int index = 0; index < count; ++index) {
+        const Ray &ray = rays[index];
+        int shape = -1;
+        float distance = std::numeric_limits<float>::max();
+        if (scene.hasFlatShapes())
+            closestHit<true>(scene, ray.origin, ray.direction, shape, distance, isSkipped);
+        else
+            closestHit<false>(scene, ray.origin, ray.direction, shape, distance, isSkipped);
+        hits[index] = {shape, distance};
+    }
+}
+
+int kernelFeatures(
+        const FlatScene &scene,
+        const TraceSettings &settings,
+        const bool recordsFootprint,
+        const bool cachesPrimaryHits)
+{
+    int features = 0;
+    const bool reflects = settings.maxDepth > 0 && scene.hasMirrors();
+    if (reflects)
+        features |= kernel::Reflections;
+    if (scene.hasBoundedBulbs())
+        features |= kernel::BoundedBulbs;
+    if (reflects && settings.sortSecondaryRays)
+        features |= kernel::SortedRays;
+    if (recordsFootprint)
+        features |= kernel::Footprints;
+    if (cachesPrimaryHits)
+        features |= kernel::PrimaryHits;
+    if (scene.hasFlatShapes())
+        features |= kernel::FlatShapes;
+    return features;
+}
+
+BatchKernel batchKernel(const int features)
+{
+    return kernels.at(features & kernel::All);
+}
@@ -0,0 +1,187 @@
+#ifndef TRACER_H
+#define TRACER_H
+
+#include <QVector>
+#include <QVector3D>
+
+#include "arena.h"
+#include "flatscene.h"
+
+// shapes hit on the way to the current ray, chained through the bounces of its path,
+// so skipping them costs nothing to allocate
+struct ExcludedShapes
+{
+    int index = -1;
+    const ExcludedShapes *previous = nullptr;
+
+    bool contains(const int shapeIndex) const
+    {
+        for (const ExcludedShapes *excluded = this; excluded; excluded = excluded->previous)
+            if (excluded->index == shapeIndex)
+                return true;
+        return false;
+    }
+};
+
+inline bool isExcluded(const ExcludedShapes *excludedShapes, const int shapeIndex)
+{
+    return excludedShapes && excludedShapes->contains(shapeIndex);
+}
+
+// rays are counted by profiling builds and ones configured with ray_stats, such as the benchmark;
+// otherwise the kernels don't touch the counters and they stay 0
+struct RayStats
+{
+#if defined(YART_PROFILING) || defined(YART_RAY_STATS)
+    static constexpr bool isCounted = true;
+#else
+    static constexpr bool isCounted = false;
+#endif
+
+    qint64 primary = 0;
+    qint64 reflection = 0;
+    qint64 shadow = 0;
+    // primary and reflection rays that hit a shape
+    qint64 hits = 0;
+    qint64 shadowsBlocked = 0;
+    // blocked shadow rays found by the shape that blocked the previous one of their bulb in the batch,
+    // without traversing the bvh
+    qint64 shadowsBlockedByLastOccluder = 0;
+    // primary rays whose hit was taken from a PrimaryHit instead of traced
+    qint64 cachedPrimary = 0;
+
+    RayStats &operator+=(const RayStats &other);
+    RayStats operator-(const RayStats &other) const;
+};
+
+// rays cast by the calling thread so far
+RayStats threadRayStats();
+
+struct Ray
+{
+    QVector3D origin;
+    QVector3D direction;
+};
+
+struct TraceSettings
+{
+    Color colorOnMiss;
+    Color colorOnFullShade;
+    // mirror bounces followed after the primary hit, up to maxReflectionDepth
+    int maxDepth = 8;
+    // a bounce is not traced once no channel of its weight in the pixel color is above that,
+    // the default stays below what 8 bit output shows
+    float minThroughput = 1.0f / 1024;
+    // reflected rays of a batch are sorted by direction octant and origin cell before
+    // they are traced, so neighbour rays visit the same bvh nodes
+    bool sortSecondaryRays = false;
+};
+
+// what colors of traced rays depend on, gathered by castBatch() for incremental rendering
+struct RayFootprint
+{
+    // rays of one depth, of all the castBatch() calls the footprint was given to
+    struct Bounds
+    {
+        // points hit by the rays
+        Aabb hits;
+        // ray segments up to what they hit and shadow rays ones from the hits to their lights
+        Aabb segments;
+        Aabb shadowSegments;
+        // rays that hit nothing start within missOrigins, their directions are within missDirections
+        Aabb missOrigins;
+        Aabb missDirections;
+
+        void extend(const Bounds &other);
+        bool mayReach(const Aabb &bounds) const;
+    };
+
+    // shapes hit by primary and reflected rays and bulbs shadow rays were cast to, may repeat;
+    // shapes are numbered as in FlatScene
+    QVector<int> shapes;
+    QVector<int> bulbs;
+    // indexed by depth, so it doesn't grow with the batches traced
+    QVector<Bounds> rays;
+
+    // sorts the lists and drops repeats
+    void compact();
+    // whether any of the rays could reach into bounds, taking missed ones as going on forever
+    bool mayReach(const Aabb &bounds) const;
+    // whether any of the rays hit a point within bounds
+    bool mayHitWithin(const Aabb &bounds) const;
+};
+
+// closest hit of a primary ray kept across castBatch() calls, so the ray isn't traced again
+// while shapes stay where they are; the hit point and normal follow from it as when it was traced
+struct PrimaryHit
+{
+    static constexpr int unknown = -2;
+
+    // shape index as in FlatScene, -1 if the ray hits nothing
+    int shape = unknown;
+    float distance = 0.0f;
+};
+
+constexpr int maxReflectionDepth = 16;
+// rays the tile renderer gathers for a castBatch() call
+constexpr int maxBatchSize = 64;
+
+Color cast(const FlatScene &scene, const TraceSettings &settings, const Ray &ray);
+// traces every bounce depth of all rays before the next one: their closest hits first,
+// then shadow rays of these hits, then reflected rays of the mirrors among them;
+// its state is allocated in scratch and freed on return; what the colors depend on
+// is added to footprint if given, its lists may allocate; primaryHits, if given, has a hit
+// per ray: known ones are used instead of tracing the ray, unknown ones are traced and stored
+void castBatch(
+        const FlatScene &scene,
+        const TraceSettings &settings,
+        const Ray *rays,
+        int count,
+        Color *colors,
+        Arena &scratch,
+        RayFootprint *footprint = nullptr,
+        PrimaryHit *primaryHits = nullptr);
+
+// closest hits of rays as castBatch() finds the ones of primary rays, nothing is shaded
+// and the rays aren't counted in RayStats
+void closestHits(const FlatScene &scene, const Ray *rays, int count, PrimaryHit *hits);
+
+// castBatch() compiled without the code of what a frame doesn't use,
+// picked once per frame by the features found with kernelFeatures()
+using BatchKernel = void (*)(
+        const FlatScene &scene,
+        const TraceSettings &settings,
+        const Ray *rays,
+        int count,
+        Color *colors,
+        Arena &scratch,
+        RayFootprint *footprint,
+        PrimaryHit *primaryHits);
+namespace kernel {
+enum Feature
+{
+    // mirrors are traced up to TraceSettings::maxDepth, otherwise paths end at their first hit
+    Reflections = 1,
+    // bulbs of finite radius are looked up in their bvh, otherwise all bulbs are visited
+    BoundedBulbs = 2,
+    // reflected rays are sorted if TraceSettings::sortSecondaryRays
+    SortedRays = 4,
+    // the footprint is gathered if given
+    Footprints = 8,
+    // primary hits are read and stored if given
+    PrimaryHits = 16,
+    // planes and instanced triangles are traced besides spheres
+    FlatShapes = 32,
+    All = Reflections | BoundedBulbs | SortedRays | Footprints | PrimaryHits | FlatShapes,
+};
+}
+// features of kernel::Feature that tracing the scene with settings needs; the result
+// is only valid as long as the scene's materials and bulbs stay as they are
+int kernelFeatures(
+        const FlatScene &scene,
+        const TraceSettings &settings,
+        bool recordsFootprint = false,
+        bool cachesPrimaryHits = false);
+BatchKernel batchKernel(int features);
+
+#endif // TRACER_H
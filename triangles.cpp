@@ -0,0 +1,22 @@
+#include "triangles.h"
+
+void TriangleArray::append(const QVector3D &a, const QVector3D &b, const QVector3D &c)
+{
+    triangles_.append({a, b - a, c - a});
+}
+
+Aabb TriangleArray::bounds(const int index) const
+{
+    const Triangle &triangle = triangles_.at(index);
+    Aabb res;
+    res.extend(triangle.corner);
+    res.extend(triangle.corner + triangle.edge1);
+    res.extend(triangle.corner + triangle.edge2);
+    return res;
+}
+
+QVector3D TriangleArray::normal(const int index) const
+{
+    const Triangle &triangle = triangles_.at(index);
+    return QVector3D::crossProduct(triangle.edge1, triangle.edge2).normalized();
+}
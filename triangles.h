@@ -0,0 +1,116 @@
+#ifndef TRIANGLES_H
+#define TRIANGLES_H
+
+#include <limits>
+
+#include <QVector3D>
+
+#include "aabb.h"
+#include "flatarray.h"
+
+// triangles as a corner and the two edges leaving it, tested one at a time with Moller-Trumbore;
+// they aren't packed for simd as spheres are, mesh leaves are small and the test branches early
+class TriangleArray
+{
+public:
+    struct Triangle
+    {
+        QVector3D corner;
+        QVector3D edge1;
+        QVector3D edge2;
+    };
+
+    void append(const QVector3D &a, const QVector3D &b, const QVector3D &c);
+    void append(const Triangle &triangle) { triangles_.append(triangle); }
+    int size() const { return triangles_.size(); }
+    const Triangle &at(int index) const { return triangles_.at(index); }
+    Aabb bounds(int index) const;
+    // not facing any side in particular
+    QVector3D normal(int index) const;
+
+    // closest hit among triangles [first, first + count) nearer than distance, except the ones
+    // isSkipped(triangleIndex) is true for; lowers distance and returns index of the triangle or -1
+    template <typename IsSkipped>
+    int closestHit(
+            int first,
+            int count,
+            const QVector3D &origin,
+            const QVector3D &direction,
+            float &distance,
+            const IsSkipped &isSkipped) const;
+    // whether any of these triangles is hit not farther than maxDistance, the index of the first one
+    // found or -1
+    template <typename IsSkipped>
+    int anyHit(
+            int first,
+            int count,
+            const QVector3D &origin,
+            const QVector3D &direction,
+            float maxDistance,
+            const IsSkipped &isSkipped) const;
+
+    // distance along the ray to triangle or infinity; hits at zero distance don't count,
+    // edges shared by two triangles hit both
+    static float distance(const Triangle &triangle, const QVector3D &origin, const QVector3D &direction);
+
+private:
+    FlatArray<Triangle> triangles_;
+};
+
+inline float TriangleArray::distance(const Triangle &triangle, const QVector3D &origin, const QVector3D &direction)
+{
+    constexpr float miss = std::numeric_limits<float>::infinity();
+    const QVector3D p = QVector3D::crossProduct(direction, triangle.edge2);
+    const float determinant = QVector3D::dotProduct(triangle.edge1, p);
+    // parallel to the plane of the triangle
+    if (determinant == 0.0f)
+        return miss;
+    const float inverseDeterminant = 1.0f / determinant;
+    const QVector3D s = origin - triangle.corner;
+    const float u = QVector3D::dotProduct(s, p) * inverseDeterminant;
+    if (u < 0.0f || u > 1.0f)
+        return miss;
+    const QVector3D q = QVector3D::crossProduct(s, triangle.edge1);
+    const float v = QVector3D::dotProduct(direction, q) * inverseDeterminant;
+    if (v < 0.0f || u + v > 1.0f)
+        return miss;
+    const float t = QVector3D::dotProduct(triangle.edge2, q) * inverseDeterminant;
+    return t > 0.0f ? t : miss;
+}
+
+template <typename IsSkipped>
+int TriangleArray::closestHit(
+        const int first,
+        const int count,
+        const QVector3D &origin,
+        const QVector3D &direction,
+        float &distance,
+        const IsSkipped &isSkipped) const
+{
+    int res = -1;
+    for (int index = first; index < first + count; ++index) {
+        const float t = TriangleArray::distance(triangles_.at(index), origin, direction);
+        if (t >= distance || isSkipped(index))
+            continue;
+        distance = t;
+        res = index;
+    }
+    return res;
+}
+
+template <typename IsSkipped>
+int TriangleArray::anyHit(
+        const int first,
+        const int count,
+        const QVector3D &origin,
+        const QVector3D &direction,
+        const float maxDistance,
+        const IsSkipped &isSkipped) const
+{
+    for (int index = first; index < first + count; ++index)
+        if (TriangleArray::distance(triangles_.at(index), origin, direction) <= maxDistance && !isSkipped(index))
+            return index;
+    return -1;
+}
+
+#endif // TRIANGLES_H
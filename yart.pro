@@ -0,0 +1,7 @@
+# the renderer as a static library to embed in other programs, see Renderer in renderer.h;
+# they add its directory to INCLUDEPATH and link it with LIBS += -lyart
+TEMPLATE = lib
+CONFIG += staticlib
+TARGET = yart
+
+include(raytracer.pri)